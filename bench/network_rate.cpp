@@ -0,0 +1,204 @@
+/**
+ * Benchmark of NetworkCoreService connection and request rates over loopback.
+ * Connection rate: every request is sent over a new connection. Request rate:
+ * requests are pipelined over persistent connections
+ *
+ * Usage: bench_network_rate [clients] [reactors]
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "core_service.hpp"
+#include "wire_protocol.hpp"
+
+namespace {
+    // Connections opened by every client
+    constexpr size_t CLIENT_CONNECTIONS{ 2000 };
+    // Requests sent by every client over its persistent connection
+    constexpr size_t CLIENT_REQUESTS{ 100000 };
+    // Requests sent by a client before it reads the responses
+    constexpr size_t PIPELINE_DEPTH{ 32 };
+
+    /**
+     * Connect to the service on the loopback interface
+     *
+     * @return Socket, -1 on failure
+     */
+    int connectService() {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+            return -1;
+        }
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(NetworkCoreService::DEFAULT_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int noDelay{ 1 };
+        if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+           setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /**
+     * Write all the data
+     *
+     * @param fd Socket
+     * @param data Data
+     * @return False on failure
+     */
+    bool writeAll(int fd, const string &data) {
+        size_t written{ 0 };
+        while(written < data.size()) {
+            auto count = write(fd, data.data() + written, data.size() - written);
+            if(count < 0 && errno == EINTR) continue;
+            if(count <= 0) return false;
+            written += count;
+        }
+        return true;
+    }
+
+    /**
+     * Read exactly the requested number of bytes
+     *
+     * @param fd Socket
+     * @param buffer Output
+     * @param size Number of bytes
+     * @return False on failure or end of stream
+     */
+    bool readAll(int fd, char *buffer, size_t size) {
+        while(size) {
+            auto count = read(fd, buffer, size);
+            if(count < 0 && errno == EINTR) continue;
+            if(count <= 0) return false;
+            buffer += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    /**
+     * Read a response frame to the benchmark search
+     *
+     * @param fd Socket
+     * @param payload Buffer reused for the payload
+     * @return False on failure or if the search wasn't executed (it finds nothing)
+     */
+    bool readResponse(int fd, string &payload) {
+        char header[WireProtocol::FRAME_HEADER_SIZE];
+        if(!readAll(fd, header, sizeof(header))) {
+            return false;
+        }
+        payload.resize(WireProtocol::decodeFrameLength(header));
+        if(!readAll(fd, &payload[0], payload.size())) {
+            return false;
+        }
+        return WireProtocol::decodeResponse(payload).getCode() == ReturnCode::NOT_FOUND;
+    }
+
+    /**
+     * Run clients in parallel and report the rate
+     *
+     * @param name Measurement name
+     * @param clients Number of client threads
+     * @param operations Operations done by every client
+     * @param client Client body, returns number of failed operations
+     */
+    void measure(const char *name, size_t clients, size_t operations, const function<size_t()> &client) {
+        atomic<size_t> failures{ 0 };
+        auto start = LatencyStats::now();
+        vector<thread> clientThreads;
+        for(size_t idx = 0; idx < clients; ++idx) {
+            clientThreads.emplace_back([&failures, &client]() {
+                failures.fetch_add(client());
+            });
+        }
+        for(auto &clientThread : clientThreads) {
+            clientThread.join();
+        }
+        auto elapsed = LatencyStats::now() - start;
+        std::cout << name << ": " << clients * operations * 1000000000ULL / elapsed << "/s"
+                  << ", " << failures.load() << " failed\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t clients = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8;
+    size_t reactors = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0;
+
+    shared_ptr<Core> core{ new Core };
+    core->start();
+    NetworkCoreService service{ core, ThreadPool::instance(), ServiceLimits{}, reactors };
+    thread serviceThread{ [&service]() {
+        try {
+            service.start();
+        } catch(const string& ex) {
+            std::cerr << ex << std::endl;
+        }
+    } };
+
+    // Search on an empty query cache and no matching records: the service path dominates
+    RecordQuery query;
+    query.allTags.push_back("bench-no-such-tag");
+    auto message = WireProtocol::encodeAction(SearchRecordsAction{ RecordQuery{ query } });
+    string request(WireProtocol::FRAME_HEADER_SIZE, '\0');
+    WireProtocol::encodeFrameLength(&request[0], message.size());
+    request += message;
+
+    int probe;
+    while((probe = connectService()) < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    close(probe);
+
+    measure("connections", clients, CLIENT_CONNECTIONS, [&request]() {
+        size_t failures{ 0 };
+        string payload;
+        for(size_t idx = 0; idx < CLIENT_CONNECTIONS; ++idx) {
+            int fd = connectService();
+            if(fd < 0 || !writeAll(fd, request) || !readResponse(fd, payload)) {
+                ++failures;
+            }
+            if(fd >= 0) close(fd);
+        }
+        return failures;
+    });
+
+    string pipeline;
+    for(size_t idx = 0; idx < PIPELINE_DEPTH; ++idx) {
+        pipeline += request;
+    }
+    measure("requests", clients, CLIENT_REQUESTS, [&pipeline]() {
+        int fd = connectService();
+        if(fd < 0) {
+            return CLIENT_REQUESTS;
+        }
+
+        size_t failures{ 0 };
+        string payload;
+        for(size_t sent = 0; sent < CLIENT_REQUESTS; sent += PIPELINE_DEPTH) {
+            if(!writeAll(fd, pipeline)) {
+                failures += CLIENT_REQUESTS - sent;
+                break;
+            }
+            for(size_t idx = 0; idx < PIPELINE_DEPTH; ++idx) {
+                if(!readResponse(fd, payload)) ++failures;
+            }
+        }
+        close(fd);
+        return failures;
+    });
+
+    service.stop();
+    serviceThread.join();
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * Benchmark of Core Action enqueue -> execution latency of LocalCoreService.
+ * Measures the dispatcher waking up from the parked state, the hot path of
+ * back-to-back Actions and the queue wait under concurrent producers
+ *
+ * Usage: bench_queue_latency [producers]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include "core_service.hpp"
+
+namespace {
+    // Actions sent one at a time after the dispatcher parked
+    constexpr size_t PARKED_ACTIONS{ 200 };
+    // Actions sent one at a time back-to-back
+    constexpr size_t HOT_ACTIONS{ 20000 };
+    // Actions sent by every concurrent producer
+    constexpr size_t PRODUCER_ACTIONS{ 50000 };
+
+    /**
+     * Core Action doing nothing, measures the dispatch only
+     */
+    struct PingAction: public CoreAction {
+        Response run() override {
+            return { ReturnCode::OK };
+        }
+
+        void undo() override {}
+
+        const char* getName() const override {
+            return "Ping";
+        }
+    };
+
+    /**
+     * Execute a Ping Action and wait for the response
+     *
+     * @param service Core Service
+     * @return Round trip time, nanoseconds
+     */
+    uint64_t ping(LocalCoreService &service) {
+        auto start = LatencyStats::now();
+        service.execAction(unique_ptr<CoreAction>{ new PingAction }).get();
+        return LatencyStats::now() - start;
+    }
+
+    /**
+     * Print percentiles of measured intervals
+     *
+     * @param name Measurement name
+     * @param nanos Intervals, nanoseconds
+     */
+    void printLatencies(const char *name, vector<uint64_t> &nanos) {
+        std::sort(nanos.begin(), nanos.end());
+        auto percentile = [&nanos](size_t p) {
+            return nanos[std::min(nanos.size() - 1, nanos.size() * p / 100)] / 1000.0;
+        };
+        std::cout << std::fixed << std::setprecision(1) << name << " round trip"
+                  << " count=" << nanos.size()
+                  << " p50=" << percentile(50) << "us"
+                  << " p99=" << percentile(99) << "us"
+                  << " max=" << nanos.back() / 1000.0 << "us\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t producers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+
+    LatencyStats::instance().setEnabled(true);
+    shared_ptr<Core> core{ new Core };
+    LocalCoreService service{ core };
+    service.start();
+
+    // Dispatcher parks between Actions
+    vector<uint64_t> nanos;
+    for(size_t idx = 0; idx < PARKED_ACTIONS; ++idx) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        nanos.push_back(ping(service));
+    }
+    printLatencies("parked", nanos);
+
+    nanos.clear();
+    for(size_t idx = 0; idx < HOT_ACTIONS; ++idx) {
+        nanos.push_back(ping(service));
+    }
+    printLatencies("hot", nanos);
+
+    // Concurrent producers, rejected Actions are sent again
+    auto start = LatencyStats::now();
+    vector<thread> producerThreads;
+    for(size_t producer = 0; producer < producers; ++producer) {
+        producerThreads.emplace_back([&service]() {
+            vector<future<Response>> responses;
+            responses.reserve(PRODUCER_ACTIONS);
+            size_t sent{ 0 };
+            while(sent < PRODUCER_ACTIONS) {
+                auto response = service.execAction(unique_ptr<CoreAction>{ new PingAction });
+                if(response.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    responses.push_back(std::move(response));
+                    ++sent;
+                } else if(response.get().getCode() == ReturnCode::OVERLOADED) {
+                    std::this_thread::yield();
+                } else {
+                    ++sent;
+                }
+            }
+            for(auto &response : responses) {
+                response.wait();
+            }
+        });
+    }
+    for(auto &producerThread : producerThreads) {
+        producerThread.join();
+    }
+    auto elapsed = LatencyStats::now() - start;
+    std::cout << producers << " producers: "
+              << producers * PRODUCER_ACTIONS * 1000000000ULL / elapsed << " actions/s\n";
+
+    service.stop();
+
+    // Enqueue -> dequeue and dequeue -> execution of all the Actions above
+    std::cout << LatencyStats::instance().report();
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * Benchmark of WireProtocol encoding and decoding of requests and responses.
+ * Responses are also serialized with the Boost text archive of the data file
+ * for comparison
+ *
+ * Usage: bench_wire_protocol [records]
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "core_action.hpp"
+#include "latency_stats.hpp"
+#include "wire_protocol.hpp"
+
+#include "boost/archive/text_iarchive.hpp"
+#include "boost/archive/text_oarchive.hpp"
+#include "boost/serialization/vector.hpp"
+
+namespace {
+    // Encoded and decoded bytes measured per case
+    constexpr size_t MEASURED_BYTES{ 256 * 1024 * 1024 };
+    // Record text length
+    constexpr size_t TEXT_SIZE{ 200 };
+
+    /**
+     * Run an operation repeatedly and report its rate
+     *
+     * @param name Case name
+     * @param bytes Bytes processed by one operation
+     * @param operation Operation
+     */
+    void measure(const char *name, size_t bytes, const function<void()> &operation) {
+        auto iterations = std::max<size_t>(MEASURED_BYTES / std::max<size_t>(bytes, 1) / 16, 100);
+        auto start = LatencyStats::now();
+        for(size_t idx = 0; idx < iterations; ++idx) {
+            operation();
+        }
+        auto elapsed = LatencyStats::now() - start;
+        std::cout << std::fixed << std::setprecision(1) << name << ": "
+                  << iterations * 1000000000.0 / elapsed << " ops/s, "
+                  << iterations * bytes * 1000.0 / elapsed << " MB/s, "
+                  << bytes << " bytes\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t recordsCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+
+    AddRecordAction add{ string(TEXT_SIZE, 'a'), vector<string>{ "work", "todo" } };
+    auto addMessage = WireProtocol::encodeAction(add);
+    measure("encode AddRecord", addMessage.size(), [&add]() {
+        WireProtocol::encodeAction(add);
+    });
+    measure("decode AddRecord", addMessage.size(), [&addMessage]() {
+        WireProtocol::decodeAction(addMessage);
+    });
+
+    RecordQuery query;
+    query.allTags = { "work" };
+    query.anyTags = { "todo", "done" };
+    query.fragment = "meeting";
+    query.cdateAfter = boost::gregorian::date{ 2020, 1, 1 };
+    SearchRecordsAction search{ std::move(query) };
+    auto searchMessage = WireProtocol::encodeAction(search);
+    measure("encode SearchRecords", searchMessage.size(), [&search]() {
+        WireProtocol::encodeAction(search);
+    });
+    measure("decode SearchRecords", searchMessage.size(), [&searchMessage]() {
+        WireProtocol::decodeAction(searchMessage);
+    });
+
+    vector<Record> records;
+    for(size_t idx = 0; idx < recordsCount; ++idx) {
+        records.emplace_back(string(TEXT_SIZE, 'a' + idx % 26), vector<string>{ "tag" + std::to_string(idx % 10) });
+        records.back().setId(idx);
+    }
+    Response response{ ReturnCode::OK, vector<Record>{ records } };
+    auto responseMessage = WireProtocol::encodeResponse(response);
+    measure("encode response", responseMessage.size(), [&response]() {
+        WireProtocol::encodeResponse(response);
+    });
+    measure("decode response", responseMessage.size(), [&responseMessage]() {
+        WireProtocol::decodeResponse(responseMessage);
+    });
+
+    std::ostringstream archived;
+    {
+        boost::archive::text_oarchive oa(archived);
+        oa << records;
+    }
+    auto archive = archived.str();
+    measure("text archive save", archive.size(), [&records]() {
+        std::ostringstream os;
+        boost::archive::text_oarchive oa(os);
+        oa << records;
+    });
+    measure("text archive load", archive.size(), [&archive]() {
+        std::istringstream is(archive);
+        boost::archive::text_iarchive ia(is);
+        vector<Record> loaded;
+        ia >> loaded;
+    });
+    return 0;
+}
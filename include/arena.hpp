@@ -0,0 +1,135 @@
+#ifndef _ARENA_HPP_
+#define _ARENA_HPP_
+
+#include <cstddef>
+#include <unordered_set>
+#include <vector>
+
+using std::unordered_set;
+using std::vector;
+
+/**
+ * Arena memory usage statistics
+ */
+struct ArenaStats {
+    // Number of memory chunks requested from the system
+    size_t chunks;
+    // Memory requested from the system (bytes)
+    size_t reservedBytes;
+    // Memory occupied by live blocks (bytes)
+    size_t usedBytes;
+    // Memory of released blocks kept for reuse (bytes)
+    size_t pooledBytes;
+    // Number of blocks allocated
+    size_t allocations;
+    // Number of allocations served by released blocks
+    size_t poolHits;
+};
+
+/**
+ * Bump allocator for record data. Memory is taken from the system in large chunks
+ * and released all at once when the arena is destroyed. Blocks are rounded up to
+ * power of two size classes, released blocks are kept in per-class pools and reused
+ * by subsequent allocations of the same class
+ */
+class Arena {
+public:
+    /**
+     * Constructor
+     */
+    Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Destructor. Releases all chunks
+     */
+    ~Arena();
+
+    /**
+     * Allocate a block
+     *
+     * @param size Block size, rounded up to its size class
+     * @return Pointer to the block, aligned for any integral type
+     */
+    char* allocate(size_t size);
+
+    /**
+     * Release a block for reuse
+     *
+     * @param block Block allocated by this arena
+     * @param size Size the block was allocated with
+     */
+    void deallocate(char *block, size_t size);
+
+    /**
+     * Get memory usage statistics
+     *
+     * @return Statistics
+     */
+    ArenaStats getStats() const;
+
+private:
+    static constexpr size_t CHUNK_SIZE{ 1024 * 1024 };
+    static constexpr size_t ALIGNMENT{ sizeof(void*) };
+    // Size classes are powers of two: 8, 16, ... 256K. The smallest class holds a free list link
+    static constexpr size_t SIZE_CLASSES{ 16 };
+    static constexpr size_t MIN_CLASS_SIZE{ ALIGNMENT };
+    // Blocks larger than the biggest size class are allocated separately
+    static constexpr size_t MAX_CLASS_SIZE{ MIN_CLASS_SIZE << (SIZE_CLASSES - 1) };
+
+    /**
+     * Released block. Next block pointer is stored in the block itself
+     */
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    // Chunks filled by bump allocation
+    vector<char*> chunks;
+    // Blocks too large for a chunk, allocated separately
+    unordered_set<char*> largeBlocks;
+    // Bump allocation position in the current chunk
+    char *cursor;
+    char *limit;
+    // Released blocks: pools[i] holds blocks of MIN_CLASS_SIZE << i bytes
+    FreeBlock *pools[SIZE_CLASSES];
+
+    size_t reservedBytes;
+    size_t usedBytes;
+    size_t pooledBytes;
+    size_t allocations;
+    size_t poolHits;
+
+    /**
+     * Round size up to the alignment
+     *
+     * @param size Size
+     * @return Aligned size
+     */
+    static size_t align(size_t size);
+
+    /**
+     * Find the smallest size class which fits a block
+     *
+     * @param size Block size, not larger than MAX_CLASS_SIZE
+     * @return Size class index
+     */
+    static size_t sizeClassOf(size_t size);
+
+    /**
+     * Put a block into the pool of its size class
+     *
+     * @param block Block
+     * @param sizeClass Size class index
+     */
+    void release(char *block, size_t sizeClass);
+
+    /**
+     * Split the unused tail of the current chunk into size class blocks and pool them
+     */
+    void releaseTail();
+};
+
+#endif
@@ -96,6 +96,8 @@ struct CliCommand {
 class Cli {
 public:
     static constexpr auto NO_ENCRYPTION = "-no-encryption";
+    // Followed by host[:port] of a notes server the CLI works with
+    static constexpr auto REMOTE_SERVICE = "-remote";
 
     /**
      * Constructor
@@ -198,12 +200,14 @@ private:
     ReturnCode addTag(Record &record) const;
 
     /**
-     * Translate record searching command into predicate accepting record
+     * Translate record searching command into record query
      *
      * @param cmd User command
-     * @return Record predicate which reflects search conditions provided in the user command
+     * @param query Output: query which reflects search conditions provided in the user command
+     * @return OK            - if the command was translated successfully
+     *         GENERIC_ERROR - if the command contains invalid conditions
      */
-     RecordPredicate generateRecordPredicate(const CliCommand &cmd) const;
+    ReturnCode generateRecordQuery(const CliCommand &cmd, RecordQuery &query) const;
 
     /** 
      * Delete tag form existing record
@@ -288,6 +292,15 @@ private:
      */
     ReturnCode exitCli(const CliCommand &cmd);
 
+    /**
+     * Execute Core Action requested by the user. The Action is scheduled as
+     * interactive, so it isn't delayed by background work
+     *
+     * @param action Core Action
+     * @return Response future
+     */
+    future<Response> execAction(unique_ptr<CoreAction> &&action) const;
+
     /**
      * Open external text editor for record text modification
      * 
@@ -1,20 +1,213 @@
 #ifndef _CORE_HPP_
 #define _CORE_HPP_
 
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include "io_uring.hpp"
+#include "query_cache.hpp"
 #include "record.hpp"
+#include "record_query.hpp"
+#include "record_store.hpp"
 #include "return_code.hpp"
+#include "text_pattern.hpp"
 
+using std::mutex;
 using std::string;
 using std::vector;
 
 using RecordPredicate = std::function<bool (const Record&)>;
 
 /**
- * Provides reading/writing/searching/ of user data
+ * Provides reading/writing/searching/ of user data.
+ *
+ * Searches may run on any number of threads concurrently with modifications: every
+ * search works with the snapshot of records published when it started. Modifications
+ * are serialized
  */
 class Core {
 public:
+    /**
+     * Group of modifications published and saved as a single commit.
+     * Holds the writer lock while alive
+     */
+    class Batch {
+    public:
+        /**
+         * Constructor. Takes the writer lock
+         *
+         * @param core Application core
+         */
+        explicit Batch(Core &core);
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+        /**
+         * Destructor. Modifications which weren't committed are published but not saved
+         */
+        ~Batch();
+
+        /**
+         * Add a new record
+         *
+         * @param record Record
+         * @return OK - if record was successfully added
+         */
+        ReturnCode addRecord(Record &&record);
+
+        /**
+         * Update a record
+         *
+         * @param record Record with updated content
+         * @return OK        - if record was successfully updated
+         *         NOT_FOUND - if required record does not exit
+         */
+        ReturnCode updateRecord(Record &&record);
+
+        /**
+         * Remove record
+         *
+         * @param recordId Id of the Record to be removed
+         * @return OK - if record was removed or didn't exist
+         */
+        ReturnCode removeRecord(int recordId);
+
+        /**
+         * Add a tag to a record
+         *
+         * @param recordId Record Id
+         * @param tag Tag
+         * @return OK        - if the tag was added or the record already has it
+         *         NOT_FOUND - if required record does not exit
+         */
+        ReturnCode addTag(int recordId, const string &tag);
+
+        /**
+         * Remove a tag from a record
+         *
+         * @param recordId Record Id
+         * @param tag Tag
+         * @return OK        - if the tag was removed or the record doesn't have it
+         *         NOT_FOUND - if required record does not exit
+         */
+        ReturnCode removeTag(int recordId, const string &tag);
+
+        /**
+         * Set deleted state of a record
+         *
+         * @param recordId Record Id
+         * @param state Deleted state
+         * @return OK        - if the state was set or the record already is in it
+         *         NOT_FOUND - if required record does not exit
+         */
+        ReturnCode setDeleted(int recordId, bool state);
+
+        /**
+         * Replace text of a record
+         *
+         * @param recordId Record Id
+         * @param text New text
+         * @return OK        - if the text was replaced or is the same
+         *         NOT_FOUND - if required record does not exit
+         */
+        ReturnCode setText(int recordId, const string &text);
+
+        /**
+         * Change text of a record by a delta
+         *
+         * @param recordId Record Id
+         * @param delta Delta against the current text
+         * @return OK            - if the text was changed
+         *         NOT_FOUND     - if required record does not exit
+         *         CONFLICT      - if the delta is based on another text version
+         *         GENERIC_ERROR - if the delta doesn't fit the text
+         */
+        ReturnCode editText(int recordId, const TextDelta &delta);
+
+        /**
+         * Add a tag to all records satisfying a query
+         *
+         * @param query Search conditions
+         * @param tag Tag
+         * @param matched Output: number of records satisfying the query
+         * @param changed Output: number of records which didn't have the tag
+         * @return OK - if the records were changed
+         */
+        ReturnCode addTag(const RecordQuery &query, const string &tag, size_t &matched, size_t &changed);
+
+        /**
+         * Remove a tag from all records satisfying a query
+         *
+         * @param query Search conditions
+         * @param tag Tag
+         * @param matched Output: number of records satisfying the query
+         * @param changed Output: number of records which had the tag
+         * @return OK - if the records were changed
+         */
+        ReturnCode removeTag(const RecordQuery &query, const string &tag, size_t &matched, size_t &changed);
+
+        /**
+         * Set deleted state of all records satisfying a query
+         *
+         * @param query Search conditions
+         * @param state Deleted state
+         * @param matched Output: number of records satisfying the query
+         * @param changed Output: number of records which were in the other state
+         * @return OK - if the records were changed
+         */
+        ReturnCode setDeleted(const RecordQuery &query, bool state, size_t &matched, size_t &changed);
+
+        /**
+         * Replace pattern matches in text of all records satisfying a query. Texts are
+         * searched and rewritten by pool workers, only changed records are stored
+         *
+         * @param query Search conditions
+         * @param pattern Pattern and replacement
+         * @param dryRun Only count the matches, records are not changed
+         * @param matched Output: number of records satisfying the query
+         * @param changed Output: number of records with matches
+         * @param replaced Output: number of matches
+         * @return OK - if the matches were replaced or counted
+         *         Throws if the regular expression fails on a text, no record is changed then
+         */
+        ReturnCode replaceText(const RecordQuery &query, const TextPattern &pattern, bool dryRun,
+            size_t &matched, size_t &changed, size_t &replaced);
+
+        /**
+         * Publish modifications to searches and write them to persistent storage
+         *
+         * @return OK - if modifications were successfully saved
+         *         May throw I/O exception
+         */
+        ReturnCode commit();
+
+        /**
+         * Drop modifications made since the batch started or was last committed.
+         * Searches never see them
+         */
+        void rollback();
+
+    private:
+        Core &core;
+        std::unique_lock<mutex> writerLock;
+        // Indicates whether there are uncommitted modifications
+        bool modified;
+        // Id of the first record added since the last commit
+        int firstRecordId;
+    };
+
+    /**
+     * Constructor
+     */
+    Core():
+        encryption{ false },
+        initialized{ false },
+        queryCache{ QUERY_CACHE_MAX_ENTRIES, QUERY_CACHE_MAX_BYTES }
+        {}
+
     /**
      * Add a new record
      *
@@ -34,7 +227,8 @@ public:
     ReturnCode updateRecord(Record &&record);
 
     /**
-     * Read user data from persistent storage
+     * Read user data from persistent storage. Data is read only once, later calls
+     * change nothing
      * 
      * @return OK    - if data initialization completed successfully
      *         EMPTY - if no data present in persistent storage
@@ -60,11 +254,44 @@ public:
     vector<Record> search(const RecordPredicate &pred);
 
     /**
-     * Set user password for data encryption/decryption
+     * Search records. Results are cached until the next data modification
+     *
+     * @param query Search conditions
+     * @return Copies of records found
+     */
+    vector<Record> search(const RecordQuery &query);
+
+    /**
+     * Search records without copying them. Results are cached until the next data
+     * modification
+     *
+     * @param query Search conditions
+     * @return Records found in the snapshot pinned by the search
+     */
+    shared_ptr<RecordStore::Selection> select(const RecordQuery &query);
+
+    /**
+     * Get search results cache statistics
+     *
+     * @return Query cache statistics
+     */
+    QueryCacheStats getQueryCacheStats() const;
+
+    /**
+     * Get statistics of memory used for records text and tags
+     *
+     * @return Arena statistics
+     */
+    ArenaStats getArenaStats() const;
+
+    /**
+     * Set user password for data encryption/decryption. Once the data is read the
+     * password is only checked against the one in use
      *
      * @param password Current user password
      * @return OK               - successfull result
      *         INVALID_PASSWORD - password does not match expected format
+     *         WRONG_PASSWORD   - data is already read with another password
      */
     ReturnCode setPassword(string &&password);
 
@@ -88,11 +315,56 @@ public:
 	
 private:
     static const string DATA_FILE;
+    // First line of the data file (absent in the files of the first format version)
+    static const string DATA_FORMAT_HEADER;
     static int NEXT_RECORD_ID;
+    static constexpr size_t QUERY_CACHE_MAX_ENTRIES{ 256 };
+    static constexpr size_t QUERY_CACHE_MAX_BYTES{ 16 * 1024 * 1024 };
+    // Number of records searched by a single task of a find-and-replace
+    static constexpr size_t REPLACE_GRAIN{ 64 };
 
     string password;
     bool encryption;
-    vector<Record> records;
+    // Data file was read, or there was none
+    bool initialized;
+    // Serializes modifications and persistent storage access
+    mutable mutex writerMutex;
+    RecordStore records;
+    // Search results for recent queries
+    QueryCache queryCache;
+    // Data file I/O ring, created on first save if io_uring is enabled
+    std::unique_ptr<IoUring> ring;
+
+    /**
+     * Write user data to persistent storage. Writer lock should be held
+     *
+     * @return OK - if user data was successfully saved
+     *         May throw I/O exception
+     */
+    ReturnCode save();
+
+    /**
+     * Replace the data file contents and flush them to the storage device. With io_uring
+     * the write and the following fsync are submitted by a single system call
+     *
+     * @param data File contents
+     *         May throw I/O exception
+     */
+    void writeFile(const string &data);
+
+    /**
+     * Serialize user data: tag dictionary followed by records
+     *
+     * @param os Output stream
+     */
+    void writeData(std::ostream &os);
+
+    /**
+     * Deserialize user data written by writeData or by previous format version
+     *
+     * @param is Input stream
+     */
+    void readData(std::istream &is);
 };
 
 #endif // CORE
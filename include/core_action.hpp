@@ -1,29 +1,170 @@
 #ifndef _CORE_ACTION_HPP_
 #define _CORE_ACTION_HPP_
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <future>
 #include "core.hpp"
+#include "latency_stats.hpp"
 #include "response.hpp"
+#include "wire_protocol.hpp"
 
+using std::function;
 using std::future;
 using std::shared_ptr;
 
+/**
+ * Scheduling class of a Core Action
+ */
+enum class ActionPriority {
+    // Requests a user is waiting for
+    INTERACTIVE,
+    NORMAL,
+    // Imports and other background jobs
+    BULK
+};
+
+/**
+ * Modification applied by a BulkUpdateAction
+ */
+enum class BulkOperation {
+    ADD_TAG,
+    REMOVE_TAG,
+    DELETE,
+    RESTORE
+};
+
+/**
+ * Times of a Core Action passing through a Core Service (LatencyStats::now()),
+ * 0 if latency statistics were disabled at the time
+ */
+struct ActionTimestamps {
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t started;
+    uint64_t finished;
+};
+
 /**
  * Virtual base class for entities which define particular operations (and context data)
  * to the application core
  */
 struct CoreAction {
+    /**
+     * Constructor
+     */
+    CoreAction(): priority{ ActionPriority::NORMAL }, timestamps{}, deadline{} {}
+
+    /**
+     * Execute the Action and fulfil the response promise
+     */
+    virtual void exec();
+
     /**
      * Execute the Action
+     *
+     * @return Execution response
+     */
+    virtual Response run() = 0;
+
+    /**
+     * Execute the Action as a part of a batch of modifications. The batch is committed
+     * by the caller, so the response is fulfilled after the commit
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    virtual Response apply(Core::Batch &batch);
+
+    /**
+     * Fulfil the response promise, or pass the response to the response handler if
+     * it is set
+     *
+     * @param response Execution response
+     */
+    void respond(Response &&response);
+
+    /**
+     * Set handler receiving the response instead of the future. Lets a caller which
+     * can't block wait for the response, e.g. a network event loop
+     *
+     * @param handler Response handler, called on the thread executing the Action
+     */
+    void setResponseHandler(function<void(Response&&)> &&handler);
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     *        Throws if the Action can't be sent over network
      */
-    virtual void exec() = 0;
+    virtual void encode(WireWriter &writer) const;
 
     /**
      * Undo the Action
      */
     virtual void undo() = 0;
 
+    /**
+     * Check whether the Action leaves the application core data unchanged.
+     * Read-only Actions may run in parallel with each other
+     *
+     * @return True if the Action doesn't modify the data
+     */
+    virtual bool isReadOnly() const;
+
+    /**
+     * Check whether the Action may be applied as a part of a batch of modifications
+     *
+     * @return True if apply() is supported
+     */
+    virtual bool isBatchable() const;
+
+    /**
+     * Get scheduling class
+     *
+     * @return Priority class
+     */
+    ActionPriority getPriority() const;
+
+    /**
+     * Get Action type name used in statistics
+     *
+     * @return Name, string literal
+     */
+    virtual const char* getName() const;
+
+    /**
+     * Get times of passing through the Core Service
+     *
+     * @return Timestamps
+     */
+    ActionTimestamps& getTimestamps();
+
+    /**
+     * Set scheduling class
+     *
+     * @param priority Priority class
+     */
+    void setPriority(ActionPriority priority);
+
+    /**
+     * Get time by which the response is expected
+     *
+     * @return Deadline, default constructed if not set
+     */
+    std::chrono::steady_clock::time_point getDeadline() const;
+
+    /**
+     * Set time by which the response is expected. A remote Core Service responds
+     * with ReturnCode::TIMEOUT once it passes
+     *
+     * @param deadline Deadline
+     */
+    void setDeadline(std::chrono::steady_clock::time_point deadline);
+
     /**
      * Set pointer to the application core
      * 
@@ -46,6 +187,18 @@ struct CoreAction {
     protected:
     std::shared_ptr<Core> core;
     std::promise<Response> responsePromise;
+    function<void(Response&&)> responseHandler;
+    ActionPriority priority;
+    ActionTimestamps timestamps;
+    std::chrono::steady_clock::time_point deadline;
+
+    /**
+     * Write request message header: message type and the Action priority
+     *
+     * @param writer Message writer
+     * @param type Message type
+     */
+    void encodeHeader(WireWriter &writer, MessageType type) const;
 };
 
 /**
@@ -65,8 +218,39 @@ struct AddRecordAction: public CoreAction {
 
     /**
      * Adds a new record
+     *
+     * @return Execution response
+     */
+    Response run() override;
+
+    /**
+     * Adds a new record as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Adding records may be batched
+     *
+     * @return True
+     */
+    bool isBatchable() const override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
      */
-    void exec() override;
+    void encode(WireWriter &writer) const override;
 
     /**
      * Undo adding a new record
@@ -91,8 +275,39 @@ struct UpdateRecordAction: public CoreAction {
 
     /**
      * Substitutes a record with same Id by the record specified
+     *
+     * @return Execution response
+     */
+    Response run() override;
+
+    /**
+     * Substitutes a record as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Updating records may be batched
+     *
+     * @return True
+     */
+    bool isBatchable() const override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
      */
-    void exec() override;
+    void encode(WireWriter &writer) const override;
 
     /**
      * Undo updating record
@@ -103,6 +318,371 @@ struct UpdateRecordAction: public CoreAction {
     Record record;
 };
 
+/**
+ * Base of the Actions changing a single field of a record named by Id. Only the field
+ * is sent and stored, the rest of the record stays in place
+ */
+struct PatchRecordAction: public CoreAction {
+    /**
+     * Constructor
+     *
+     * @param recordId Id of the record to be changed
+     */
+    explicit PatchRecordAction(int recordId): recordId{ recordId } {}
+
+    /**
+     * Changes the field and commits the change
+     *
+     * @return Execution response
+     */
+    Response run() override;
+
+    /**
+     * Changing fields may be batched
+     *
+     * @return True
+     */
+    bool isBatchable() const override;
+
+    /**
+     * Undo changing the field
+     */
+    void undo() override;
+
+    protected:
+    int recordId;
+};
+
+/**
+ * Add a tag to a record
+ */
+struct AddTagAction: public PatchRecordAction {
+    /**
+     * Constructor
+     *
+     * @param recordId Record Id
+     * @param tag Tag
+     */
+    AddTagAction(int recordId, string &&tag): PatchRecordAction{ recordId }, tag{ std::move(tag) } {}
+
+    /**
+     * Adds the tag as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    private:
+    string tag;
+};
+
+/**
+ * Remove a tag from a record
+ */
+struct RemoveTagAction: public PatchRecordAction {
+    /**
+     * Constructor
+     *
+     * @param recordId Record Id
+     * @param tag Tag
+     */
+    RemoveTagAction(int recordId, string &&tag): PatchRecordAction{ recordId }, tag{ std::move(tag) } {}
+
+    /**
+     * Removes the tag as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    private:
+    string tag;
+};
+
+/**
+ * Set deleted state of a record
+ */
+struct SetDeletedAction: public PatchRecordAction {
+    /**
+     * Constructor
+     *
+     * @param recordId Record Id
+     * @param state Deleted state
+     */
+    SetDeletedAction(int recordId, bool state): PatchRecordAction{ recordId }, state{ state } {}
+
+    /**
+     * Sets the state as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    private:
+    bool state;
+};
+
+/**
+ * Replace text of a record
+ */
+struct SetTextAction: public PatchRecordAction {
+    /**
+     * Constructor
+     *
+     * @param recordId Record Id
+     * @param text New text
+     */
+    SetTextAction(int recordId, string &&text): PatchRecordAction{ recordId }, text{ std::move(text) } {}
+
+    /**
+     * Replaces the text as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    private:
+    string text;
+};
+
+/**
+ * Change text of a record by a delta: only the changed ranges are sent and applied
+ */
+struct EditTextAction: public PatchRecordAction {
+    /**
+     * Constructor
+     *
+     * @param recordId Record Id
+     * @param delta Delta against the current text
+     */
+    EditTextAction(int recordId, TextDelta &&delta): PatchRecordAction{ recordId }, delta{ std::move(delta) } {}
+
+    /**
+     * Changes the text as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    private:
+    TextDelta delta;
+};
+
+/**
+ * Modify all records satisfying a query inside the application core: records are
+ * picked by a scan of the record columns and changed in parallel, nothing is sent
+ * to the client but the numbers of records
+ */
+struct BulkUpdateAction: public CoreAction {
+    /**
+     * Constructor
+     *
+     * @param query Records to modify
+     * @param operation Modification
+     * @param tag Tag added or removed, ignored by other operations
+     */
+    BulkUpdateAction(RecordQuery &&query, BulkOperation operation, string &&tag = {}):
+    query{ std::move(query) },
+    operation{ operation },
+    tag{ std::move(tag) }
+    {}
+
+    /**
+     * Modifies the records and commits the modifications
+     *
+     * @return Execution response, counts: records satisfying the query, records changed
+     */
+    Response run() override;
+
+    /**
+     * Modifies the records as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response, counts: records satisfying the query, records changed
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Bulk modifications may be batched
+     *
+     * @return True
+     */
+    bool isBatchable() const override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    /**
+     * Undo the modifications
+     */
+    void undo() override;
+
+    private:
+    RecordQuery query;
+    BulkOperation operation;
+    string tag;
+};
+
+/**
+ * Find and replace text in all records satisfying a query. Texts are searched and
+ * rewritten by pool workers inside the application core and committed at once
+ */
+struct ReplaceTextAction: public CoreAction {
+    /**
+     * Constructor
+     *
+     * @param query Records to search, all non-deleted records by default
+     * @param pattern Literal text or ECMAScript regular expression
+     * @param replacement Replacement, may refer to regular expression groups by $n
+     * @param regex Pattern is a regular expression
+     * @param dryRun Only count the matches
+     */
+    ReplaceTextAction(RecordQuery &&query, string &&pattern, string &&replacement, bool regex = false,
+        bool dryRun = false):
+    query{ std::move(query) },
+    pattern{ std::move(pattern) },
+    replacement{ std::move(replacement) },
+    regex{ regex },
+    dryRun{ dryRun }
+    {}
+
+    /**
+     * Replaces the matches and commits the changed records
+     *
+     * @return Execution response, counts: records satisfying the query, records
+     *         with matches, matches
+     */
+    Response run() override;
+
+    /**
+     * Replaces the matches as a part of the batch
+     *
+     * @param batch Batch of modifications
+     * @return Execution response, counts: records satisfying the query, records
+     *         with matches, matches
+     */
+    Response apply(Core::Batch &batch) override;
+
+    /**
+     * Find-and-replace may be batched
+     *
+     * @return True
+     */
+    bool isBatchable() const override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    /**
+     * Undo the replacement
+     */
+    void undo() override;
+
+    private:
+    RecordQuery query;
+    string pattern;
+    string replacement;
+    bool regex;
+    bool dryRun;
+};
+
 /**
  * Search for the records
  */
@@ -115,17 +695,52 @@ struct SearchRecordsAction: public CoreAction {
     SearchRecordsAction(RecordPredicate &&pred): pred{ std::forward<RecordPredicate>(pred) } {}
 
     /**
-     * Searches for the record using specified predicate
+     * Constructor
+     * 
+     * @param query Search conditions
+     */
+    SearchRecordsAction(RecordQuery &&query): query{ std::forward<RecordQuery>(query) } {}
+
+    /**
+     * Searches for the record using specified predicate or query
+     *
+     * @return Execution response
+     */
+    Response run() override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
      */
-    void exec() override;
+    void encode(WireWriter &writer) const override;
 
     /**
      * Undo record searching
      */
     void undo() override;
 
+    /**
+     * Searching doesn't modify the data
+     *
+     * @return True
+     */
+    bool isReadOnly() const override;
+
     private:
+    // Found records with this much text are referred to in place instead of copied
+    static constexpr size_t MIN_PINNED_TEXT{ 64 * 1024 };
+
+    // Arbitrary predicate (results are not cached), takes precedence over the query
     RecordPredicate pred;
+    RecordQuery query;
 };
 
 /**
@@ -141,8 +756,24 @@ struct SetPasswordAction: public CoreAction {
 
     /**
      * Sets encryption/decryption password
+     *
+     * @return Execution response
+     */
+    Response run() override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
      */
-    void exec() override;
+    void encode(WireWriter &writer) const override;
 
     /**
      * Undo setting password
@@ -159,8 +790,24 @@ struct SetPasswordAction: public CoreAction {
 struct StartAction: public CoreAction {
     /**
      * Starts the application core
+     *
+     * @return Execution response
+     */
+    Response run() override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
      */
-    void exec() override;
+    void encode(WireWriter &writer) const override;
 
     /**
      * Undo starting the application core
@@ -168,4 +815,98 @@ struct StartAction: public CoreAction {
     void undo() override;
 };
 
+/**
+ * Report latency statistics of Core Actions and data sync
+ */
+struct StatsAction: public CoreAction {
+    /**
+     * Collects the statistics
+     *
+     * @return Execution response, the report is in the summary
+     */
+    Response run() override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message
+     *
+     * @param writer Message writer
+     */
+    void encode(WireWriter &writer) const override;
+
+    /**
+     * Collecting statistics doesn't modify the data
+     *
+     * @return True
+     */
+    bool isReadOnly() const override;
+
+    /**
+     * Undo collecting statistics
+     */
+    void undo() override;
+};
+
+/**
+ * Execute a group of modifications as a single unit: the items are applied in order
+ * by a single batch of the application core, searches see all of them at once and
+ * they are saved by a single commit. Only batchable Actions may be items, the items'
+ * own responses are not fulfilled: their return codes are in the batch response.
+ *
+ * If the batch is atomic, the first item which doesn't succeed stops it and all
+ * modifications of the batch are dropped
+ */
+struct BatchAction: public CoreAction {
+    /**
+     * Constructor
+     *
+     * @param actions Batch items
+     * @param atomic Apply either all items or none of them
+     */
+    BatchAction(vector<unique_ptr<CoreAction>> &&actions, bool atomic = false):
+    actions{ std::move(actions) },
+    atomic{ atomic }
+    {}
+
+    /**
+     * Applies the items and commits them
+     *
+     * @return Execution response: OK if the items were committed, return codes
+     *         of the items are in the results. If an atomic batch is stopped, the
+     *         code of the failed item; items following it are not executed and get
+     *         GENERIC_ERROR
+     */
+    Response run() override;
+
+    /**
+     * Get Action type name
+     *
+     * @return Name
+     */
+    const char* getName() const override;
+
+    /**
+     * Encode the Action as a network request message, items are nested messages
+     *
+     * @param writer Message writer
+     *        Throws if an item can't be sent over network
+     */
+    void encode(WireWriter &writer) const override;
+
+    /**
+     * Undo the batch
+     */
+    void undo() override;
+
+    private:
+    vector<unique_ptr<CoreAction>> actions;
+    bool atomic;
+};
+
 #endif
@@ -1,18 +1,28 @@
 #ifndef _CORE_SERVICE_HPP_
 #define _CORE_SERVICE_HPP_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <future>
 #include <queue>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "core.hpp"
 #include "core_action.hpp"
+#include "latency_stats.hpp"
+#include "mpsc_queue.hpp"
+#include "reactor.hpp"
 #include "response.hpp"
+#include "thread_pool.hpp"
+#include "tracing.hpp"
 
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -20,14 +30,17 @@
 using std::async;
 using std::atomic;
 using std::condition_variable;
+using std::deque;
 using std::future;
 using std::mutex;
 using std::pair;
 using std::promise;
 using std::shared_ptr;
+using std::string;
 using std::thread;
 using std::unique_ptr;
 using std::queue;
+using std::vector;
 
 /**
  * Virtual base class for intermediate layers between application core and client code. 
@@ -70,70 +83,263 @@ struct CoreService {
 };
 
 /**
- * Provides access to the core for client code running on local machine
+ * Load limits of a Core Service. Requests beyond the limits are rejected at once
+ * with ReturnCode::OVERLOADED
+ */
+struct ServiceLimits {
+    // Maximum number of queued Core Actions of every priority class,
+    // rounded up to a power of two
+    size_t queueCapacity{ 4096 };
+    // Maximum number of read-only Core Actions submitted to the pool
+    size_t maxReadActions{ 4096 };
+    // Maximum number of network connections processed at once
+    size_t maxConnections{ 256 };
+    // Retry hint of rejected requests
+    std::chrono::milliseconds retryAfter{ 100 };
+};
+
+/**
+ * Core Service load gauges
+ */
+struct ServiceStats {
+    // Queued Core Actions of every priority class, indexed by ActionPriority
+    vector<size_t> queueDepths;
+    // Read-only Core Actions submitted to the pool and not completed
+    size_t readActions;
+    // Network connections being processed
+    size_t connections;
+    // Core Actions rejected since the service start
+    size_t rejectedActions;
+    // Network connections rejected since the service start
+    size_t rejectedConnections;
+};
+
+/**
+ * Provides access to the core for client code running on local machine.
+ *
+ * Every priority class of Core Actions has its own queue. The dispatcher serves the
+ * classes by weighted round robin: in every round a class is served up to its weight
+ * times, so interactive Actions overtake bulk ones while bulk Actions are still served
+ * every round. Within a class Actions are dispatched in the order they were received.
+ * Mutating Actions are executed one at a time by the dispatching thread; consecutive
+ * batchable ones of a class are applied together as a single commit. Read-only Actions
+ * are submitted to the thread pool and run in parallel. Since the core publishes every
+ * modification before the next Action is dispatched, a read-only Action observes all
+ * modifications of its class received before it.
+ *
+ * Queues are bounded: a Core Action which doesn't fit is rejected at once with
+ * ReturnCode::OVERLOADED and a retry hint, instead of delaying all the others
  */
 struct LocalCoreService: public CoreService {
     /**
      * Constructor
      * 
      * @param core Pointer to the application core
+     * @param pool Thread pool executing read-only Actions
+     * @param limits Load limits
      */
-    LocalCoreService(shared_ptr<Core> &core): CoreService{ core }, stopService{ false } {}
+    LocalCoreService(shared_ptr<Core> &core, ThreadPool &pool = ThreadPool::instance(),
+                     const ServiceLimits &limits = ServiceLimits{}):
+        CoreService{ core },
+        stopService{ false },
+        pool{ pool },
+        limits{ limits },
+        rejectedActions{ 0 },
+        credits{},
+        activeReadActions{ 0 },
+        pushingActions{ 0 },
+        dispatcherParked{ false },
+        readActions{ pool }
+    {
+        for(size_t priority = 0; priority < PRIORITY_CLASSES; ++priority) {
+            actions.emplace_back(new MpscQueue<unique_ptr<CoreAction>>{ queueCapacity(limits.queueCapacity) });
+        }
+    }
 
     /**
-     * Execute Core Action
+     * Execute Core Action. Rejected at once if its queue is full, fails with
+     * ReturnCode::GENERIC_ERROR once the service is stopped
      * 
      * @param action Core Action to be executed
      * @return Response future
      */
     future<Response> execAction(unique_ptr<CoreAction>&& action) override;
 
+    /**
+     * Get load gauges. May be called from any thread
+     *
+     * @return Service statistics
+     */
+    virtual ServiceStats getStats() const;
+
     /**
      * Start accepting commands 
      */
     void start() override;
 
     /**
-     * Stop accepting commands
+     * Stop accepting commands. Core Actions still queued are answered with
+     * ReturnCode::GENERIC_ERROR
      */ 
     void stop() override;
 
 protected:
     // Indicates whether service should continue operating
     atomic<bool> stopService;
+    // Executes read-only Core Actions
+    ThreadPool &pool;
+    const ServiceLimits limits;
+    // Number of rejected Core Actions
+    atomic<size_t> rejectedActions;
+
+    /**
+     * Reject Core Action since the service is overloaded
+     *
+     * @param action Core Action
+     */
+    void reject(CoreAction &action);
 
 private:
-    // Core Actions queue
-    queue<unique_ptr<CoreAction>> actions;
-    // Core Actions queue synchronization
-    mutex actionsMutex;
-    // Notification about incoming Core Actions
-    condition_variable actionsCv;
-    // Executes Core Actions in the queue asynchronously 
+    // Number of Core Action priority classes
+    static constexpr size_t PRIORITY_CLASSES{ 3 };
+    // Dispatches per round of every priority class: interactive, normal, bulk
+    static constexpr size_t PRIORITY_WEIGHTS[PRIORITY_CLASSES]{ 8, 4, 1 };
+    // Attempts to take a Core Action before the dispatcher yields the CPU
+    static constexpr size_t DISPATCHER_SPINS{ 2000 };
+    // Attempts to take a Core Action after yielding before the dispatcher parks
+    static constexpr size_t DISPATCHER_YIELDS{ 16 };
+    // Maximum number of Core Actions applied as a single commit
+    static constexpr size_t MAX_BATCH_SIZE{ 1024 };
+
+    // Core Actions queue of every priority class
+    vector<unique_ptr<MpscQueue<unique_ptr<CoreAction>>>> actions;
+    // Dispatches left to every priority class in the current round. Dispatcher only
+    size_t credits[PRIORITY_CLASSES];
+    // Number of read-only Core Actions submitted to the pool and not completed
+    atomic<size_t> activeReadActions;
+    // Number of Core Actions being pushed by clients which saw the service running
+    atomic<size_t> pushingActions;
+    // Set while the dispatcher waits for Core Actions
+    atomic<bool> dispatcherParked;
+    // Dispatcher parking synchronization
+    mutex parkMutex;
+    // Wakes up the parked dispatcher
+    condition_variable parkCv;
+    // Executes mutating Core Actions and dispatches read-only ones
     thread execActionThread;
+    // Read-only Core Actions submitted to the pool
+    TaskGroup readActions;
 
     /**
      *  Executes Core Actions in the queue
      */ 
     void execActionLoop();
+
+    /**
+     * Apply a batchable Core Action together with the batchable ones of its class
+     * dispatched right after it as a single commit. Responses are fulfilled after
+     * the commit
+     *
+     * @param action First Core Action of the batch. Output: Core Action dispatched
+     *               which can't join the batch, nullptr if there is none
+     */
+    void runBatch(unique_ptr<CoreAction> &action);
+
+    /**
+     * Wait for the next Core Action: spin briefly, then park until it arrives
+     *
+     * @param action Output: Core Action
+     * @return False if the service is stopping
+     */
+    bool nextAction(unique_ptr<CoreAction> &action);
+
+    /**
+     * Take a queued Core Action of the class next in the weighted round robin.
+     * A new round starts once no class with dispatches left has queued Actions
+     *
+     * @param action Output: Core Action
+     * @return False if all queues are empty
+     */
+    bool takeAction(unique_ptr<CoreAction> &action);
+
+    /**
+     * Timestamp a Core Action taken from its queue
+     *
+     * @param action Core Action
+     */
+    static void markDequeued(CoreAction &action);
+
+    /**
+     * Get queue of Core Actions of a priority class
+     *
+     * @param priority Priority class
+     * @return Queue
+     */
+    MpscQueue<unique_ptr<CoreAction>>& queueOf(ActionPriority priority);
+
+    /**
+     * Get queue capacity satisfying the limit
+     *
+     * @param limit Requested capacity
+     * @return Power of two not less than the limit
+     */
+    static size_t queueCapacity(size_t limit);
+
+    /**
+     * Wake up the dispatcher if it is parked. Running dispatcher is not notified
+     */
+    void wakeDispatcher();
+
+    /**
+     * Execute Core Action, report exceptions
+     *
+     * @param action Core Action
+     */
+    static void runAction(CoreAction &action);
+
+    /**
+     * Record latency of an executed Core Action
+     *
+     * @param action Core Action with timestamps set
+     */
+    static void recordLatency(CoreAction &action);
+
+    /**
+     * Check whether Core Actions should be timestamped: latency statistics
+     * or tracing is enabled
+     *
+     * @return True if enabled
+     */
+    static bool timestampsEnabled();
 };
 
 /**
- * Should provide access to the core for client code over network
+ * Should provide access to the core for client code over network.
+ * Connections are served by non-blocking reactors, each with a listening socket of
+ * its own bound to the same port (SO_REUSEPORT): the kernel spreads connections
+ * across them and a connection stays with its reactor until it is closed.
+ * Connections are persistent, clients may pipeline requests on them.
+ * The first reactor runs on the thread which started the service. Requests are
+ * WireProtocol messages decoded on the reactor threads; the Core Actions are
+ * executed as local ones and respond through the reactors once done
  */
 struct NetworkCoreService: public LocalCoreService {
+    // Port the service listens on
+    static constexpr int DEFAULT_PORT{ 8080 };
+
     /**
      * @brief NetworkCoreService constructor
      * @param core Pointer to the application core
+     * @param pool Thread pool processing requests and read-only Actions
+     * @param limits Load limits
+     * @param reactorsCount Number of reactor threads, 0 - a quarter of CPU cores
      */
-    NetworkCoreService(shared_ptr<Core> &core): 
-        LocalCoreService{ core }, 
-        port{ 8080 }, 
-        connectionQueueSize{ 30 }
-    {}
+    NetworkCoreService(shared_ptr<Core> &core, ThreadPool &pool = ThreadPool::instance(),
+                       const ServiceLimits &limits = ServiceLimits{}, size_t reactorsCount = 0);
 
     void start() override;
     void stop() override;
+    ServiceStats getStats() const override;
 
 private:
     static constexpr int SOCKET_OPTION{ 1 };
@@ -141,47 +347,220 @@ private:
     int port;
     // Number of connections in queue until they are refused
     int connectionQueueSize;
-    // File descriptor corresponding server socket
-    int serverFd;
-    // Socket address
-    struct sockaddr_in socketAddr;
-    // Queue of sockets awaiting processing
-    queue<int> sockets;
-    // Socket queue synchronization
-    mutex socketMutex;
-    // Notification about incoming sockets
-    condition_variable socketCv;
-    // Socket processing thread
-    thread socketProcessingThread;
+    // Network event loops
+    vector<unique_ptr<Reactor>> reactors;
+    // Threads running reactors except the first one
+    vector<thread> reactorThreads;
+
+    /**
+     * @brief Create server socket bound to the service port
+     * @return Listening socket
+     */
+    virtual int createServerSocket();
+
+    /**
+     * @brief Process particular client request: decode the Core Action and execute it.
+     *        Called on reactor threads, doesn't wait for the execution
+     * @param request Request payload, valid only during the call
+     * @param respond Responder called with the encoded response
+     */
+    virtual void processRequest(string_ref request, Reactor::Responder &&respond);
+};
+
+/**
+ * Options of a remote Core Service client
+ */
+struct RemoteServiceOptions {
+    // Number of persistent connections to the server
+    size_t connections{ 4 };
+    // Maximum number of Core Actions in flight on a connection, Actions beyond it
+    // are rejected at once with ReturnCode::OVERLOADED
+    size_t maxInFlight{ 1024 };
+    // Deadline of Core Actions which don't set their own
+    std::chrono::milliseconds timeout{ 5000 };
+    // Retry hint of Actions rejected by the client
+    std::chrono::milliseconds retryAfter{ 100 };
+};
+
+/**
+ * Provides access to a Core Service of another process over network: Core Actions are
+ * sent to a NetworkCoreService as WireProtocol requests and their responses fulfil
+ * the futures. Client code works with it as with a local service.
+ *
+ * A pool of persistent connections is kept open. An Action is sent over the connection
+ * with the fewest Actions in flight, requests are pipelined without waiting for earlier
+ * responses, so any number of callers may have Actions in flight at once. A single I/O
+ * thread writes and reads all connections. Actions are encoded by the calling thread.
+ *
+ * An Action without response by its deadline gets ReturnCode::TIMEOUT, the late response
+ * is discarded. If a connection fails, its Actions in flight get ReturnCode::GENERIC_ERROR
+ * (they may have been executed) and the connection is reopened for the next Action
+ */
+struct RemoteCoreService: public CoreService {
+    /**
+     * @brief RemoteCoreService constructor
+     * @param host Server host name or address
+     * @param port Server port
+     * @param options Client options
+     */
+    RemoteCoreService(const string &host, int port, const RemoteServiceOptions &options = RemoteServiceOptions{});
+
+    /**
+     * @brief Destructor. Stops the service
+     */
+    ~RemoteCoreService();
+
+    /**
+     * @brief Send Core Action to the server. May be called from any thread
+     * @param action Core Action to be executed
+     * @return Response future
+     */
+    future<Response> execAction(unique_ptr<CoreAction>&& action) override;
+
+    /**
+     * @brief Connect to the server and start the I/O thread
+     */
+    void start() override;
 
     /**
-     * @brief readSocket Read data from socket
-     * @param socket Socket
-     * @return Pair: data length + ptr to the data
+     * @brief Stop the I/O thread. Actions in flight get ReturnCode::GENERIC_ERROR
      */
-    virtual pair<size_t, unique_ptr<char>> readSocket(int socket);
+    void stop() override;
+
+private:
+    // Epoll event identifier of the wake up descriptor, connections use their index + 1
+    static constexpr uint64_t WAKE_ID{ 0 };
+    // Events processed per epoll_wait call
+    static constexpr int MAX_EVENTS{ 64 };
+    // Initial size of a connection input buffer
+    static constexpr size_t READ_BUFFER_SIZE{ 16 * 1024 };
 
     /**
-     * @brief Create server socket
+     * Core Action sent over a connection and waiting for its response
      */
-    virtual void createServerSocket();
+    struct Request {
+        // nullptr once the Action got its response, e.g. when its deadline passed
+        unique_ptr<CoreAction> action;
+        std::chrono::steady_clock::time_point deadline;
+    };
 
     /**
-     * @brief Accept client requests from network interface
+     * Core Action handed over to the I/O thread
      */
-    virtual void acceptRequests();
+    struct Submission {
+        size_t connection;
+        string message;
+        Request request;
+    };
 
     /**
-     * @brief Process particular client request
-     * @param socket Target socket
+     * Deadline of a request in flight
      */
-    virtual void processRequest(int socket);
+    struct Deadline {
+        std::chrono::steady_clock::time_point time;
+        size_t connection;
+        uint64_t sequence;
+
+        bool operator>(const Deadline &other) const { return time > other.time; }
+    };
 
     /**
-     * @brief processNextRequest Process next request in the queue
+     * Connection to the server
      */
-    virtual void processNextRequest();
+    struct Connection {
+        // Socket, -1 while the connection is closed
+        int fd;
+        // Requests in the order they were sent: responses arrive in this order
+        deque<Request> requests;
+        // Sequence number of the first request
+        uint64_t firstSequence;
+        // Framed requests not written yet, from writeCount
+        string output;
+        size_t writeCount;
+        // Data read and not processed yet: the first inputSize bytes
+        string input;
+        size_t inputSize;
+        // Epoll events watched
+        uint32_t events;
+        // Number of Actions in flight, including submissions. Updated by any thread
+        atomic<size_t> load;
+    };
+
+    const RemoteServiceOptions options;
+    // Resolved server address
+    sockaddr_storage address;
+    socklen_t addressLength;
+    int epollFd;
+    // Event descriptor waking up the I/O thread
+    int wakeFd;
+    // Accessed by the I/O thread only, except the load counters
+    vector<unique_ptr<Connection>> connections;
+    // Deadlines of requests in flight, the earliest first
+    std::priority_queue<Deadline, vector<Deadline>, std::greater<Deadline>> deadlines;
+    // Core Actions handed over to the I/O thread
+    vector<Submission> submissions;
+    mutex submissionsMutex;
+    // Set once stopped, checked under the submissions mutex
+    bool stopped;
+    atomic<bool> stopping;
+    thread ioThread;
+
+    /**
+     * @brief Run the I/O loop until the service is stopped
+     */
+    void ioLoop();
+
+    /**
+     * @brief Send Core Actions handed over by callers
+     */
+    void processSubmissions();
+
+    /**
+     * @brief Respond to requests past their deadline
+     * @return Time to wait for the next deadline (ms), -1 if there are none
+     */
+    int expireRequests();
+
+    /**
+     * @brief Open a non-blocking connection to the server
+     * @param idx Connection index
+     * @return False if the connection failed
+     */
+    bool openConnection(size_t idx);
+
+    /**
+     * @brief Read responses and fulfil the futures of their Actions
+     * @param idx Connection index
+     * @return False if the connection was closed
+     */
+    bool readConnection(size_t idx);
+
+    /**
+     * @brief Write pending requests, watch the socket while some are left
+     * @param idx Connection index
+     * @return False if the connection was closed
+     */
+    bool writeConnection(size_t idx);
+
+    /**
+     * @brief Close connection, respond to its Actions in flight
+     * @param idx Connection index
+     * @param summary Reason given in the responses
+     */
+    void closeConnection(size_t idx, const string &summary);
+
+    /**
+     * @brief Respond to the Action of a request which hasn't got a response yet
+     * @param connection Connection of the request
+     * @param request Request
+     * @param response Response
+     */
+    static void finish(Connection &connection, Request &request, Response &&response);
+
+    /**
+     * @brief Wake up the I/O thread
+     */
+    void wake();
 };
 
 #endif
-
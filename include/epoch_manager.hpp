@@ -0,0 +1,119 @@
+#ifndef _EPOCH_MANAGER_HPP_
+#define _EPOCH_MANAGER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+
+using std::atomic;
+using std::deque;
+using std::function;
+using std::pair;
+
+/**
+ * Epoch based memory reclamation. Readers pin the current epoch while they access
+ * shared data; the writer retires replaced data and it is destroyed only after every
+ * reader which could have seen it has unpinned. Pinning takes no locks
+ */
+class EpochManager {
+public:
+    /**
+     * Keeps the epoch pinned while alive
+     */
+    class Guard {
+    public:
+        /**
+         * Constructor
+         *
+         * @param slot Pinned reader slot, nullptr for an empty guard
+         */
+        explicit Guard(atomic<uint64_t> *slot = nullptr): slot{ slot } {}
+
+        /**
+         * Move constructor
+         *
+         * @param other Guard, left empty
+         */
+        Guard(Guard &&other): slot{ other.slot } { other.slot = nullptr; }
+
+        /**
+         * Move assignment operator
+         *
+         * @param other Guard, left empty
+         * @return Reference to the result object
+         */
+        Guard& operator=(Guard &&other);
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        /**
+         * Destructor. Unpins the epoch
+         */
+        ~Guard();
+
+    private:
+        atomic<uint64_t> *slot;
+    };
+
+    /**
+     * Constructor
+     */
+    EpochManager();
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    /**
+     * Destructor. Destroys all retired data, no reader should be active
+     */
+    ~EpochManager();
+
+    /**
+     * Pin the current epoch. May be called from any thread
+     *
+     * @return Guard which unpins the epoch when destroyed
+     */
+    Guard pin();
+
+    /**
+     * Retire data replaced by the writer. Writer thread only
+     *
+     * @param deleter Function which destroys the data
+     */
+    void retire(function<void()> &&deleter);
+
+    /**
+     * Destroy retired data no reader can access anymore. Writer thread only
+     */
+    void collect();
+
+private:
+    // Maximum number of simultaneously pinned guards
+    static constexpr size_t READER_SLOTS{ 128 };
+    // Slot value of a reader which is not pinned
+    static constexpr uint64_t IDLE{ 0 };
+    // Cache line size
+    static constexpr size_t CACHE_LINE{ 64 };
+
+    /**
+     * Reader slot padded to a cache line, so readers don't contend. Padding is used
+     * instead of alignment: an over-aligned manager would need aligned allocation
+     * by every class which contains it
+     */
+    struct Slot {
+        atomic<uint64_t> epoch;
+        char padding[CACHE_LINE - sizeof(atomic<uint64_t>)];
+    };
+
+    atomic<uint64_t> globalEpoch;
+    // Keeps the global epoch off the cache line of the first slot
+    char padding[CACHE_LINE - sizeof(atomic<uint64_t>)];
+    Slot slots[READER_SLOTS];
+    // Retire epoch + deleter, in retire order
+    deque<pair<uint64_t, function<void()>>> retired;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef _IO_URING_HPP_
+#define _IO_URING_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+using std::deque;
+
+/**
+ * Minimal io_uring instance: submission and completion rings shared with the kernel.
+ * Operations are queued into the submission ring and submitted together by a single
+ * system call. Used by one thread at a time
+ */
+class IoUring {
+public:
+    /**
+     * Check whether io_uring should be used: it is selected by NOTES_IO_BACKEND=io_uring
+     * environment variable and the kernel supports it. Otherwise callers fall back
+     * to epoll and blocking I/O
+     *
+     * @return True if enabled
+     */
+    static bool isEnabled();
+
+    /**
+     * Constructor
+     *
+     * @param entries Submission ring size
+     */
+    explicit IoUring(unsigned entries);
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /**
+     * Destructor. Requests still in flight are canceled by the kernel
+     */
+    ~IoUring();
+
+    /**
+     * Queue accept of connections. Accepted sockets are non-blocking
+     *
+     * @param fd Listening socket
+     * @param userData Completion tag
+     * @param multishot Keep accepting: a completion per connection
+     */
+    void prepareAccept(int fd, uint64_t userData, bool multishot);
+
+    /**
+     * Queue read from a file or socket
+     *
+     * @param fd Descriptor
+     * @param buffer Destination
+     * @param size Size
+     * @param offset File offset, -1 for the current position / sockets
+     * @param userData Completion tag
+     */
+    void prepareRead(int fd, void *buffer, size_t size, uint64_t offset, uint64_t userData);
+
+    /**
+     * Queue socket receive
+     *
+     * @param fd Socket
+     * @param buffer Destination
+     * @param size Size
+     * @param userData Completion tag
+     */
+    void prepareRecv(int fd, void *buffer, size_t size, uint64_t userData);
+
+    /**
+     * Queue socket send
+     *
+     * @param fd Socket
+     * @param buffer Data
+     * @param size Size
+     * @param userData Completion tag
+     */
+    void prepareSend(int fd, const void *buffer, size_t size, uint64_t userData);
+
+    /**
+     * Queue socket send of a message gathered from several blocks
+     *
+     * @param fd Socket
+     * @param message Message, should stay valid until the send completes
+     * @param userData Completion tag
+     */
+    void prepareSendmsg(int fd, const msghdr *message, uint64_t userData);
+
+    /**
+     * Queue file write
+     *
+     * @param fd File
+     * @param buffer Data
+     * @param size Size
+     * @param offset File offset
+     * @param userData Completion tag
+     * @param link Start the next queued operation only after this one succeeds
+     */
+    void prepareWrite(int fd, const void *buffer, size_t size, uint64_t offset, uint64_t userData, bool link);
+
+    /**
+     * Queue file data sync
+     *
+     * @param fd File
+     * @param userData Completion tag
+     */
+    void prepareFsync(int fd, uint64_t userData);
+
+    /**
+     * Queue cancellation of all operations in flight. Canceled operations complete
+     * with -ECANCELED
+     *
+     * @param userData Completion tag
+     */
+    void prepareCancelAll(uint64_t userData);
+
+    /**
+     * Submit queued operations
+     *
+     * @param waitFor Number of completions to wait for, doesn't wait while completions
+     *                taken off the ring are not processed
+     */
+    void submit(unsigned waitFor = 0);
+
+    /**
+     * Process available completions
+     *
+     * @param handler Called for every completion: (const io_uring_cqe&)
+     * @return Number of completions processed
+     */
+    template<typename Handler>
+    size_t complete(Handler &&handler) {
+        // The handler may queue operations, which take completions off the ring when it is full
+        size_t count{ 0 };
+        io_uring_cqe cqe;
+        while(takeCompletion(cqe)) {
+            handler(cqe);
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    int ringFd;
+    unsigned entries;
+    // Mapped rings
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    // Submission ring fields
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    // Tail including queued entries not submitted yet
+    unsigned sqPendingTail;
+    // Completion ring fields
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+    // Completions taken off the ring to free it for submissions, older than ones in the ring
+    deque<io_uring_cqe> reaped;
+
+    /**
+     * Get a free submission entry, submit queued ones if the ring is full
+     *
+     * @param opcode Operation
+     * @param fd Descriptor
+     * @param userData Completion tag
+     * @return Cleared entry
+     */
+    io_uring_sqe& nextSqe(uint8_t opcode, int fd, uint64_t userData);
+
+    /**
+     * Take the oldest completion not processed yet
+     *
+     * @param cqe Output: completion
+     * @return True if there was a completion
+     */
+    bool takeCompletion(io_uring_cqe &cqe);
+
+    /**
+     * Move completions from the ring to the reaped ones, so the kernel can post
+     * completions held back while the ring was full
+     *
+     * @return Number of completions moved
+     */
+    size_t reapCompletions();
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef _LATENCY_STATS_HPP_
+#define _LATENCY_STATS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using std::atomic;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+/**
+ * Measured time intervals
+ */
+enum class LatencyMetric {
+    // Core Action enqueue -> dequeue by the dispatcher
+    QUEUE_WAIT,
+    // Core Action dequeue -> execution start (waiting for a pool worker)
+    SCHEDULE_WAIT,
+    // Core Action execution start -> execution end
+    EXECUTION,
+    // Data sync phases
+    SERIALIZE,
+    ENCRYPT,
+    WRITE,
+    FSYNC
+};
+
+/**
+ * Percentiles of a recorded interval, nanoseconds
+ */
+struct LatencySummary {
+    // Name of the measured operation
+    string name;
+    LatencyMetric metric;
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+/**
+ * Histogram of time intervals with logarithmic buckets: every power of two range is
+ * split into SUB_BUCKETS linear buckets, so the relative error is below 1/SUB_BUCKETS.
+ * Written by a single thread, may be read by any thread
+ */
+class LatencyHistogram {
+public:
+    /**
+     * Constructor
+     */
+    LatencyHistogram();
+
+    /**
+     * Record an interval. Owner thread only
+     *
+     * @param nanos Interval, nanoseconds
+     */
+    void record(uint64_t nanos);
+
+    /**
+     * Add bucket counts to the totals
+     *
+     * @param counts Bucket counts, BUCKETS elements
+     */
+    void addTo(vector<uint64_t> &counts) const;
+
+    /**
+     * Get the largest value of a bucket
+     *
+     * @param bucket Bucket index
+     * @return Value, nanoseconds
+     */
+    static uint64_t bucketValue(size_t bucket);
+
+    static constexpr size_t SUB_BUCKET_BITS{ 4 };
+    static constexpr size_t SUB_BUCKETS{ 1 << SUB_BUCKET_BITS };
+    static constexpr size_t BUCKETS{ (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS };
+
+private:
+    atomic<uint64_t> counts[BUCKETS];
+
+    /**
+     * Get bucket of a value
+     *
+     * @param nanos Value, nanoseconds
+     * @return Bucket index
+     */
+    static size_t bucketOf(uint64_t nanos);
+};
+
+/**
+ * Process wide latency statistics of Core Actions and data sync. Every thread records
+ * into histograms of its own, so recording doesn't synchronize with other threads.
+ * Recording is disabled by default (enabled by NOTES_LATENCY_STATS environment variable
+ * or setEnabled()), a disabled recorder costs a single relaxed load
+ */
+class LatencyStats {
+public:
+    /**
+     * Get the process wide statistics
+     *
+     * @return Latency statistics
+     */
+    static LatencyStats& instance();
+
+    /**
+     * Get monotonic time, nanoseconds
+     *
+     * @return Time
+     */
+    static uint64_t now();
+
+    /**
+     * Check whether recording is enabled
+     *
+     * @return True if enabled
+     */
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Enable or disable recording
+     *
+     * @param state Recording state
+     */
+    void setEnabled(bool state);
+
+    /**
+     * Record an interval. Ignored if recording is disabled
+     *
+     * @param name Name of the measured operation, string literal: names are
+     *             compared by address first
+     * @param metric Measured interval
+     * @param nanos Interval, nanoseconds
+     */
+    void record(const char *name, LatencyMetric metric, uint64_t nanos);
+
+    /**
+     * Get percentiles of all recorded intervals
+     *
+     * @return Summary of every operation and metric recorded
+     */
+    vector<LatencySummary> getSummary() const;
+
+    /**
+     * Get text report of all recorded intervals
+     *
+     * @return Report, a line per operation and metric
+     */
+    string report() const;
+
+private:
+    // Maximum number of distinct operation names
+    static constexpr size_t MAX_NAMES{ 64 };
+    static constexpr size_t METRICS{ 7 };
+
+    /**
+     * Histograms of a thread, created on first use
+     */
+    struct ThreadHistograms {
+        atomic<LatencyHistogram*> histograms[MAX_NAMES][METRICS];
+
+        ThreadHistograms();
+        ~ThreadHistograms();
+    };
+
+    atomic<bool> enabled;
+    // Operation names, claimed in order of first use
+    atomic<const char*> names[MAX_NAMES];
+    // Histograms of every thread that recorded an interval
+    vector<unique_ptr<ThreadHistograms>> threads;
+    mutable mutex threadsMutex;
+
+    /**
+     * Constructor
+     */
+    LatencyStats();
+
+    /**
+     * Get index of an operation name, register it on first use
+     *
+     * @param name Operation name
+     * @return Index, MAX_NAMES if there is no room for a new name
+     */
+    size_t nameIndex(const char *name);
+
+    /**
+     * Get histograms of the calling thread, register them on first use
+     *
+     * @return Thread histograms
+     */
+    ThreadHistograms& threadHistograms();
+};
+
+/**
+ * Records duration of a scope when the statistics are enabled
+ */
+class LatencyTimer {
+public:
+    /**
+     * Constructor. Starts measuring
+     *
+     * @param name Name of the measured operation, string literal
+     * @param metric Measured interval
+     */
+    LatencyTimer(const char *name, LatencyMetric metric):
+        name{ name },
+        metric{ metric },
+        start{ LatencyStats::instance().isEnabled() ? LatencyStats::now() : 0 }
+        {}
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+    /**
+     * Destructor. Records the duration
+     */
+    ~LatencyTimer() {
+        if(start) {
+            LatencyStats::instance().record(name, metric, LatencyStats::now() - start);
+        }
+    }
+
+private:
+    const char *name;
+    LatencyMetric metric;
+    uint64_t start;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef _MPSC_QUEUE_HPP_
+#define _MPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+using std::atomic;
+using std::unique_ptr;
+
+/**
+ * Bounded lock-free queue for multiple producers and a single consumer.
+ * Ring buffer of cells, every cell has a sequence number telling whether it is
+ * ready for writing (sequence == position) or reading (sequence == position + 1)
+ */
+template<typename T>
+class MpscQueue {
+public:
+    /**
+     * Constructor
+     *
+     * @param capacity Maximum number of elements, power of two
+     */
+    explicit MpscQueue(size_t capacity):
+        cells{ new Cell[capacity] },
+        mask{ capacity - 1 },
+        enqueuePos{ 0 },
+        dequeuePos{ 0 }
+    {
+        for(size_t pos = 0; pos < capacity; ++pos) {
+            cells[pos].sequence.store(pos, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * Append an element. May be called from any thread
+     *
+     * @param value Element, moved from only if it was appended
+     * @return False if the queue is full
+     */
+    bool tryPush(T &value) {
+        auto pos = enqueuePos.load(std::memory_order_relaxed);
+        while(true) {
+            auto &cell = cells[pos & mask];
+            auto sequence = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos);
+
+            if(diff == 0) {
+                // Cell is free: claim the position
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                // Consumer hasn't freed the cell yet
+                return false;
+            } else {
+                // Another producer claimed the position
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Get number of queued elements. May be called from any thread, the value is
+     * approximate while the queue is modified
+     *
+     * @return Number of elements
+     */
+    size_t size() const {
+        auto dequeued = dequeuePos.load(std::memory_order_relaxed);
+        auto enqueued = enqueuePos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    /**
+     * Get maximum number of elements
+     *
+     * @return Capacity
+     */
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    /**
+     * Take the first element. Consumer thread only
+     *
+     * @param value Output: element
+     * @return False if the queue is empty
+     */
+    bool tryPop(T &value) {
+        auto pos = dequeuePos.load(std::memory_order_relaxed);
+        auto &cell = cells[pos & mask];
+        if(cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+
+        value = std::move(cell.value);
+        cell.sequence.store(pos + mask + 1, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    /**
+     * Queue element slot
+     */
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    // Cache line size
+    static constexpr size_t CACHE_LINE{ 64 };
+
+    unique_ptr<Cell[]> cells;
+    const size_t mask;
+    // Producers and consumer positions are kept on separate cache lines by padding,
+    // alignment would require aligned allocation of the queue.
+    // Consumer position is written by the consumer only, atomic for size()
+    char producerPadding[CACHE_LINE];
+    atomic<size_t> enqueuePos;
+    char consumerPadding[CACHE_LINE - sizeof(atomic<size_t>)];
+    atomic<size_t> dequeuePos;
+    char tailPadding[CACHE_LINE - sizeof(atomic<size_t>)];
+};
+
+template<typename T>
+constexpr size_t MpscQueue<T>::CACHE_LINE;
+
+#endif
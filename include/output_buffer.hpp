@@ -0,0 +1,176 @@
+#ifndef _OUTPUT_BUFFER_HPP_
+#define _OUTPUT_BUFFER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+
+#include "boost/utility/string_ref.hpp"
+
+using boost::string_ref;
+using std::deque;
+using std::shared_ptr;
+using std::string;
+
+/**
+ * Data queued for writing to a socket: a sequence of owned byte chunks and references
+ * to memory owned by somebody else, e.g. leased record text. Referenced memory is
+ * kept alive by its owner until it is written, so large payloads are sent by
+ * scatter/gather writes without being copied into the buffer.
+ *
+ * Data written by zero-copy sends (MSG_ZEROCOPY) is still read by the kernel after
+ * the send returns: it is retained until the kernel reports that it's done with it
+ */
+class OutputBuffer {
+public:
+    /**
+     * Constructor of an empty buffer
+     */
+    OutputBuffer(): offset{ 0 }, total{ 0 } {}
+
+    /**
+     * Constructor
+     *
+     * @param bytes Data, owned by the buffer
+     */
+    OutputBuffer(string &&bytes);
+
+    /**
+     * Move constructor
+     *
+     * @param other Buffer, left empty
+     */
+    OutputBuffer(OutputBuffer &&other);
+
+    /**
+     * Move assignment operator
+     *
+     * @param other Buffer, left empty
+     * @return Reference to the result object
+     */
+    OutputBuffer& operator=(OutputBuffer &&other);
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    /**
+     * Append a copy of data
+     *
+     * @param data Data
+     * @param size Size
+     */
+    void append(const char *data, size_t size);
+
+    /**
+     * Append a reference to data without copying it
+     *
+     * @param data Data, should stay valid while the owner is alive
+     * @param owner Keeps the data alive, released once the data is written
+     */
+    void appendRef(string_ref data, const shared_ptr<const void> &owner);
+
+    /**
+     * Append data of another buffer. Small chunks are copied, so many small responses
+     * are written by a single call
+     *
+     * @param other Buffer, left empty
+     */
+    void append(OutputBuffer &&other);
+
+    /**
+     * Get size of data not written yet
+     *
+     * @return Size in bytes
+     */
+    size_t size() const;
+
+    /**
+     * Check whether all data was written
+     *
+     * @return True if there is nothing to write
+     */
+    bool empty() const;
+
+    /**
+     * Describe data not written yet for a scatter/gather write. The buffer should not
+     * be modified until the write completes
+     *
+     * @param vectors Output: data blocks
+     * @param maxVectors Maximum number of blocks
+     * @return Number of blocks
+     */
+    size_t prepare(iovec *vectors, size_t maxVectors) const;
+
+    /**
+     * Mark data as written. Fully written chunks are released
+     *
+     * @param count Number of bytes written
+     */
+    void consume(size_t count);
+
+    /**
+     * Mark data as written by a zero-copy send. Fully written chunks are retained
+     * until the send is reported complete by release()
+     *
+     * @param count Number of bytes written
+     * @param sendId Number of the send call on the socket, counting zero-copy sends from 0
+     */
+    void consumeZerocopy(size_t count, uint32_t sendId);
+
+    /**
+     * Release chunks retained for zero-copy sends which completed. Sends on a stream
+     * socket complete in order
+     *
+     * @param lastSendId Number of the last completed send
+     */
+    void release(uint32_t lastSendId);
+
+private:
+    // Owned chunks take at least this much memory, so they never use the small string
+    // buffer and their data doesn't move along with the chunk
+    static constexpr size_t MIN_CHUNK_CAPACITY{ 256 };
+    // Chunks of an appended buffer up to this size are copied
+    static constexpr size_t MAX_COPIED_CHUNK{ 4 * 1024 };
+
+    /**
+     * Owned chunk or a reference
+     */
+    struct Chunk {
+        // Owned bytes, used if data is nullptr
+        string bytes;
+        // Referenced bytes
+        const char *data;
+        size_t size;
+        // Keeps referenced bytes alive
+        shared_ptr<const void> owner;
+        // Chunk was passed to a zero-copy send and must not change until it completes
+        bool zerocopy;
+        // Last zero-copy send the chunk was passed to
+        uint32_t sendId;
+
+        const char* begin() const { return data ? data : bytes.data(); }
+        size_t length() const { return data ? size : bytes.size(); }
+    };
+
+    // Data not written yet, the first chunk is written from the offset
+    deque<Chunk> chunks;
+    size_t offset;
+    // Size of data not written yet
+    size_t total;
+    // Written chunks the kernel may still read, in the order of sends
+    deque<Chunk> retained;
+
+    /**
+     * Mark data as written
+     *
+     * @param count Number of bytes written
+     * @param zerocopy Data was written by a zero-copy send
+     * @param sendId Number of the zero-copy send
+     */
+    void consume(size_t count, bool zerocopy, uint32_t sendId);
+};
+
+#endif
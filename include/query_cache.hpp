@@ -0,0 +1,143 @@
+#ifndef _QUERY_CACHE_HPP_
+#define _QUERY_CACHE_HPP_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::list;
+using std::mutex;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Query cache usage statistics
+ */
+struct QueryCacheStats {
+    // Number of lookups answered from the cache
+    size_t hits;
+    // Number of lookups which required a search
+    size_t misses;
+    // Number of cached queries
+    size_t entries;
+    // Approximate memory occupied by cached queries (bytes)
+    size_t memoryBytes;
+
+    /**
+     * Get share of lookups answered from the cache
+     *
+     * @return Hit rate in range [0, 1]
+     */
+    double hitRate() const;
+};
+
+/**
+ * Bounded LRU cache of search results (record Ids) keyed by normalized query.
+ * Every entry remembers data generation it was calculated for and is considered
+ * stale once the generation changes.
+ *
+ * The cache may be used from multiple threads. Entries are split between shards
+ * by key hash, every shard has its own lock and LRU order
+ */
+class QueryCache {
+public:
+    /**
+     * Constructor
+     *
+     * @param maxEntries Maximum number of cached queries
+     * @param maxBytes Maximum memory occupied by cached queries
+     */
+    QueryCache(size_t maxEntries, size_t maxBytes);
+
+    /**
+     * Find cached search result
+     *
+     * @param key Normalized query
+     * @param generation Data generation the search runs against
+     * @param ids Output: Ids of the records found
+     * @return True if an up to date result was found
+     */
+    bool lookup(const string &key, uint64_t generation, vector<int> &ids);
+
+    /**
+     * Store search result
+     *
+     * @param key Normalized query
+     * @param generation Data generation the result was calculated for
+     * @param ids Ids of the records found
+     */
+    void store(const string &key, uint64_t generation, const vector<int> &ids);
+
+    /**
+     * Drop all cached results
+     */
+    void clear();
+
+    /**
+     * Get cache usage statistics
+     *
+     * @return Statistics
+     */
+    QueryCacheStats getStats() const;
+
+private:
+    static constexpr size_t SHARDS{ 16 };
+
+    struct Entry {
+        string key;
+        uint64_t generation;
+        vector<int> ids;
+    };
+
+    using EntryIter = list<Entry>::iterator;
+
+    /**
+     * Independently locked part of the cache
+     */
+    struct Shard {
+        Shard(): memoryBytes{ 0 }, hits{ 0 }, misses{ 0 } {}
+
+        mutex shardMutex;
+        // Most recently used entries go first
+        list<Entry> entries;
+        unordered_map<string, EntryIter> index;
+        size_t memoryBytes;
+        size_t hits;
+        size_t misses;
+    };
+
+    // Limits of a single shard
+    size_t maxEntries;
+    size_t maxBytes;
+    mutable Shard shards[SHARDS];
+
+    /**
+     * Get shard an entry belongs to
+     *
+     * @param key Normalized query
+     * @return Shard
+     */
+    Shard& shardOf(const string &key);
+
+    /**
+     * Approximate memory occupied by an entry
+     *
+     * @param entry Cache entry
+     * @return Size in bytes
+     */
+    static size_t entrySize(const Entry &entry);
+
+    /**
+     * Remove an entry from the cache
+     *
+     * @param shard Shard holding the entry
+     * @param entry Entry to be removed
+     */
+    static void erase(Shard &shard, EntryIter entry);
+};
+
+#endif
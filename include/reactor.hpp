@@ -0,0 +1,404 @@
+#ifndef _REACTOR_HPP_
+#define _REACTOR_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "io_uring.hpp"
+#include "output_buffer.hpp"
+#include "wire_protocol.hpp"
+
+using std::atomic;
+using std::function;
+using std::map;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Non-blocking network event loop. A single thread accepts connections and reads and
+ * writes all of them; a connection is a state machine with its own buffers, so a slow
+ * client delays nobody else. Complete requests are handed to the request handler
+ * straight from the receive buffer, responses are handed back to the loop for writing
+ * from any thread.
+ *
+ * The loop is based on io_uring if it is enabled (IoUring::isEnabled()): accepts are
+ * multishot, reads and writes of all connections are submitted in a batch by a single
+ * system call per loop iteration. Otherwise it is based on epoll readiness events.
+ *
+ * Connections are persistent and carry any number of requests. A client may pipeline
+ * requests without waiting for responses: requests of a connection may complete
+ * in any order, every request gets exactly one response and responses are sent in
+ * the order of requests. Reading is paused while too many requests of a connection
+ * are in flight or too much response data is waiting for the client. After the
+ * client shuts its side down, the connection is closed once all responses are sent.
+ *
+ * Responses may refer to memory they keep alive instead of holding copies: output is
+ * written by scatter/gather sends straight from that memory. On epoll, large writes use
+ * zero-copy sends (MSG_ZEROCOPY) and the memory is released once the kernel reports
+ * the send complete on the socket error queue.
+ *
+ * Request and response frame: WireProtocol frame, 4 bytes little-endian payload
+ * length followed by the payload
+ */
+class Reactor {
+public:
+    /**
+     * Sends the response payload of a request. Should be called exactly once, may be
+     * called from any thread
+     */
+    using Responder = function<void(OutputBuffer &&response)>;
+
+    /**
+     * Request processing: called on the loop thread with the request payload, which is
+     * valid only during the call, and the responder of the request. Should not block:
+     * long processing is handed over to other threads which respond when done.
+     * If it throws, the responder is not called and an empty response is sent
+     */
+    using RequestHandler = function<void(string_ref request, Responder &&respond)>;
+
+    /**
+     * Constructor
+     *
+     * @param handler Request processing
+     * @param maxConnections Maximum number of open connections, connections beyond
+     *                       it are closed at once
+     */
+    Reactor(RequestHandler &&handler, size_t maxConnections);
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    /**
+     * Destructor. Closes all sockets
+     */
+    ~Reactor();
+
+    /**
+     * Accept connections on a listening socket. The reactor takes its ownership
+     *
+     * @param listenFd Listening socket
+     */
+    void addListener(int listenFd);
+
+    /**
+     * Run the event loop on the calling thread until stop() is called
+     */
+    void run();
+
+    /**
+     * Stop the event loop. May be called from any thread
+     */
+    void stop();
+
+    /**
+     * Get number of open connections
+     *
+     * @return Number of connections
+     */
+    size_t getConnections() const;
+
+    /**
+     * Get number of connections closed at once since the limit was reached
+     *
+     * @return Number of rejected connections
+     */
+    size_t getRejectedConnections() const;
+
+private:
+    // Length prefix of a request or response
+    static constexpr size_t HEADER_SIZE{ WireProtocol::FRAME_HEADER_SIZE };
+    // Larger requests are not read, the connection is closed
+    static constexpr size_t MAX_REQUEST_SIZE{ 64 * 1024 * 1024 };
+    // Larger responses don't fit the length prefix, an empty response is sent instead
+    static constexpr size_t MAX_RESPONSE_SIZE{ UINT32_MAX };
+    // Initial size of a connection input buffer, a single read may fetch many requests
+    static constexpr size_t READ_BUFFER_SIZE{ 16 * 1024 };
+    // Requests of a connection stop being dispatched while this many are in flight
+    static constexpr uint64_t MAX_PIPELINED_REQUESTS{ 128 };
+    // Requests of a connection stop being dispatched while this much response data
+    // isn't sent yet
+    static constexpr size_t MAX_PENDING_OUTPUT{ 4 * 1024 * 1024 };
+    // Output blocks passed to a single send call
+    static constexpr size_t MAX_SEND_VECTORS{ 64 };
+    // Writes of at least this size use zero-copy sends. Smaller ones are cheaper
+    // to copy than to pin pages and wait for the completion notification
+    static constexpr size_t MIN_ZEROCOPY_SIZE{ 64 * 1024 };
+    // Events processed per epoll_wait call
+    static constexpr int MAX_EVENTS{ 256 };
+    // Event identifiers of the wake up descriptor, listeners and connections
+    static constexpr uint64_t WAKE_ID{ 0 };
+    static constexpr uint64_t LISTENER_ID{ 1 };
+    static constexpr uint64_t FIRST_CONNECTION_ID{ uint64_t{ 1 } << 32 };
+    // io_uring submission ring size
+    static constexpr unsigned URING_ENTRIES{ 1024 };
+    // Bits of io_uring completion tag holding the operation
+    static constexpr unsigned OPERATION_BITS{ 3 };
+
+    /**
+     * io_uring operations, tagged with the event identifier
+     */
+    enum class Operation {
+        WAKE,
+        ACCEPT,
+        RECV,
+        SEND,
+        CANCEL
+    };
+
+    /**
+     * Client connection
+     */
+    struct Connection {
+        int fd;
+        // Data read and not dispatched yet: the first inputSize bytes
+        string input;
+        size_t inputSize;
+        // Sequence number of the next request dispatched
+        uint64_t nextSequence;
+        // Sequence number of the next response queued for writing
+        uint64_t sendSequence;
+        // Responses completed ahead of earlier requests: sequence number -> response
+        map<uint64_t, OutputBuffer> ready;
+        // Framed responses being written. Not modified while an io_uring send is in flight
+        OutputBuffer output;
+        // Framed responses queued after the output
+        OutputBuffer pendingOutput;
+        // Client shut its side down
+        bool readClosed;
+        // Last write didn't complete, waiting for the socket to become writable
+        bool writeBlocked;
+        // Epoll events watched
+        uint32_t events;
+        // io_uring receive / send in flight
+        bool recvPending;
+        bool sendPending;
+        // Closed while its io_uring operations were in flight, released once they complete
+        bool closing;
+        // Zero-copy sends are enabled on the socket
+        bool zerocopy;
+        // Number of zero-copy sends made, the kernel reports their completion by number
+        uint32_t zerocopySends;
+        // Message of the io_uring send in flight
+        msghdr sendMessage;
+        iovec sendVectors[MAX_SEND_VECTORS];
+    };
+
+    /**
+     * Response handed over by a responder
+     */
+    struct Completion {
+        uint64_t id;
+        uint64_t sequence;
+        OutputBuffer response;
+    };
+
+    RequestHandler handler;
+    const size_t maxConnections;
+    int epollFd;
+    // Event descriptor waking up the loop
+    int wakeFd;
+    vector<int> listeners;
+    atomic<bool> stopping;
+    // Accessed by the loop thread only
+    unordered_map<uint64_t, unique_ptr<Connection>> connections;
+    uint64_t nextConnectionId;
+    atomic<size_t> connectionsCount;
+    atomic<size_t> rejectedCount;
+    // Responses handed over by responders
+    vector<Completion> completions;
+    mutex completionsMutex;
+    // io_uring of the running loop, nullptr if the loop is based on epoll
+    IoUring *ring;
+    // Number of io_uring operations which haven't completed
+    size_t ringOperations;
+    // False if the kernel doesn't support multishot accept
+    bool multishotAccept;
+    // Destination of wake up descriptor reads
+    uint64_t wakeValue;
+
+    /**
+     * Run the event loop based on epoll
+     */
+    void runEpoll();
+
+    /**
+     * Run the event loop based on io_uring
+     */
+    void runUring();
+
+    /**
+     * Process io_uring completion
+     *
+     * @param cqe Completion
+     */
+    void handleCompletion(const io_uring_cqe &cqe);
+
+    /**
+     * Queue io_uring operation
+     *
+     * @param id Event identifier
+     * @param operation Operation
+     */
+    void submitOperation(uint64_t id, Operation operation);
+
+    /**
+     * Register an accepted connection
+     *
+     * @param fd Connection socket
+     */
+    void addConnection(int fd);
+
+    /**
+     * Check whether more requests of a connection may be dispatched
+     *
+     * @param connection Connection
+     * @return True if neither requests in flight nor unsent responses are at the limit
+     */
+    static bool canDispatch(const Connection &connection);
+
+    /**
+     * Check whether a connection should be read
+     *
+     * @param connection Connection
+     * @return True if reading isn't paused
+     */
+    static bool canRead(const Connection &connection);
+
+    /**
+     * Check whether a connection has response data to write
+     *
+     * @param connection Connection
+     * @return True if there is data to write
+     */
+    static bool hasOutput(const Connection &connection);
+
+    /**
+     * Parse length prefix of a request
+     *
+     * @param header HEADER_SIZE bytes
+     * @return Payload length, 0 if the length is not valid
+     */
+    static size_t parseLength(const char *header);
+
+    /**
+     * Dispatch complete requests from the input buffer, make room for the next read
+     *
+     * @param id Connection Id
+     * @param connection Connection
+     * @return False if the connection was closed
+     */
+    bool parseInput(uint64_t id, Connection &connection);
+
+    /**
+     * Queue responses which are next in the request order for writing
+     *
+     * @param connection Connection
+     */
+    static void flushReady(Connection &connection);
+
+    /**
+     * Continue serving a connection after its state changed: dispatch buffered
+     * requests, write responses, watch the matching events or submit io_uring
+     * operations. Closes the connection once the client shut its side down and
+     * all responses are sent
+     *
+     * @param id Connection Id
+     * @param connection Connection
+     */
+    void resume(uint64_t id, Connection &connection);
+
+    /**
+     * Accept pending connections
+     *
+     * @param listenFd Listening socket
+     */
+    void acceptConnections(int listenFd);
+
+    /**
+     * Read available data, dispatch requests once they are complete
+     *
+     * @param id Connection Id
+     * @param connection Connection
+     * @return False if the connection was closed
+     */
+    bool readConnection(uint64_t id, Connection &connection);
+
+    /**
+     * Write pending response data
+     *
+     * @param id Connection Id
+     * @param connection Connection
+     * @return False if the connection was closed
+     */
+    bool writeConnection(uint64_t id, Connection &connection);
+
+    /**
+     * Release output of zero-copy sends reported complete on the socket error queue
+     *
+     * @param connection Connection
+     * @return True if any completion was reported
+     */
+    static bool readErrorQueue(Connection &connection);
+
+    /**
+     * Hand a complete request over to the request handler
+     *
+     * @param id Connection Id
+     * @param connection Connection
+     * @param request Request payload in the input buffer
+     */
+    void dispatchRequest(uint64_t id, Connection &connection, string_ref request);
+
+    /**
+     * Hand a response over to the loop. May be called from any thread
+     *
+     * @param id Connection Id
+     * @param sequence Request sequence number
+     * @param response Response
+     */
+    void complete(uint64_t id, uint64_t sequence, OutputBuffer &&response);
+
+    /**
+     * Start writing responses handed over by responders
+     */
+    void processCompletions();
+
+    /**
+     * Change events watched for a connection if they differ. The connection is closed
+     * if the change fails
+     *
+     * @param id Connection Id
+     * @param connection Connection
+     * @param events Epoll events
+     * @return False if the connection was closed
+     */
+    bool watch(uint64_t id, Connection &connection, uint32_t events);
+
+    /**
+     * Close connection. While its io_uring operations are in flight the socket is only
+     * shut down, the connection is released once they complete
+     *
+     * @param id Connection Id
+     */
+    void closeConnection(uint64_t id);
+
+    /**
+     * Wake up the loop
+     */
+    void wake();
+};
+
+#endif
@@ -10,11 +10,56 @@
 #include "boost/algorithm/string.hpp"
 #include "boost/date_time/gregorian/gregorian.hpp"
 #include "boost/date_time/gregorian/greg_serialize.hpp"
+#include "boost/serialization/split_member.hpp"
 #include "boost/serialization/vector.hpp"
+#include "boost/serialization/version.hpp"
+
+#include "tag_dictionary.hpp"
+#include "tag_set.hpp"
 
 using std::string;
 using std::vector;
 
+/**
+ * Loads a date saved by greg_serialize (undelimited ISO string). Archive layout is the
+ * same, but regular dates are parsed without temporary allocations
+ */
+struct DateLoader {
+    /**
+     * Constructor
+     *
+     * @param date Date to be loaded
+     */
+    DateLoader(boost::gregorian::date &date): date{ date } {}
+
+    /**
+     * Load the date
+     *
+     * @param ar Storage
+     * @param version Version
+     */
+    template<class Archive>
+    void serialize(Archive &ar, const unsigned int /*version*/) {
+        string iso;
+        ar & iso;
+
+        if(iso.size() == 8 && std::all_of(iso.begin(), iso.end(), ::isdigit)) {
+            auto number = [&iso](size_t pos, size_t len) {
+                unsigned short value = 0;
+                for(auto i = pos; i < pos + len; ++i) value = value * 10 + (iso[i] - '0');
+                return value;
+            };
+            date = { number(0, 4), number(4, 2), number(6, 2) };
+        } else {
+            // Special values like not-a-date-time
+            date = boost::gregorian::date{ boost::gregorian::special_value_from_string(iso) };
+        }
+    }
+
+    private:
+    boost::gregorian::date &date;
+};
+
 /**
  * Defines user data entry
  */
@@ -32,12 +77,32 @@ public:
      */
     Record(string &&text, vector<string> &&tags): 
         text    { std::forward<string>(text)               }, 
-        tags    { std::forward<vector<string>>(tags)       },
+        tags    { internTags(tags)                         },
         cdate   { boost::gregorian::day_clock::local_day() },
         mdate   { boost::gregorian::day_clock::local_day() },
         deleted { false                                    }
         {}
 
+    /**
+     * Constructor for restoring a stored record
+     *
+     * @param id Record Id
+     * @param text Text
+     * @param tags Tag Ids
+     * @param cdate Creation date
+     * @param mdate Modification date
+     * @param deleted Deleted state
+     */
+    Record(int id, string &&text, TagSet &&tags, const boost::gregorian::date &cdate,
+        const boost::gregorian::date &mdate, bool deleted):
+        id      { id                                       },
+        text    { std::forward<string>(text)               }, 
+        tags    { std::forward<TagSet>(tags)               },
+        cdate   { cdate                                    },
+        mdate   { mdate                                    },
+        deleted { deleted                                  }
+        {}
+
     /**
      * Add tag to a record
      * 
@@ -100,7 +165,14 @@ public:
      * 
      * @return Record tags
      */
-    const vector<string>& getTags() const;
+    vector<string> getTags() const;
+
+    /**
+     * Get Ids of record tags
+     * 
+     * @return Record tag Ids
+     */
+    const TagSet& getTagIds() const;
 
     /**
      * Get record text
@@ -161,6 +233,14 @@ public:
      */
     bool tagged(const string &tag) const;
 
+    /**
+     * Check whether the record has specified tag
+     *
+     * @param tag Tag Id
+     * @return True if the record has specified tag
+     */
+    bool tagged(TagId tag) const;
+
 private:
     /**
      * Constructor for serialization purposes
@@ -174,7 +254,7 @@ private:
     string text;
 
     // Attached tags 
-    vector<string> tags;
+    TagSet tags;
 
     // Creation date
     boost::gregorian::date cdate; 
@@ -185,6 +265,14 @@ private:
     // Deleted state
     bool deleted;
     
+    /**
+     * Get Ids of tags, register unknown tags in the tag dictionary
+     *
+     * @param tags Tag names
+     * @return Tag Ids
+     */
+    static TagSet internTags(const vector<string> &tags);
+
 friend class boost::serialization::access;
 
     /*
@@ -194,13 +282,41 @@ friend class boost::serialization::access;
      * @param version Version
      */
     template<class Archive>
-    void serialize(Archive &ar, const unsigned int version) {
+    void save(Archive &ar, const unsigned int /*version*/) const {
         ar & cdate;
         ar & mdate;
         ar & tags;
         ar & text;
         ar & deleted;
     }
+
+    /*
+     * Deserialize record from persistent storage. Version 0 stores tag names,
+     * later versions store tag Ids of the dictionary saved along with records
+     * 
+     * @param ar Storage 
+     * @param version Version
+     */
+    template<class Archive>
+    void load(Archive &ar, const unsigned int version) {
+        DateLoader cdateLoader{ cdate };
+        DateLoader mdateLoader{ mdate };
+        ar & cdateLoader;
+        ar & mdateLoader;
+        if(version == 0) {
+            vector<string> tagNames;
+            ar & tagNames;
+            tags = internTags(tagNames);
+        } else {
+            ar & tags;
+        }
+        ar & text;
+        ar & deleted;
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
+BOOST_CLASS_VERSION(Record, 1)
+
 #endif // RECORD
@@ -0,0 +1,111 @@
+#ifndef _RECORD_QUERY_HPP_
+#define _RECORD_QUERY_HPP_
+
+#include "record.hpp"
+
+using std::string;
+using std::vector;
+
+/**
+ * Defines record search conditions. Unlike an arbitrary RecordPredicate a query
+ * can be normalized into a key, so equal requests can be recognized
+ */
+struct RecordQuery {
+    /**
+     * Constructor. Default query matches all non-deleted records
+     */
+    RecordQuery(): deleted{ false } {}
+
+    /**
+     * Check whether a record satisfies the query
+     *
+     * @param record Record
+     * @return True if the record satisfies all query conditions
+     */
+    bool matches(const Record &record) const;
+
+    /**
+     * Get normalized query representation. Queries which differ only in tags order,
+     * duplicated tags or text fragment case produce the same key
+     *
+     * @return Query key
+     */
+    string key() const;
+
+    // Search among deleted records instead of non-deleted ones
+    bool deleted;
+
+    // Record should have all of these tags
+    vector<string> allTags;
+
+    // Record should have at least one of these tags
+    vector<string> anyTags;
+
+    // Creation date bounds: [cdateAfter, cdateBefore). Not limited if not_a_date_time
+    boost::gregorian::date cdateAfter;
+    boost::gregorian::date cdateBefore;
+
+    // Modification date bounds: [mdateAfter, mdateBefore). Not limited if not_a_date_time
+    boost::gregorian::date mdateAfter;
+    boost::gregorian::date mdateBefore;
+
+    // Text fragment (case insensitive). Not limited if empty
+    string fragment;
+};
+
+/**
+ * Query prepared for matching many records: tag names are resolved to tag Ids once
+ */
+struct QueryMatcher {
+    /**
+     * Constructor
+     *
+     * @param query Search conditions
+     */
+    QueryMatcher(const RecordQuery &query);
+
+    /**
+     * Check whether a record satisfies the query
+     *
+     * @param record Record
+     * @return True if the record satisfies all query conditions
+     */
+    bool matches(const Record &record) const;
+
+    /**
+     * Get search conditions
+     *
+     * @return Query
+     */
+    const RecordQuery& getQuery() const;
+
+    /**
+     * Check whether the query can't match any record (refers to unknown tags)
+     *
+     * @return True if no record can satisfy the query
+     */
+    bool isUnsatisfiable() const;
+
+    /**
+     * Get Ids of tags which a record should have all of
+     *
+     * @return Tag Ids
+     */
+    const TagSet& getAllTags() const;
+
+    /**
+     * Get Ids of tags which a record should have at least one of
+     *
+     * @return Tag Ids, empty if not limited
+     */
+    const vector<TagId>& getAnyTags() const;
+
+    private:
+    const RecordQuery &query;
+    // Query can't match any record (refers to unknown tags)
+    bool unsatisfiable;
+    TagSet allTags;
+    vector<TagId> anyTags;
+};
+
+#endif
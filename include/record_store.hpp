@@ -0,0 +1,756 @@
+#ifndef _RECORD_STORE_HPP_
+#define _RECORD_STORE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "boost/serialization/collection_size_type.hpp"
+#include "boost/serialization/item_version_type.hpp"
+#include "boost/serialization/split_member.hpp"
+#include "boost/utility/string_ref.hpp"
+
+#include "arena.hpp"
+#include "epoch_manager.hpp"
+#include "record.hpp"
+#include "record_query.hpp"
+#include "text_delta.hpp"
+
+using boost::string_ref;
+using std::atomic;
+using std::function;
+using std::mutex;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Column oriented, multi version storage of records. Every record field is kept in
+ * a separate dense column, so a scan over dates or deleted state touches only the
+ * data it needs. Columns are split into fixed size segments.
+ *
+ * Readers work with an immutable snapshot and never wait for the writer. The writer
+ * prepares the next version by copying only the segments it changes and publishes it
+ * atomically; replaced segments, text and tags are reclaimed once no reader can see
+ * them. Modifications must be serialized by the caller.
+ *
+ * Text and tags of all records are allocated in a single arena.
+ * Records are materialized on request
+ */
+class RecordStore {
+private:
+    static constexpr size_t WORD_BITS{ 64 };
+    static constexpr size_t SEGMENT_SIZE{ 1024 };
+    static constexpr size_t SEGMENT_WORDS{ SEGMENT_SIZE / WORD_BITS };
+    // Number of segments scanned by a single task
+    static constexpr size_t SCAN_GRAIN{ 8 };
+    // Number of rows changed by a single task of a bulk modification
+    static constexpr size_t CHANGE_GRAIN{ 4096 };
+
+    /**
+     * Columns of up to SEGMENT_SIZE consecutive records
+     */
+    struct Segment {
+        // Record Ids, ascending
+        int ids[SEGMENT_SIZE];
+        // Creation dates (day numbers)
+        uint32_t cdays[SEGMENT_SIZE];
+        // Modification dates (day numbers)
+        uint32_t mdays[SEGMENT_SIZE];
+        // Deleted state, bit per record. Atomic, since the writer may append
+        // to a segment while readers scan it
+        atomic<uint64_t> deletedBits[SEGMENT_WORDS];
+        // Sorted tag Ids of a record: [tagIds[i], tagIds[i] + tagCounts[i])
+        TagId *tagIds[SEGMENT_SIZE];
+        uint32_t tagCounts[SEGMENT_SIZE];
+        // Text of a record: [texts[i], texts[i] + textLengths[i])
+        char *texts[SEGMENT_SIZE];
+        uint32_t textLengths[SEGMENT_SIZE];
+    };
+
+public:
+    /**
+     * Immutable version of the records
+     */
+    class Snapshot {
+    public:
+        /**
+         * Get number of records
+         *
+         * @return Number of records
+         */
+        size_t size() const;
+
+        /**
+         * Get version number, incremented on every published modification
+         *
+         * @return Version number
+         */
+        uint64_t getGeneration() const;
+
+        /**
+         * Find record position
+         *
+         * @param id Record Id
+         * @param row Output: record position
+         * @return True if the record was found
+         */
+        bool find(int id, size_t &row) const;
+
+        /**
+         * Get record
+         *
+         * @param row Record position
+         * @param withText Copy record text, otherwise the text is left empty
+         * @return Copy of the record
+         */
+        Record get(size_t row, bool withText = true) const;
+
+        /**
+         * Get record Id
+         *
+         * @param row Record position
+         * @return Record Id
+         */
+        int getId(size_t row) const;
+
+        /**
+         * Get record text without copying it
+         *
+         * @param row Record position
+         * @return Reference to the text, valid while the snapshot is pinned
+         */
+        string_ref getText(size_t row) const;
+
+        /**
+         * Find records satisfying the query. Large snapshots are scanned in parallel
+         *
+         * @param matcher Prepared query
+         * @return Positions of the records found
+         */
+        vector<size_t> select(const QueryMatcher &matcher) const;
+
+    private:
+        friend class RecordStore;
+
+        vector<shared_ptr<Segment>> segments;
+        // Number of records. Segment rows beyond it are not part of the snapshot
+        size_t count;
+        uint64_t generation;
+
+        /**
+         * Constructor
+         *
+         * @param generation Version number
+         */
+        explicit Snapshot(uint64_t generation): count{ 0 }, generation{ generation } {}
+
+        /**
+         * Get number of snapshot records in a segment
+         *
+         * @param segment Segment index
+         * @return Number of records
+         */
+        size_t segmentRows(size_t segment) const;
+
+        /**
+         * Find segment records satisfying the query
+         *
+         * @param segmentIdx Segment index
+         * @param matcher Prepared query
+         * @param fragment Lower case text fragment
+         * @param rowsFound Output: positions of the records found are appended
+         */
+        void selectSegment(size_t segmentIdx, const QueryMatcher &matcher, const string &fragment,
+            vector<size_t> &rowsFound) const;
+
+        /**
+         * Clear selection bits of records with day out of range [from, to)
+         *
+         * @param days Segment date column
+         * @param rows Number of segment records
+         * @param from First day in range
+         * @param to Day after the range
+         * @param selected Segment selection bitmap
+         */
+        static void filterDays(const uint32_t *days, size_t rows, uint32_t from, uint32_t to,
+            uint64_t *selected);
+
+        /**
+         * Check whether the record tags satisfy the query
+         *
+         * @param segment Segment
+         * @param row Position in the segment
+         * @param matcher Prepared query
+         * @return True if the record tags satisfy the query
+         */
+        static bool tagsMatch(const Segment &segment, size_t row, const QueryMatcher &matcher);
+
+        /**
+         * Check whether the record text contains specified fragment
+         *
+         * @param segment Segment
+         * @param row Position in the segment
+         * @param fragment Lower case text fragment
+         * @return True if the record contains the fragment (case insensitive)
+         */
+        static bool textMatches(const Segment &segment, size_t row, const string &fragment);
+    };
+
+    /**
+     * Snapshot pinned for reading. The snapshot stays valid while the view is alive
+     */
+    class View {
+    public:
+        /**
+         * Constructor
+         *
+         * @param guard Pinned epoch
+         * @param snapshot Snapshot published at the time of pinning
+         * @param store Store the snapshot belongs to
+         */
+        View(EpochManager::Guard &&guard, const Snapshot *snapshot, const RecordStore *store):
+            guard{ std::move(guard) },
+            snapshot{ snapshot },
+            store{ store }
+            {}
+
+        const Snapshot& operator*() const { return *snapshot; }
+        const Snapshot* operator->() const { return snapshot; }
+
+        /**
+         * Get store the snapshot belongs to
+         *
+         * @return Record store
+         */
+        const RecordStore& getStore() const { return *store; }
+
+    private:
+        EpochManager::Guard guard;
+        const Snapshot *snapshot;
+        const RecordStore *store;
+    };
+
+    /**
+     * Text of records kept alive after the snapshot it was read from is unpinned,
+     * e.g. while it is sent over network. Only the text blocks are kept: a slow
+     * client doesn't hold back reclamation of the snapshots published meanwhile.
+     * May be released by any thread, before the store is destroyed
+     */
+    class TextLease {
+    public:
+        /**
+         * Constructor
+         *
+         * @param store Record store
+         * @param texts Texts of a pinned snapshot
+         */
+        TextLease(const RecordStore &store, vector<const char*> &&texts);
+
+        TextLease(const TextLease&) = delete;
+        TextLease& operator=(const TextLease&) = delete;
+
+        /**
+         * Destructor. Text replaced meanwhile is freed by the writer on the next publish
+         */
+        ~TextLease();
+
+    private:
+        const RecordStore &store;
+        vector<const char*> texts;
+    };
+
+    /**
+     * Records of a pinned snapshot, referred to in place. The snapshot stays valid
+     * while the selection is alive
+     */
+    class Selection {
+    public:
+        /**
+         * Constructor
+         *
+         * @param view Pinned snapshot
+         * @param rows Positions of the records
+         */
+        Selection(View &&view, vector<size_t> &&rows):
+            view{ std::move(view) },
+            rows{ std::move(rows) }
+            {}
+
+        Selection(const Selection&) = delete;
+        Selection& operator=(const Selection&) = delete;
+
+        /**
+         * Get snapshot
+         *
+         * @return Pinned snapshot
+         */
+        const Snapshot& getSnapshot() const { return *view; }
+
+        /**
+         * Get record positions
+         *
+         * @return Positions of the records
+         */
+        const vector<size_t>& getRows() const { return rows; }
+
+        /**
+         * Get total size of the records text
+         *
+         * @return Size in bytes
+         */
+        size_t getTextSize() const;
+
+        /**
+         * Copy the records
+         *
+         * @return Copies of the records
+         */
+        vector<Record> getRecords() const;
+
+        /**
+         * Keep text of the records alive after the selection is released. The
+         * selection pins the snapshot and should be short lived, the lease may be
+         * kept for as long as the text is needed
+         *
+         * @param minSize Shorter text is not leased
+         * @return Lease of the text of at least minSize bytes
+         */
+        shared_ptr<const TextLease> leaseText(size_t minSize) const;
+
+    private:
+        View view;
+        vector<size_t> rows;
+    };
+
+    /**
+     * Constructor
+     */
+    RecordStore();
+
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
+
+    /**
+     * Destructor. No reader should be active
+     */
+    ~RecordStore();
+
+    /**
+     * Pin the latest published snapshot. May be called from any thread
+     *
+     * @return Pinned snapshot
+     */
+    View read() const;
+
+    /**
+     * Make modifications visible to readers and reclaim versions no reader uses
+     */
+    void publish();
+
+    /**
+     * Drop modifications which weren't published. Text and tags stored for them
+     * are released at once, no reader has seen them
+     */
+    void discard();
+
+    /**
+     * Get number of records, including unpublished modifications
+     *
+     * @return Number of records
+     */
+    size_t size() const;
+
+    /**
+     * Append a record. Records should be appended in ascending Id order
+     *
+     * @param record Record
+     */
+    void append(const Record &record);
+
+    /**
+     * Reserve space for records
+     *
+     * @param size Expected number of records
+     */
+    void reserve(size_t size);
+
+    /**
+     * Find record position, including unpublished modifications
+     *
+     * @param id Record Id
+     * @param row Output: record position
+     * @return True if the record was found
+     */
+    bool find(int id, size_t &row) const;
+
+    /**
+     * Get record, including unpublished modifications
+     *
+     * @param row Record position
+     * @return Copy of the record
+     */
+    Record get(size_t row) const;
+
+    /**
+     * Get record Id, including unpublished modifications
+     *
+     * @param row Record position
+     * @return Record Id
+     */
+    int getId(size_t row) const;
+
+    /**
+     * Find records satisfying a query, including unpublished modifications
+     *
+     * @param matcher Prepared query
+     * @return Positions of the records found, ascending
+     */
+    vector<size_t> select(const QueryMatcher &matcher) const;
+
+    /**
+     * Get record text, including unpublished modifications
+     *
+     * @param row Record position
+     * @return Text, valid until the record is modified
+     */
+    string_ref getText(size_t row) const;
+
+    /**
+     * Set record Id. Ascending Id order should be kept
+     *
+     * @param row Record position
+     * @param id Record Id
+     */
+    void setId(size_t row, int id);
+
+    /**
+     * Replace record content
+     *
+     * @param row Record position
+     * @param record Record with updated content
+     */
+    void update(size_t row, const Record &record);
+
+    /**
+     * Add a tag. Text stays in place
+     *
+     * @param row Record position
+     * @param tag Tag Id
+     * @return False if the record already has the tag
+     */
+    bool addTag(size_t row, TagId tag);
+
+    /**
+     * Remove a tag. Text stays in place
+     *
+     * @param row Record position
+     * @param tag Tag Id
+     * @return False if the record doesn't have the tag
+     */
+    bool removeTag(size_t row, TagId tag);
+
+    /**
+     * Set deleted state
+     *
+     * @param row Record position
+     * @param state Deleted state
+     * @return False if the record already is in the state
+     */
+    bool setDeleted(size_t row, bool state);
+
+    /**
+     * Replace record text. Tags stay in place
+     *
+     * @param row Record position
+     * @param text New text
+     * @return False if the text is the same
+     */
+    bool setText(size_t row, const string &text);
+
+    /**
+     * Change record text by a delta. The result is built straight from the current
+     * text and the changed ranges. Tags stay in place
+     *
+     * @param row Record position
+     * @param delta Delta valid for the current text
+     */
+    void editText(size_t row, const TextDelta &delta);
+
+    /**
+     * Add a tag to many records. Records are checked and changed in parallel
+     *
+     * @param rows Record positions, ascending
+     * @param tag Tag Id
+     * @param mdate Modification date of the changed records
+     * @return Number of records which didn't have the tag
+     */
+    size_t addTag(const vector<size_t> &rows, TagId tag, const boost::gregorian::date &mdate);
+
+    /**
+     * Remove a tag from many records. Records are checked and changed in parallel
+     *
+     * @param rows Record positions, ascending
+     * @param tag Tag Id
+     * @param mdate Modification date of the changed records
+     * @return Number of records which had the tag
+     */
+    size_t removeTag(const vector<size_t> &rows, TagId tag, const boost::gregorian::date &mdate);
+
+    /**
+     * Set deleted state of many records. Records are checked and changed in parallel
+     *
+     * @param rows Record positions, ascending
+     * @param state Deleted state
+     * @return Number of records which were in the other state
+     */
+    size_t setDeleted(const vector<size_t> &rows, bool state);
+
+    /**
+     * Replace text of many records. Texts are copied into place in parallel
+     *
+     * @param rows Record positions, ascending
+     * @param texts New texts in the order of rows
+     * @param mdate Modification date of the records
+     */
+    void setText(const vector<size_t> &rows, const vector<string> &texts, const boost::gregorian::date &mdate);
+
+    /**
+     * Set modification date
+     *
+     * @param row Record position
+     * @param mdate Modification date
+     */
+    void setModificationDate(size_t row, const boost::gregorian::date &mdate);
+
+    /**
+     * Remove record. Positions of the following records are shifted
+     *
+     * @param row Record position
+     */
+    void erase(size_t row);
+
+    /**
+     * Translate tag Ids after loading records saved with another tag dictionary.
+     * Tags are translated in place, so the records should not be published yet
+     *
+     * @param mapping Saved tag Id -> actual tag Id
+     * @param firstRow Position of the first loaded record
+     *        Throws if a record refers to a tag Id outside the mapping
+     */
+    void remapTags(const vector<TagId> &mapping, size_t firstRow);
+
+    /**
+     * Get statistics of memory used for text and tags
+     *
+     * @return Arena statistics
+     */
+    ArenaStats getArenaStats() const;
+
+private:
+    /**
+     * Record columns values, text and tags are referenced
+     */
+    struct Row {
+        int id;
+        uint32_t cday;
+        uint32_t mday;
+        bool deleted;
+        TagId *tagIds;
+        uint32_t tagCount;
+        char *text;
+        uint32_t textLength;
+    };
+
+    // Memory for text and tags. Declared first: retired blocks are released to it
+    // when the epoch manager is destroyed
+    Arena arena;
+
+    /**
+     * Text blocks kept alive by text leases
+     */
+    struct Leases {
+        // Guards the rest, taken by lease holders and by the writer
+        mutex leasesMutex;
+        // Number of leased texts, checked by the writer before taking the lock
+        atomic<size_t> count{ 0 };
+        // Leased text -> number of leases
+        unordered_map<const char*, size_t> leased;
+        // Leased text replaced in the published version -> block size
+        unordered_map<const char*, size_t> retired;
+        // Replaced text no lease refers to anymore, freed by the writer
+        vector<pair<char*, size_t>> released;
+    };
+    // Declared before the epoch manager, retired blocks are checked against it
+    mutable Leases leases;
+
+    mutable EpochManager epochs;
+    // Latest version visible to readers
+    atomic<const Snapshot*> published;
+    // Next version being prepared by the writer, nullptr if there are no modifications
+    unique_ptr<Snapshot> draft;
+    // Text and tag blocks replaced in the draft
+    vector<pair<char*, size_t>> retiredBlocks;
+    // Text and tag blocks stored for the draft
+    vector<pair<char*, size_t>> draftBlocks;
+
+    /**
+     * Get the latest version, including unpublished modifications
+     *
+     * @return Snapshot
+     */
+    const Snapshot& latest() const;
+
+    /**
+     * Get the draft, start it from the published version if needed
+     *
+     * @return Draft snapshot
+     */
+    Snapshot& edit();
+
+    /**
+     * Get a segment for modification. Segments shared with the published version
+     * are copied first
+     *
+     * @param segment Segment index
+     * @return Segment owned by the draft
+     */
+    Segment& editSegment(size_t segment);
+
+    /**
+     * Pick records to change, records are checked in parallel
+     *
+     * @param rows Record positions, ascending
+     * @param pred Check of record columns, called from several threads
+     * @return Positions of the records satisfying the check, ascending
+     */
+    vector<size_t> filterRows(const vector<size_t> &rows, const function<bool(const Row&)> &pred) const;
+
+    /**
+     * Change records in parallel. Their segments are copied to the draft up front,
+     * changes of different records don't interfere
+     *
+     * @param rows Record positions, ascending
+     * @param change Change of a record: (index in rows, segment, position in segment),
+     *               called from several threads
+     */
+    void changeRows(const vector<size_t> &rows, const function<void(size_t, Segment&, size_t)> &change);
+
+    /**
+     * Append record columns to the draft. Rows beyond the snapshot size are never
+     * read, so the last segment is extended in place
+     *
+     * @param row Record columns
+     */
+    void appendRow(const Row &row);
+
+    /**
+     * Read record columns
+     *
+     * @param row Record position
+     * @return Record columns
+     */
+    Row readRow(size_t row) const;
+
+    /**
+     * Set record deleted state
+     *
+     * @param segment Segment
+     * @param row Position in the segment
+     * @param state Deleted state
+     */
+    static void setDeleted(Segment &segment, size_t row, bool state);
+
+    /**
+     * Copy tags into the arena
+     *
+     * @param tags Tag Ids
+     * @return Arena block
+     */
+    TagId* storeTags(const TagSet &tags);
+
+    /**
+     * Copy text into the arena
+     *
+     * @param text Text
+     * @return Arena block
+     */
+    char* storeText(const string &text);
+
+    /**
+     * Release arena block once the published version is replaced
+     *
+     * @param block Block
+     * @param size Block size
+     */
+    void retire(char *block, size_t size);
+
+    /**
+     * Free blocks of a replaced version no reader can access anymore. Leased
+     * text blocks are freed once their leases are released
+     *
+     * @param blocks Blocks
+     */
+    void freeBlocks(const vector<pair<char*, size_t>> &blocks);
+
+friend class boost::serialization::access;
+
+    /*
+     * Serialize records. The layout matches serialized vector<Record>
+     *
+     * @param ar Storage
+     * @param version Version
+     */
+    template<class Archive>
+    void save(Archive &ar, const unsigned int /*version*/) const {
+        const auto &snapshot = latest();
+        const boost::serialization::collection_size_type recordCount(snapshot.size());
+        const boost::serialization::item_version_type itemVersion(
+            boost::serialization::version<Record>::value);
+        ar << recordCount;
+        ar << itemVersion;
+
+        for(size_t row = 0; row < snapshot.size(); ++row) {
+            const Record record{ snapshot.get(row) };
+            ar << record;
+        }
+    }
+
+    /*
+     * Deserialize records written by save() or as vector<Record>.
+     * Records are appended to the draft
+     *
+     * @param ar Storage
+     * @param version Version
+     */
+    template<class Archive>
+    void load(Archive &ar, const unsigned int /*version*/) {
+        boost::serialization::collection_size_type recordCount;
+        boost::serialization::item_version_type itemVersion;
+        ar >> recordCount;
+        if(boost::archive::library_version_type(3) < ar.get_library_version()) {
+            ar >> itemVersion;
+        }
+        reserve(size() + recordCount);
+
+        // Single record object is reused, so its buffers are allocated once
+        Record record{ {}, {} };
+        for(size_t row = 0; row < recordCount; ++row) {
+            ar >> record;
+            append(record);
+        }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef _RESPONSE_HPP_
 #define _RESPONSE_HPP_
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "record_store.hpp"
 #include "return_code.hpp"
 
+using std::shared_ptr;
+
 /**
  * Defines core service response entity
  */
@@ -17,7 +23,57 @@ struct Response {
     Response(ReturnCode code, vector<Record> &&records = {}, string &&summary = {}): 
     code{ code }, 
     records{ std::forward<vector<Record>>(records) },
-    summary{ std::forward<string>(summary) }
+    summary{ std::forward<string>(summary) },
+    retryAfter{ 0 }
+    {}
+
+    /**
+     * Constructor of a response referring to records in place
+     *
+     * @param code Return code
+     * @param selection Records of a pinned snapshot
+     */
+    Response(ReturnCode code, shared_ptr<const RecordStore::Selection> &&selection):
+    code{ code },
+    selection{ std::move(selection) },
+    retryAfter{ 0 }
+    {}
+
+    /**
+     * Constructor of a batch response
+     *
+     * @param code Return code of the batch
+     * @param summary Text summary
+     * @param results Return codes of the batch items
+     */
+    Response(ReturnCode code, string &&summary, vector<ReturnCode> &&results):
+    code{ code },
+    summary{ std::move(summary) },
+    retryAfter{ 0 },
+    results{ std::move(results) }
+    {}
+
+    /**
+     * Constructor of a response reporting numbers
+     *
+     * @param code Return code
+     * @param counts Numbers, their meaning is defined by the Action
+     */
+    Response(ReturnCode code, vector<uint64_t> &&counts):
+    code{ code },
+    retryAfter{ 0 },
+    counts{ std::move(counts) }
+    {}
+
+    /**
+     * Constructor of a rejection response
+     *
+     * @param code Return code
+     * @param retryAfter Delay after which the request may be retried
+     */
+    Response(ReturnCode code, std::chrono::milliseconds retryAfter):
+    code{ code },
+    retryAfter{ retryAfter }
     {}
 
     /**
@@ -28,12 +84,26 @@ struct Response {
     ReturnCode getCode() const;
 
     /**
-     * Get records
+     * Get records. Records referred to in place are copied and released
      * 
      * @return Records
      */
     vector<Record>& getRecords();
 
+    /**
+     * Get records. Records referred to in place are copied and released
+     *
+     * @return Records
+     */
+    const vector<Record>& getRecords() const;
+
+    /**
+     * Get records referred to in place, they can be sent without copying
+     *
+     * @return Records of a pinned snapshot, nullptr if the records are copies
+     */
+    const shared_ptr<const RecordStore::Selection>& getSelection() const;
+
     /**
      * Get summary
      * 
@@ -41,10 +111,36 @@ struct Response {
      */
     const string& getSummary() const;
 
+    /**
+     * Get retry hint of a rejected request
+     *
+     * @return Delay after which the request may be retried, 0 if not specified
+     */
+    std::chrono::milliseconds getRetryAfter() const;
+
+    /**
+     * Get results of batch items
+     *
+     * @return Return codes in the order of items, empty if the response isn't for a batch
+     */
+    const vector<ReturnCode>& getResults() const;
+
+    /**
+     * Get numbers reported by the Action, e.g. numbers of records changed
+     *
+     * @return Numbers, empty if the Action doesn't report any
+     */
+    const vector<uint64_t>& getCounts() const;
+
     private:
     ReturnCode code;
-    vector<Record> records;
+    // Copied from the selection on first access
+    mutable vector<Record> records;
+    mutable shared_ptr<const RecordStore::Selection> selection;
     string summary;
+    std::chrono::milliseconds retryAfter;
+    vector<ReturnCode> results;
+    vector<uint64_t> counts;
 };
 
 #endif
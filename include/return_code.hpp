@@ -10,7 +10,13 @@ enum class ReturnCode {
     WRONG_PASSWORD,
     GENERIC_ERROR,
     NOT_FOUND,
-    EMPTY
+    EMPTY,
+    // Request was rejected since the service is overloaded, it may be retried later
+    OVERLOADED,
+    // Response didn't arrive before the request deadline
+    TIMEOUT,
+    // Change was based on a version which is no longer current
+    CONFLICT
 };
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef _TAG_DICTIONARY_HPP_
+#define _TAG_DICTIONARY_HPP_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "tag_set.hpp"
+
+using std::deque;
+using std::mutex;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * Process wide mapping between tag names and dense tag Ids. Tag names are stored once
+ * no matter how many records they are attached to
+ */
+class TagDictionary {
+public:
+    /**
+     * Get the dictionary instance
+     *
+     * @return Tag dictionary
+     */
+    static TagDictionary& instance();
+
+    /**
+     * Get Id of a tag, assign a new Id if the tag is not known yet
+     *
+     * @param tag Tag name
+     * @return Tag Id
+     */
+    TagId intern(const string &tag);
+
+    /**
+     * Find Id of a known tag
+     *
+     * @param tag Tag name
+     * @param id Output: tag Id
+     * @return True if the tag is known
+     */
+    bool find(const string &tag, TagId &id) const;
+
+    /**
+     * Get tag name
+     *
+     * @param id Tag Id
+     * @return Tag name
+     */
+    const string& name(TagId id) const;
+
+    /**
+     * Get names of all known tags
+     *
+     * @return Tag names ordered by tag Id
+     */
+    vector<string> names() const;
+
+private:
+    /**
+     * Constructor
+     */
+    TagDictionary() {}
+
+    mutable mutex dictionaryMutex;
+    // Tag name -> tag Id
+    unordered_map<string, TagId> ids;
+    // Tag Id -> tag name. Deque keeps references to names valid while it grows
+    deque<string> tagNames;
+};
+
+#endif
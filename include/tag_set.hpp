@@ -0,0 +1,163 @@
+#ifndef _TAG_SET_HPP_
+#define _TAG_SET_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "boost/serialization/split_free.hpp"
+
+using std::vector;
+
+// Dense tag identifier assigned by TagDictionary
+using TagId = uint32_t;
+
+/**
+ * Sorted set of tag Ids. Small sets are stored inline, without heap allocation
+ */
+class TagSet {
+public:
+    /**
+     * Constructor
+     */
+    TagSet(): count{ 0 }, capacity{ INLINE_CAPACITY } {}
+
+    /**
+     * Copy constructor
+     *
+     * @param other Tag set
+     */
+    TagSet(const TagSet &other);
+
+    /**
+     * Move constructor
+     *
+     * @param other Tag set
+     */
+    TagSet(TagSet &&other);
+
+    /**
+     * Assignment operator
+     *
+     * @param other Tag set
+     * @return Reference to the result object
+     */
+    TagSet& operator=(TagSet other);
+
+    /**
+     * Destructor
+     */
+    ~TagSet();
+
+    /**
+     * Check whether the set contains specified tag
+     *
+     * @param id Tag Id
+     * @return True if the tag is present
+     */
+    bool contains(TagId id) const;
+
+    /**
+     * Check whether the set contains all tags of another set
+     *
+     * @param other Tag set
+     * @return True if all tags of other set are present
+     */
+    bool containsAll(const TagSet &other) const;
+
+    /**
+     * Add tag to the set
+     *
+     * @param id Tag Id
+     * @return True if the tag was not present before
+     */
+    bool insert(TagId id);
+
+    /**
+     * Remove tag from the set
+     *
+     * @param id Tag Id
+     * @return True if the tag was present
+     */
+    bool erase(TagId id);
+
+    /**
+     * Get number of tags
+     *
+     * @return Number of tags
+     */
+    size_t size() const;
+
+    /**
+     * Get first tag Id
+     *
+     * @return Pointer to the first (smallest) tag Id
+     */
+    const TagId* begin() const;
+
+    /**
+     * Get position after the last tag Id
+     *
+     * @return Pointer after the last tag Id
+     */
+    const TagId* end() const;
+
+private:
+    static constexpr uint32_t INLINE_CAPACITY{ 4 };
+
+    // Number of tags
+    uint32_t count;
+    // Number of tags which fit into current storage
+    uint32_t capacity;
+
+    // Tag Ids: inline while capacity == INLINE_CAPACITY, on the heap otherwise
+    union {
+        TagId inlineIds[INLINE_CAPACITY];
+        TagId *heapIds;
+    };
+
+    /**
+     * Get tag Ids storage
+     *
+     * @return Pointer to the first tag Id
+     */
+    TagId* data();
+
+    /**
+     * Take over content of another set. Current storage should be inline
+     *
+     * @param other Tag set, left empty
+     */
+    void moveFrom(TagSet &other);
+
+    /**
+     * Ensure storage can hold specified number of tags
+     *
+     * @param size Required capacity
+     */
+    void reserve(uint32_t size);
+};
+
+namespace boost {
+namespace serialization {
+    template<class Archive>
+    void save(Archive &ar, const TagSet &tags, const unsigned int /*version*/) {
+        vector<TagId> ids(tags.begin(), tags.end());
+        ar << ids;
+    }
+
+    template<class Archive>
+    void load(Archive &ar, TagSet &tags, const unsigned int /*version*/) {
+        // Buffer is reused, so loading many records doesn't allocate for every tag set
+        static thread_local vector<TagId> ids;
+        ar >> ids;
+        tags = TagSet{};
+        for(auto id : ids) {
+            tags.insert(id);
+        }
+    }
+}
+}
+
+BOOST_SERIALIZATION_SPLIT_FREE(TagSet)
+
+#endif
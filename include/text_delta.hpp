@@ -0,0 +1,100 @@
+#ifndef _TEXT_DELTA_HPP_
+#define _TEXT_DELTA_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "boost/utility/string_ref.hpp"
+
+using boost::string_ref;
+using std::string;
+using std::vector;
+
+/**
+ * Change of a text expressed as ranges replaced in the base version. A large text
+ * is edited by sending only the changed bytes; the base version hash lets the
+ * receiver detect that the text was changed by somebody else in the meantime
+ */
+struct TextDelta {
+    /**
+     * Replacement of a base text range
+     */
+    struct Edit {
+        // Position in the base text
+        size_t offset;
+        // Number of base bytes removed
+        size_t removed;
+        // Text inserted instead
+        string inserted;
+    };
+
+    /**
+     * Constructor of a delta which changes nothing
+     */
+    TextDelta(): baseHash{ 0 } {}
+
+    /**
+     * Calculate the delta turning one text into another. Changed lines are found by
+     * a line diff, so a few edits scattered over a large text produce a few small
+     * ranges
+     *
+     * @param base Base text
+     * @param text Changed text
+     * @return Delta
+     */
+    static TextDelta diff(const string &base, const string &text);
+
+    /**
+     * Calculate the hash identifying a text version
+     *
+     * @param text Text
+     * @return 64 bit FNV-1a hash
+     */
+    static uint64_t hash(string_ref text);
+
+    /**
+     * Check whether the delta can be applied to a base text of the size
+     *
+     * @param baseSize Base text size
+     * @return True if the ranges are ordered, don't overlap and fit the base text
+     */
+    bool isValid(size_t baseSize) const;
+
+    /**
+     * Check whether the delta changes nothing
+     *
+     * @return True if there are no edits
+     */
+    bool empty() const;
+
+    /**
+     * Get size of the text the delta produces
+     *
+     * @param baseSize Base text size, the delta should be valid for it
+     * @return Result size
+     */
+    size_t resultSize(size_t baseSize) const;
+
+    /**
+     * Apply the delta. Unchanged ranges are copied straight from the base text
+     *
+     * @param base Base text, the delta should be valid for it
+     * @param out Output: resultSize() bytes
+     */
+    void apply(string_ref base, char *out) const;
+
+    // Hash of the base text version
+    uint64_t baseHash;
+
+    // Ranges in ascending order
+    vector<Edit> edits;
+
+private:
+    // Line diffs needing more edits fall back to replacing all lines between
+    // the common prefix and suffix, the search cost grows with their square
+    static constexpr size_t MAX_LINE_EDITS{ 256 };
+};
+
+#endif
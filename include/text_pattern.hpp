@@ -0,0 +1,70 @@
+#ifndef _TEXT_PATTERN_HPP_
+#define _TEXT_PATTERN_HPP_
+
+#include <cstddef>
+#include <regex>
+#include <string>
+
+#include "boost/utility/string_ref.hpp"
+
+using boost::string_ref;
+using std::string;
+
+/**
+ * Pattern of a find-and-replace: a literal string or an ECMAScript regular expression.
+ * Matching doesn't change the pattern, it may be used by many threads at once
+ */
+class TextPattern {
+public:
+    /**
+     * Constructor
+     *
+     * @param pattern Literal text or regular expression, case sensitive
+     * @param replacement Literal text, or a format with $n / $& references if the
+     *                    pattern is a regular expression
+     * @param regex Pattern is a regular expression
+     *        Throws if the pattern is empty or not a valid regular expression
+     */
+    TextPattern(const string &pattern, const string &replacement, bool regex);
+
+    /**
+     * Count non-overlapping matches
+     *
+     * @param text Text
+     * @return Number of matches
+     *         Throws if the regular expression exceeds the matcher's complexity or stack limits
+     */
+    size_t count(string_ref text) const;
+
+    /**
+     * Replace all non-overlapping matches
+     *
+     * @param text Text
+     * @param out Output: text with the matches replaced, if there were any
+     * @return Number of matches
+     *         Throws if the regular expression exceeds the matcher's complexity or stack limits
+     */
+    size_t replace(string_ref text, string &out) const;
+
+    /**
+     * Check whether the pattern is a regular expression
+     *
+     * @return True if it is a regular expression, false if it's literal text
+     */
+    bool isRegex() const;
+
+    /**
+     * Get pattern text
+     *
+     * @return Literal text or regular expression
+     */
+    const string& getPattern() const;
+
+private:
+    string pattern;
+    string replacement;
+    bool regex;
+    std::regex expression;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef _THREAD_POOL_HPP_
+#define _THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::atomic;
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::list;
+using std::mutex;
+using std::shared_ptr;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+using Task = function<void()>;
+
+/**
+ * Task priorities. Higher priority tasks are taken first, both from the own queue
+ * of a worker and when stealing
+ */
+enum class TaskPriority {
+    // Subtasks of running work (fork/join), finishing it releases resources early
+    HIGH,
+    // Client requests
+    NORMAL,
+    // Background work
+    LOW
+};
+
+/**
+ * Work-stealing thread pool. Every worker has its own task queues: tasks submitted
+ * by a worker go to its queues and are executed in LIFO order, idle workers steal
+ * the oldest tasks of others. Tasks submitted by other threads are shared by all
+ * workers. Worker count matches the number of CPU cores, so work submitted by all
+ * components shares the cores without oversubscription
+ */
+class ThreadPool {
+public:
+    /**
+     * Get the process wide pool
+     *
+     * @return Thread pool
+     */
+    static ThreadPool& instance();
+
+    /**
+     * Constructor
+     *
+     * @param workers Number of worker threads, 0 - one per CPU core
+     */
+    explicit ThreadPool(size_t workers = 0);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Destructor. Completes queued tasks and stops workers
+     */
+    ~ThreadPool();
+
+    /**
+     * Queue a task
+     *
+     * @param task Task
+     * @param priority Task priority
+     */
+    void submit(Task &&task, TaskPriority priority = TaskPriority::NORMAL);
+
+    /**
+     * Execute body for subranges of [begin, end) in parallel. The range is split in
+     * halves recursively until subranges are not larger than grain
+     *
+     * @param begin Range start
+     * @param end Range end
+     * @param grain Maximum subrange size processed by a single task
+     * @param body Subrange processing: (subrange begin, subrange end)
+     */
+    void parallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)> &body);
+
+    /**
+     * Get number of worker threads
+     *
+     * @return Number of workers
+     */
+    size_t size() const;
+
+private:
+    static constexpr size_t PRIORITIES{ 3 };
+
+    /**
+     * Task queues of a single priority each
+     */
+    struct TaskQueues {
+        mutex queuesMutex;
+        deque<Task> tasks[PRIORITIES];
+    };
+
+    // Queues of every worker
+    vector<unique_ptr<TaskQueues>> workerQueues;
+    // Tasks submitted by threads outside the pool
+    TaskQueues sharedQueues;
+    vector<thread> workers;
+    // Number of queued tasks
+    atomic<size_t> pending;
+    // Number of workers waiting for tasks
+    atomic<size_t> sleeping;
+    atomic<bool> stopping;
+    mutex sleepMutex;
+    condition_variable sleepCv;
+
+    /**
+     * Worker thread loop
+     *
+     * @param worker Worker index
+     */
+    void workerLoop(size_t worker);
+
+    /**
+     * Take the next task: own queues first, then shared ones, then steal
+     *
+     * @param worker Index of the calling worker, workers.size() for other threads
+     * @param task Output: task
+     * @return True if a task was taken
+     */
+    bool take(size_t worker, Task &task);
+
+    /**
+     * Execute a task, report exceptions
+     *
+     * @param task Task
+     */
+    static void execute(Task &task);
+
+    /**
+     * Get index of the calling worker in this pool
+     *
+     * @return Worker index, workers.size() if called by another thread
+     */
+    size_t currentWorker() const;
+};
+
+/**
+ * Set of tasks to be joined (fork/join). Tasks may run groups of their own.
+ * A waiting thread executes the tasks of its group no worker has started yet,
+ * then sleeps until the started ones complete
+ */
+class TaskGroup {
+public:
+    /**
+     * Constructor
+     *
+     * @param pool Pool executing the tasks
+     */
+    explicit TaskGroup(ThreadPool &pool = ThreadPool::instance()):
+        pool{ pool },
+        state{ std::make_shared<State>() }
+        {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * Destructor. Waits for the tasks
+     */
+    ~TaskGroup();
+
+    /**
+     * Start a task
+     *
+     * @param task Task
+     * @param priority Task priority
+     */
+    void run(Task &&task, TaskPriority priority = TaskPriority::HIGH);
+
+    /**
+     * Wait until all started tasks complete. Exception thrown by a task is rethrown
+     */
+    void wait();
+
+private:
+    /**
+     * Task of the group, executed by a worker or by the waiting thread,
+     * whichever takes it first
+     */
+    struct Entry {
+        Task task;
+        bool taken;
+        // Position in the queued tasks while it isn't taken
+        list<shared_ptr<Entry>>::iterator position;
+    };
+
+    /**
+     * Group state, shared with the pool tasks which may run after the group is gone
+     */
+    struct State {
+        mutex stateMutex;
+        // Notified when the last task completes
+        condition_variable completed;
+        // Tasks not taken yet, newest last
+        list<shared_ptr<Entry>> queued;
+        // Number of tasks which haven't completed
+        size_t active{ 0 };
+        // First exception thrown by a task
+        std::exception_ptr error;
+    };
+
+    ThreadPool &pool;
+    shared_ptr<State> state;
+
+    /**
+     * Execute a taken task, record its exception and count its completion
+     *
+     * @param state Group state
+     * @param entry Task
+     */
+    static void execute(State &state, Entry &entry);
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef _TRACING_HPP_
+#define _TRACING_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "latency_stats.hpp"
+
+using std::atomic;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+/**
+ * Tracing probes. Compiled in only if NOTES_TRACING is defined, otherwise they expand
+ * to nothing. Compiled in probes record while the tracer is enabled at runtime
+ */
+#ifdef NOTES_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Record the enclosing scope as a span
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__){ name }
+// Record a span started earlier (LatencyStats::now()) and ending now
+#define TRACE_INTERVAL(name, start) Tracer::instance().record(name, start, LatencyStats::now())
+#define TRACE_ENABLED() Tracer::instance().isEnabled()
+#else
+#define TRACE_SPAN(name)
+#define TRACE_INTERVAL(name, start)
+#define TRACE_ENABLED() false
+#endif
+
+/**
+ * Records spans into per-thread ring buffers and writes them as Chrome trace JSON
+ * (chrome://tracing, Perfetto). Every thread keeps the latest RING_SIZE spans.
+ * Enabled by NOTES_TRACE environment variable naming the file the trace is written
+ * to at exit, or by setEnabled()
+ */
+class Tracer {
+public:
+    /**
+     * Get the process wide tracer
+     *
+     * @return Tracer
+     */
+    static Tracer& instance();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     * Destructor. Writes the trace to the file given by NOTES_TRACE
+     */
+    ~Tracer();
+
+    /**
+     * Check whether recording is enabled
+     *
+     * @return True if enabled
+     */
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Enable or disable recording
+     *
+     * @param state Recording state
+     */
+    void setEnabled(bool state);
+
+    /**
+     * Record a span. Ignored if recording is disabled
+     *
+     * @param name Span name, string literal
+     * @param start Start time (LatencyStats::now())
+     * @param end End time (LatencyStats::now())
+     */
+    void record(const char *name, uint64_t start, uint64_t end);
+
+    /**
+     * Write recorded spans as Chrome trace JSON
+     *
+     * @param os Output stream
+     */
+    void dump(std::ostream &os) const;
+
+    /**
+     * Write recorded spans as Chrome trace JSON into a file
+     *
+     * @param path File path
+     */
+    void dump(const string &path) const;
+
+private:
+    // Number of spans kept by a thread, power of two
+    static constexpr size_t RING_SIZE{ 1 << 14 };
+
+    /**
+     * Recorded span. Fields are atomic since the ring may be dumped while it is written
+     */
+    struct Span {
+        atomic<const char*> name;
+        atomic<uint64_t> start;
+        atomic<uint64_t> duration;
+    };
+
+    /**
+     * Spans of a thread
+     */
+    struct Ring {
+        size_t threadIdx;
+        // Number of spans recorded by the thread
+        atomic<uint64_t> head;
+        unique_ptr<Span[]> spans;
+
+        explicit Ring(size_t threadIdx);
+    };
+
+    atomic<bool> enabled;
+    // File the trace is written to at exit, empty if none
+    string exitPath;
+    vector<unique_ptr<Ring>> rings;
+    mutable mutex ringsMutex;
+
+    /**
+     * Constructor
+     */
+    Tracer();
+
+    /**
+     * Get ring of the calling thread, register it on first use
+     *
+     * @return Ring
+     */
+    Ring& threadRing();
+};
+
+/**
+ * Records the scope as a span while the tracer is enabled
+ */
+class TraceSpan {
+public:
+    /**
+     * Constructor. Starts the span
+     *
+     * @param name Span name, string literal
+     */
+    explicit TraceSpan(const char *name):
+        name{ name },
+        start{ Tracer::instance().isEnabled() ? LatencyStats::now() : 0 }
+        {}
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    /**
+     * Destructor. Records the span
+     */
+    ~TraceSpan() {
+        if(start) {
+            Tracer::instance().record(name, start, LatencyStats::now());
+        }
+    }
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef _WIRE_PROTOCOL_HPP_
+#define _WIRE_PROTOCOL_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/utility/string_ref.hpp"
+
+#include "output_buffer.hpp"
+#include "record.hpp"
+#include "record_query.hpp"
+#include "response.hpp"
+#include "text_delta.hpp"
+
+using boost::string_ref;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+struct CoreAction;
+
+/**
+ * Type of a network message, follows the protocol version in the message header
+ */
+enum class MessageType : uint8_t {
+    ADD_RECORD = 1,
+    UPDATE_RECORD,
+    SEARCH_RECORDS,
+    SET_PASSWORD,
+    START,
+    STATS,
+    RESPONSE,
+    BATCH,
+    ADD_TAG,
+    REMOVE_TAG,
+    SET_DELETED,
+    SET_TEXT,
+    EDIT_TEXT,
+    BULK_UPDATE,
+    REPLACE_TEXT
+};
+
+/**
+ * Appends binary encoded values to a message. Integers are LEB128 varints (signed
+ * ones zigzag encoded), strings are prefixed with their length
+ */
+class WireWriter {
+public:
+    /**
+     * Constructor
+     *
+     * @param out Message the values are appended to
+     */
+    explicit WireWriter(string &out): out{ out } {}
+
+    /**
+     * Write message header: protocol version and message type
+     *
+     * @param type Message type
+     */
+    void putHeader(MessageType type);
+
+    /**
+     * Write byte
+     *
+     * @param value Value
+     */
+    void putByte(uint8_t value);
+
+    /**
+     * Write unsigned integer
+     *
+     * @param value Value
+     */
+    void putVarint(uint64_t value);
+
+    /**
+     * Write signed integer
+     *
+     * @param value Value
+     */
+    void putSignedVarint(int64_t value);
+
+    /**
+     * Write string
+     *
+     * @param value Value
+     */
+    void putString(string_ref value);
+
+    /**
+     * Write list of strings: count followed by strings
+     *
+     * @param values Values
+     */
+    void putStrings(const vector<string> &values);
+
+    /**
+     * Write date: 0 - not a date, 1 / 2 - negative / positive infinity, day number + 3
+     * otherwise
+     *
+     * @param value Date
+     */
+    void putDate(const boost::gregorian::date &value);
+
+    /**
+     * Write record with its Id, dates and tag names
+     *
+     * @param record Record
+     */
+    void putRecord(const Record &record);
+
+    /**
+     * Write record fields following its text: tag names, dates and deleted state
+     *
+     * @param record Record
+     */
+    void putRecordFields(const Record &record);
+
+    /**
+     * Write search conditions
+     *
+     * @param query Query
+     */
+    void putQuery(const RecordQuery &query);
+
+    /**
+     * Write text delta: base hash and the edits with their offsets, removed sizes
+     * and inserted text
+     *
+     * @param delta Delta
+     */
+    void putDelta(const TextDelta &delta);
+
+private:
+    string &out;
+};
+
+/**
+ * Reads binary encoded values written by WireWriter. Strings are read as references
+ * into the message, nothing is copied until a value is converted into its owning type.
+ * Throws on truncated or malformed messages
+ */
+class WireReader {
+public:
+    /**
+     * Constructor
+     *
+     * @param message Message, should stay valid while values are read
+     */
+    explicit WireReader(string_ref message): message{ message }, pos{ 0 } {}
+
+    /**
+     * Read message header
+     *
+     * @return Message type
+     *         Throws if the protocol version is not supported
+     */
+    MessageType getHeader();
+
+    /**
+     * Read byte
+     *
+     * @return Value
+     */
+    uint8_t getByte();
+
+    /**
+     * Read unsigned integer
+     *
+     * @return Value
+     */
+    uint64_t getVarint();
+
+    /**
+     * Read signed integer
+     *
+     * @return Value
+     */
+    int64_t getSignedVarint();
+
+    /**
+     * Read string
+     *
+     * @return Reference into the message
+     */
+    string_ref getString();
+
+    /**
+     * Read list of strings
+     *
+     * @return Copies of the strings
+     */
+    vector<string> getStrings();
+
+    /**
+     * Read date
+     *
+     * @return Date
+     */
+    boost::gregorian::date getDate();
+
+    /**
+     * Read record. Its tags are added to the tag dictionary
+     *
+     * @return Record
+     */
+    Record getRecord();
+
+    /**
+     * Read search conditions
+     *
+     * @return Query
+     */
+    RecordQuery getQuery();
+
+    /**
+     * Read text delta
+     *
+     * @return Delta, not validated against any text
+     */
+    TextDelta getDelta();
+
+    /**
+     * Check whether the whole message was read
+     *
+     * @return True if there is nothing left
+     */
+    bool atEnd() const;
+
+private:
+    string_ref message;
+    size_t pos;
+
+    /**
+     * Read number of list elements, every element takes at least a byte
+     *
+     * @return Count
+     */
+    size_t getCount();
+};
+
+/**
+ * Binary protocol of the network Core Service.
+ *
+ * Frame: 4 bytes little-endian payload length followed by the payload. Request payload:
+ * version, message type, Action priority and the Action fields; items of a batch are
+ * nested request messages. Response payload: version, RESPONSE type, return code,
+ * retry hint (ms), summary, return codes of batch items, counts and records
+ */
+class WireProtocol {
+public:
+    // Version written to every message, messages of other versions are rejected
+    static constexpr uint8_t VERSION{ 2 };
+    // Length prefix of a frame
+    static constexpr size_t FRAME_HEADER_SIZE{ 4 };
+
+    /**
+     * Write frame length prefix
+     *
+     * @param header FRAME_HEADER_SIZE bytes destination
+     * @param length Payload length
+     */
+    static void encodeFrameLength(char *header, uint32_t length);
+
+    /**
+     * Read frame length prefix
+     *
+     * @param header FRAME_HEADER_SIZE bytes
+     * @return Payload length
+     */
+    static uint32_t decodeFrameLength(const char *header);
+
+    /**
+     * Encode Core Action request
+     *
+     * @param action Core Action
+     * @return Message
+     *         Throws if the Action can't be sent over network
+     */
+    static string encodeAction(const CoreAction &action);
+
+    /**
+     * Decode Core Action request
+     *
+     * @param message Message
+     * @return Core Action
+     *         Throws if the message is malformed
+     */
+    static unique_ptr<CoreAction> decodeAction(string_ref message);
+
+    /**
+     * Encode Core Service response
+     *
+     * @param response Response
+     * @return Message
+     */
+    static string encodeResponse(const Response &response);
+
+    /**
+     * Encode Core Service response for sending. Text of records referred to in place
+     * is not copied: the output refers to it and keeps the text leased until
+     * it's written
+     *
+     * @param response Response
+     * @param out Output: message is appended
+     */
+    static void encodeResponse(const Response &response, OutputBuffer &out);
+
+    /**
+     * Decode Core Service response
+     *
+     * @param message Message
+     * @return Response
+     *         Throws if the message is malformed
+     */
+    static Response decodeResponse(string_ref message);
+
+private:
+    // Shorter text of records referred to in place is copied into the output,
+    // a separate write block isn't worth it
+    static constexpr size_t MIN_REFERENCED_TEXT{ 1024 };
+
+    /**
+     * Write response fields preceding the records
+     *
+     * @param writer Message writer
+     * @param response Response
+     * @param count Number of records
+     */
+    static void putResponseHeader(WireWriter &writer, const Response &response, size_t count);
+};
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * Arena implementation
+ */
+
+#include <algorithm>
+#include "arena.hpp"
+
+constexpr size_t Arena::CHUNK_SIZE;
+constexpr size_t Arena::ALIGNMENT;
+constexpr size_t Arena::SIZE_CLASSES;
+constexpr size_t Arena::MIN_CLASS_SIZE;
+constexpr size_t Arena::MAX_CLASS_SIZE;
+
+Arena::Arena():
+    cursor{ nullptr },
+    limit{ nullptr },
+    reservedBytes{ 0 },
+    usedBytes{ 0 },
+    pooledBytes{ 0 },
+    allocations{ 0 },
+    poolHits{ 0 }
+{
+    std::fill(pools, pools + SIZE_CLASSES, nullptr);
+}
+
+Arena::~Arena() {
+    for(auto chunk : chunks) {
+        delete[] chunk;
+    }
+
+    for(auto block : largeBlocks) {
+        delete[] block;
+    }
+}
+
+char* Arena::allocate(size_t size) {
+    if(size == 0) {
+        return nullptr;
+    }
+
+    size = align(size);
+    ++allocations;
+
+    if(size > MAX_CLASS_SIZE) {
+        auto block = new char[size];
+        largeBlocks.insert(block);
+        reservedBytes += size;
+        usedBytes += size;
+        return block;
+    }
+
+    // Blocks take their whole class, so a released block serves any later size of the class
+    auto sizeClass = sizeClassOf(size);
+    size = MIN_CLASS_SIZE << sizeClass;
+    usedBytes += size;
+
+    if(pools[sizeClass]) {
+        auto block = pools[sizeClass];
+        pools[sizeClass] = block->next;
+        pooledBytes -= size;
+        ++poolHits;
+        return reinterpret_cast<char*>(block);
+    }
+
+    if(cursor + size > limit) {
+        // Keep the tail of the current chunk for smaller blocks
+        releaseTail();
+
+        cursor = new char[CHUNK_SIZE];
+        limit = cursor + CHUNK_SIZE;
+        chunks.push_back(cursor);
+        reservedBytes += CHUNK_SIZE;
+    }
+
+    auto block = cursor;
+    cursor += size;
+    return block;
+}
+
+void Arena::deallocate(char *block, size_t size) {
+    if(!block) {
+        return;
+    }
+
+    size = align(size);
+    if(size > MAX_CLASS_SIZE) {
+        usedBytes -= size;
+        largeBlocks.erase(block);
+        reservedBytes -= size;
+        delete[] block;
+        return;
+    }
+
+    auto sizeClass = sizeClassOf(size);
+    usedBytes -= MIN_CLASS_SIZE << sizeClass;
+    release(block, sizeClass);
+}
+
+ArenaStats Arena::getStats() const {
+    return { chunks.size() + largeBlocks.size(), reservedBytes, usedBytes, pooledBytes,
+        allocations, poolHits };
+}
+
+size_t Arena::align(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+size_t Arena::sizeClassOf(size_t size) {
+    size_t sizeClass = 0;
+    while((MIN_CLASS_SIZE << sizeClass) < size) {
+        ++sizeClass;
+    }
+    return sizeClass;
+}
+
+void Arena::release(char *block, size_t sizeClass) {
+    auto freeBlock = reinterpret_cast<FreeBlock*>(block);
+    freeBlock->next = pools[sizeClass];
+    pools[sizeClass] = freeBlock;
+    pooledBytes += MIN_CLASS_SIZE << sizeClass;
+}
+
+void Arena::releaseTail() {
+    // Blocks are multiples of the smallest class, so the tail splits without a remainder
+    while(cursor < limit) {
+        auto sizeClass = SIZE_CLASSES - 1;
+        while((MIN_CLASS_SIZE << sizeClass) > static_cast<size_t>(limit - cursor)) {
+            --sizeClass;
+        }
+        release(cursor, sizeClass);
+        cursor += MIN_CLASS_SIZE << sizeClass;
+    }
+}
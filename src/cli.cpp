@@ -8,6 +8,7 @@
 #include <thread>
 #include "cli.hpp"
 #include "record.hpp"
+#include "tracing.hpp"
 
 #define ready std::future_status::ready 
 
@@ -87,7 +88,7 @@ ReturnCode Cli::addRecord(const CliCommand &cmd) const {
     auto text = openEditor("");
     auto tags = cmd.getArgumentList(TAG_OPT);
     unique_ptr<CoreAction> addRecordAction{ new AddRecordAction{ std::move(text), std::move(tags) } };
-    auto futureResponse = coreService->execAction(std::move(addRecordAction));
+    auto futureResponse = execAction(std::move(addRecordAction));
     auto responseStatus = futureResponse.wait_for(
         std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
 
@@ -101,9 +102,9 @@ ReturnCode Cli::addRecord(const CliCommand &cmd) const {
 
 ReturnCode Cli::addTag(Record &record) const {
     auto tag = prompt(INPUT_TAG_PROMPT);
-    record.addTag(std::move(tag));
-    unique_ptr<CoreAction> updateRecordAction{ new UpdateRecordAction{ Record{record} } };
-    auto futureResponse = coreService->execAction(std::move(updateRecordAction));
+    record.addTag(string{ tag });
+    unique_ptr<CoreAction> addTagAction{ new AddTagAction{ record.getId(), std::move(tag) } };
+    auto futureResponse = execAction(std::move(addTagAction));
     auto responseStatus = futureResponse.wait_for(
         std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
 
@@ -115,102 +116,46 @@ ReturnCode Cli::addTag(Record &record) const {
     return ReturnCode::OK;
 }
 
-RecordPredicate Cli::generateRecordPredicate(const CliCommand &cmd) const {
-    // Initialize filter to pick non-deleted records
-    RecordPredicate pred = [](const Record &rec){return !rec.isDeleted();};
-
+ReturnCode Cli::generateRecordQuery(const CliCommand &cmd, RecordQuery &query) const {
     // Search by deleted state
-    if(cmd.hasArgument(DELETED_OPT)) {
-        pred = Util::INV<Record>(pred);
-    }
+    query.deleted = cmd.hasArgument(DELETED_OPT);
 
     // Search by multiple tags
-    if(cmd.hasArgument(TAGS_OPT)) {
-        auto tags = cmd.getArgumentList(TAGS_OPT);
-        pred = Util::AND<Record>(pred, [tags] (const Record &rec) {
-            return rec.tagged(tags);
-        });
-    }
+    query.allTags = cmd.getArgumentList(TAGS_OPT);
 
     // Search by single tag (record contains at least one of specified tags)
-    if(cmd.hasArgument(TAG_OPT)) {
-        auto tags = cmd.getArgumentList(TAG_OPT);
-        pred = Util::AND<Record>(pred, [tags] (const Record &rec) {
-            for(const string &tag : tags) {
-                if(rec.tagged(tag)) return true;
-            }
-            return false;
-        });
-    }
-
-    // Search by creation date (pick older records)
-    if(cmd.hasArgument(CDATE_BEFORE_OPT)) {
-        try {
-            date recordDate(boost::gregorian::from_string(cmd.getArgument(CDATE_BEFORE_OPT)));
-            pred = Util::AND<Record>(pred, [recordDate](const Record &rec) {
-                return rec.getCreationDate() < recordDate;
-            });
-        } catch(...) {
-            message(MSG_DATE_FORMAT_ERROR);
-            return [](const Record&){return false;};
-        }
-    }
-
-    // Search by creation date (pick newer records)
-    if(cmd.hasArgument(CDATE_AFTER_OPT)) {
-        try {
-            date recordDate(boost::gregorian::from_string(cmd.getArgument(CDATE_AFTER_OPT)));
-            pred = Util::AND<Record>(pred, [recordDate](const Record &rec) {
-                return rec.getCreationDate() >= recordDate;
-            });
-        } catch(...) {
-            message(MSG_DATE_FORMAT_ERROR);
-            return [](const Record&){return false;};
-        }
-    }
-
-    // Search by modification date (pick older records)
-    if(cmd.hasArgument(MDATE_BEFORE_OPT)) {
-        try {
-            date recordDate(boost::gregorian::from_string(cmd.getArgument(MDATE_BEFORE_OPT)));
-            pred = Util::AND<Record>(pred, [recordDate](const Record &rec) {
-                return rec.getModificationDate() < recordDate;
-            });
-        } catch(...) {
-            message(MSG_DATE_FORMAT_ERROR);
-            return [](const Record&){return false;};
-        }
-    }
-
-    // Search by modification date (pick newer records)
-    if(cmd.hasArgument(MDATE_AFTER_OPT)) {
-        try {
-            date recordDate(boost::gregorian::from_string(cmd.getArgument(MDATE_AFTER_OPT)));
-            pred = Util::AND<Record>(pred, [recordDate](const Record &rec) {
-                return rec.getModificationDate() >= recordDate;
-            });
-        } catch(...) {
-            message(MSG_DATE_FORMAT_ERROR);
-            return [](const Record&){return false;};
-        }
+    query.anyTags = cmd.getArgumentList(TAG_OPT);
+
+    // Search by creation/modification date
+    try {
+        // Pick older records
+        if(cmd.hasArgument(CDATE_BEFORE_OPT))
+            query.cdateBefore = boost::gregorian::from_string(cmd.getArgument(CDATE_BEFORE_OPT));
+        // Pick newer records
+        if(cmd.hasArgument(CDATE_AFTER_OPT))
+            query.cdateAfter = boost::gregorian::from_string(cmd.getArgument(CDATE_AFTER_OPT));
+        if(cmd.hasArgument(MDATE_BEFORE_OPT))
+            query.mdateBefore = boost::gregorian::from_string(cmd.getArgument(MDATE_BEFORE_OPT));
+        if(cmd.hasArgument(MDATE_AFTER_OPT))
+            query.mdateAfter = boost::gregorian::from_string(cmd.getArgument(MDATE_AFTER_OPT));
+    } catch(...) {
+        message(MSG_DATE_FORMAT_ERROR);
+        return ReturnCode::GENERIC_ERROR;
     }
     
     // Search by text fragment
     if(cmd.hasArgument(FRAGMENT_OPT)) {
-        const auto &text = cmd.getArgument(FRAGMENT_OPT);
-        pred = Util::AND<Record>(pred, [text] (const Record &rec) {
-            return rec.containsText(text);
-        });
+        query.fragment = cmd.getArgument(FRAGMENT_OPT);
     }
 
-    return pred;
+    return ReturnCode::OK;
 }
 
 ReturnCode Cli::deleteTag(Record &record) const {
     auto tag = prompt(INPUT_TAG_PROMPT);
     record.deleteTag(tag);
-    unique_ptr<CoreAction> updateRecordAction{ new UpdateRecordAction{ Record{record} } };
-    auto futureResponse = coreService->execAction(std::move(updateRecordAction));
+    unique_ptr<CoreAction> removeTagAction{ new RemoveTagAction{ record.getId(), std::move(tag) } };
+    auto futureResponse = execAction(std::move(removeTagAction));
     auto responseStatus = futureResponse.wait_for(
         std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
 
@@ -223,6 +168,7 @@ ReturnCode Cli::deleteTag(Record &record) const {
 }
 
 ReturnCode Cli::dispatchCmd(const CliCommand &cmd) {
+    TRACE_SPAN("Cli::dispatchCmd");
     if(cmd == "") 
         return ReturnCode::OK;
     if(cmd == ADD_CMD)  
@@ -239,9 +185,11 @@ ReturnCode Cli::dispatchCmd(const CliCommand &cmd) {
 
 ReturnCode Cli::editRecord(Record &record) const {
     auto new_text = openEditor(record.getText());
+    // Only the changed lines are sent
+    auto delta = TextDelta::diff(record.getText(), new_text);
     record.setText(std::move(new_text));
-    unique_ptr<CoreAction> updateRecordAction{ new UpdateRecordAction{ Record{ record } } };
-    auto futureResponse = coreService->execAction(std::move(updateRecordAction));
+    unique_ptr<CoreAction> editTextAction{ new EditTextAction{ record.getId(), std::move(delta) } };
+    auto futureResponse = execAction(std::move(editTextAction));
     auto responseStatus = futureResponse.wait_for(
         std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
 
@@ -255,8 +203,8 @@ ReturnCode Cli::editRecord(Record &record) const {
 
 ReturnCode Cli::deleteRecord(Record &record) const {
     record.setDeleted(true);
-    unique_ptr<CoreAction> updateRecordAction{ new UpdateRecordAction{ Record{ record } } };
-    auto futureResponse = coreService->execAction(std::move(updateRecordAction));
+    unique_ptr<CoreAction> setDeletedAction{ new SetDeletedAction{ record.getId(), true } };
+    auto futureResponse = execAction(std::move(setDeletedAction));
     auto responseStatus = futureResponse.wait_for(
         std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
 
@@ -269,9 +217,14 @@ ReturnCode Cli::deleteRecord(Record &record) const {
 }
 
 ReturnCode Cli::searchRecords(const CliCommand &cmd) const {
-    auto pred = generateRecordPredicate(cmd);
-    unique_ptr<CoreAction> searchRecordsAction{ new SearchRecordsAction{ std::move(pred) } };
-    auto responseFuture = coreService->execAction(std::move(searchRecordsAction));
+    RecordQuery query;
+    auto queryCode = generateRecordQuery(cmd, query);
+    if(queryCode != ReturnCode::OK) {
+        return queryCode;
+    }
+
+    unique_ptr<CoreAction> searchRecordsAction{ new SearchRecordsAction{ std::move(query) } };
+    auto responseFuture = execAction(std::move(searchRecordsAction));
     auto status = responseFuture.wait_for(std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
 
     if(status == ready) {
@@ -355,7 +308,7 @@ string Cli::requestPassword() {
 ReturnCode Cli::start() {
     if(encryption) {
         unique_ptr<CoreAction> setPasswdAction { new SetPasswordAction{ requestPassword() } };
-        auto responseFuture = coreService->execAction(std::move(setPasswdAction));
+        auto responseFuture = execAction(std::move(setPasswdAction));
         auto responseStatus = responseFuture.wait_for(
             std::chrono::seconds(Cli::CORE_SERVICE_RESPONSE_TIMEOUT));
 
@@ -364,14 +317,15 @@ ReturnCode Cli::start() {
             return ReturnCode::GENERIC_ERROR;
         }
 
-        if(responseFuture.get().getCode() == ReturnCode::INVALID_PASSWORD) {
+        auto code = responseFuture.get().getCode();
+        if(code == ReturnCode::INVALID_PASSWORD || code == ReturnCode::WRONG_PASSWORD) {
             message(MSG_INVALID_PASSWD);
-            return ReturnCode::INVALID_PASSWORD;
+            return code;
         }
     }
 
     unique_ptr<CoreAction> startAction { new StartAction() };
-    auto futureResponse = coreService->execAction(std::move(startAction));
+    auto futureResponse = execAction(std::move(startAction));
     auto responseStatus = futureResponse.wait_for(
         std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
     if(responseStatus != ready) {
@@ -432,6 +386,13 @@ ReturnCode Cli::exitCli(const CliCommand &cmd) {
     return ReturnCode::OK;
 }
 
+future<Response> Cli::execAction(unique_ptr<CoreAction> &&action) const {
+    action->setPriority(ActionPriority::INTERACTIVE);
+    // Nobody waits for the response after the timeout, a remote service may drop it
+    action->setDeadline(std::chrono::steady_clock::now() + std::chrono::seconds(CORE_SERVICE_RESPONSE_TIMEOUT));
+    return coreService->execAction(std::move(action));
+}
+
 string Cli::openEditor(const string &text) const {
     // Remove tmp file
     std::remove(TMP_FILE_PATH.c_str());
@@ -2,20 +2,41 @@
  * Implementation of the Core class
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <unistd.h>
 #include "crypto.hpp"
 #include "core.hpp"
+#include "latency_stats.hpp"
+#include "thread_pool.hpp"
+#include "tracing.hpp"
 
 const string Core::DATA_FILE = "notes_data";
+const string Core::DATA_FORMAT_HEADER = "notes-data 2";
+
+using std::lock_guard;
 
 int Core::NEXT_RECORD_ID;
+constexpr size_t Core::QUERY_CACHE_MAX_ENTRIES;
+constexpr size_t Core::QUERY_CACHE_MAX_BYTES;
+constexpr size_t Core::REPLACE_GRAIN;
 
 ReturnCode Core::setPassword(string &&password) {
     if(password.empty()) {
         return ReturnCode::INVALID_PASSWORD;
     }
 
+    lock_guard<mutex> lock{ writerMutex };
+    // Data is already decrypted with the password in use, clients of a shared
+    // server can't replace it
+    if(initialized) {
+        return encryption && password == this->password ? ReturnCode::OK : ReturnCode::WRONG_PASSWORD;
+    }
+
     this->password = std::move(password);	
     encryption = true;
     return ReturnCode::OK;
@@ -34,86 +55,463 @@ ReturnCode Core::start() {
 }
 
 ReturnCode Core::addRecord(Record &&record) {
-    record.setId(NEXT_RECORD_ID++);
-    records.emplace_back(std::move(record));
+    Batch batch{ *this };
+    auto code = batch.addRecord(std::move(record));
 
     // TODO: define when sync should really ocur
-    return sync();
+    batch.commit();
+    return code;
 }
 
 ReturnCode Core::updateRecord(Record &&record) {
-    auto id = record.getId();
-    //auto records = search([id](const Record& r){return r.getId() == id;});
-    auto recordIter = std::find_if(records.begin(), records.end(), 
-        [id](const Record& r){return r.getId() == id;});
-
-    if(recordIter != records.end()) {
-        std::swap(*recordIter, record);
-        sync();
-        return ReturnCode::OK;
-    }
-    
-    return ReturnCode::NOT_FOUND;
+    Batch batch{ *this };
+    auto code = batch.updateRecord(std::move(record));
+    batch.commit();
+    return code;
 }
 
 ReturnCode Core::removeRecord(int id) {
-    records.erase(
-        std::remove_if(
-            records.begin(), records.end(), [id](const Record &r){return r.getId() == id;}),
-        records.end());
+    Batch batch{ *this };
+    auto code = batch.removeRecord(id);
+    batch.commit();
+    return code;
+}
+
+Core::Batch::Batch(Core &core):
+    core{ core },
+    writerLock{ core.writerMutex },
+    modified{ false },
+    firstRecordId{ NEXT_RECORD_ID }
+{}
 
-    return sync();
+Core::Batch::~Batch() {
+    if(modified) {
+        core.records.publish();
+    }
 }
 
-ReturnCode Core::sync() {
-    std::ofstream ofs(DATA_FILE);
-    if(!ofs.is_open()) throw string{ "I/O ERROR" };
+ReturnCode Core::Batch::addRecord(Record &&record) {
+    record.setId(NEXT_RECORD_ID++);
+    core.records.append(record);
+    modified = true;
+    return ReturnCode::OK;
+}
 
-    if(encryption) {
-        std::stringstream textStream;
-        boost::archive::text_oarchive oa(textStream);
-        oa << records;
-        Crypto crt(password);
-        string encryptedData = crt.encryptString(textStream.str());
-        ofs << encryptedData;
-    } else {
-        boost::archive::text_oarchive oa(ofs); 
-        oa << records;
+ReturnCode Core::Batch::updateRecord(Record &&record) {
+    size_t row;
+    if(!core.records.find(record.getId(), row)) {
+        return ReturnCode::NOT_FOUND;
+    }
+
+    core.records.update(row, record);
+    modified = true;
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::removeRecord(int id) {
+    size_t row;
+    if(core.records.find(id, row)) {
+        core.records.erase(row);
+        modified = true;
+    }
+
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::addTag(int id, const string &tag) {
+    size_t row;
+    if(!core.records.find(id, row)) {
+        return ReturnCode::NOT_FOUND;
+    }
+
+    if(core.records.addTag(row, TagDictionary::instance().intern(tag))) {
+        core.records.setModificationDate(row, boost::gregorian::day_clock::local_day());
+        modified = true;
+    }
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::removeTag(int id, const string &tag) {
+    size_t row;
+    if(!core.records.find(id, row)) {
+        return ReturnCode::NOT_FOUND;
+    }
+
+    // Tag which was never interned isn't set on any record
+    TagId tagId;
+    if(TagDictionary::instance().find(tag, tagId) && core.records.removeTag(row, tagId)) {
+        core.records.setModificationDate(row, boost::gregorian::day_clock::local_day());
+        modified = true;
+    }
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::setDeleted(int id, bool state) {
+    size_t row;
+    if(!core.records.find(id, row)) {
+        return ReturnCode::NOT_FOUND;
+    }
+
+    if(core.records.setDeleted(row, state)) {
+        modified = true;
+    }
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::setText(int id, const string &text) {
+    size_t row;
+    if(!core.records.find(id, row)) {
+        return ReturnCode::NOT_FOUND;
+    }
+
+    if(core.records.setText(row, text)) {
+        core.records.setModificationDate(row, boost::gregorian::day_clock::local_day());
+        modified = true;
+    }
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::editText(int id, const TextDelta &delta) {
+    size_t row;
+    if(!core.records.find(id, row)) {
+        return ReturnCode::NOT_FOUND;
+    }
+
+    auto text = core.records.getText(row);
+    if(TextDelta::hash(text) != delta.baseHash) {
+        return ReturnCode::CONFLICT;
+    }
+    if(!delta.isValid(text.size())) {
+        return ReturnCode::GENERIC_ERROR;
     }
 
+    if(!delta.empty()) {
+        core.records.editText(row, delta);
+        core.records.setModificationDate(row, boost::gregorian::day_clock::local_day());
+        modified = true;
+    }
     return ReturnCode::OK;
 }
 
+ReturnCode Core::Batch::addTag(const RecordQuery &query, const string &tag, size_t &matched, size_t &changed) {
+    TRACE_SPAN("Core::Batch bulk update");
+    auto rows = core.records.select(QueryMatcher{ query });
+    matched = rows.size();
+    changed = core.records.addTag(rows, TagDictionary::instance().intern(tag),
+        boost::gregorian::day_clock::local_day());
+    modified = modified || changed;
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::removeTag(const RecordQuery &query, const string &tag, size_t &matched, size_t &changed) {
+    TRACE_SPAN("Core::Batch bulk update");
+    auto rows = core.records.select(QueryMatcher{ query });
+    matched = rows.size();
+    changed = 0;
+    TagId tagId;
+    if(TagDictionary::instance().find(tag, tagId)) {
+        changed = core.records.removeTag(rows, tagId, boost::gregorian::day_clock::local_day());
+    }
+    modified = modified || changed;
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::setDeleted(const RecordQuery &query, bool state, size_t &matched, size_t &changed) {
+    TRACE_SPAN("Core::Batch bulk update");
+    auto rows = core.records.select(QueryMatcher{ query });
+    matched = rows.size();
+    changed = core.records.setDeleted(rows, state);
+    modified = modified || changed;
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::replaceText(const RecordQuery &query, const TextPattern &pattern, bool dryRun,
+    size_t &matched, size_t &changed, size_t &replaced) {
+    TRACE_SPAN("Core::Batch replace text");
+    auto rows = core.records.select(QueryMatcher{ query });
+    matched = rows.size();
+
+    // Literal text can't match records without the fragment: the scan narrows the rows
+    if(!pattern.isRegex() && query.fragment.empty() && !rows.empty()) {
+        auto narrowed = query;
+        narrowed.fragment = pattern.getPattern();
+        rows = core.records.select(QueryMatcher{ narrowed });
+    }
+
+    vector<size_t> counts(rows.size());
+    vector<string> texts(dryRun ? 0 : rows.size());
+    ThreadPool::instance().parallelFor(0, rows.size(), REPLACE_GRAIN, [&](size_t begin, size_t end) {
+        for(auto idx = begin; idx < end; ++idx) {
+            auto text = core.records.getText(rows[idx]);
+            counts[idx] = dryRun ? pattern.count(text) : pattern.replace(text, texts[idx]);
+        }
+    });
+
+    vector<size_t> changedRows;
+    vector<string> changedTexts;
+    replaced = 0;
+    for(size_t idx = 0; idx < rows.size(); ++idx) {
+        if(!counts[idx]) continue;
+        replaced += counts[idx];
+        changedRows.push_back(rows[idx]);
+        if(!dryRun) changedTexts.push_back(std::move(texts[idx]));
+    }
+    changed = changedRows.size();
+
+    if(!dryRun && changed) {
+        core.records.setText(changedRows, changedTexts, boost::gregorian::day_clock::local_day());
+        modified = true;
+    }
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::Batch::commit() {
+    if(!modified) {
+        return ReturnCode::OK;
+    }
+
+    core.records.publish();
+    modified = false;
+    firstRecordId = NEXT_RECORD_ID;
+    return core.save();
+}
+
+void Core::Batch::rollback() {
+    core.records.discard();
+    modified = false;
+    NEXT_RECORD_ID = firstRecordId;
+}
+
+ReturnCode Core::sync() {
+    lock_guard<mutex> lock{ writerMutex };
+    return save();
+}
+
 vector<Record> Core::search(const RecordPredicate &pred) {
+    TRACE_SPAN("Core::search");
+    auto snapshot = records.read();
     vector<Record> recordsFound;
-    for(auto &record : records) {
-        if(pred(record)) recordsFound.push_back(record);
+    for(size_t row = 0; row < snapshot->size(); ++row) {
+        auto record = snapshot->get(row);
+        if(pred(record)) recordsFound.push_back(std::move(record));
     }
 
     return recordsFound;
 }
 
+vector<Record> Core::search(const RecordQuery &query) {
+    return select(query)->getRecords();
+}
+
+shared_ptr<RecordStore::Selection> Core::select(const RecordQuery &query) {
+    TRACE_SPAN("Core::search");
+    // Snapshot stays unchanged while it is pinned, writers don't wait for the search
+    auto snapshot = records.read();
+    auto key = query.key();
+    vector<int> ids;
+    vector<size_t> rows;
+
+    if(queryCache.lookup(key, snapshot->getGeneration(), ids)) {
+        rows.resize(ids.size());
+        for(size_t idx = 0; idx < ids.size(); ++idx) {
+            snapshot->find(ids[idx], rows[idx]);
+        }
+    } else {
+        rows = snapshot->select(QueryMatcher{ query });
+        ids.reserve(rows.size());
+        for(auto row : rows) {
+            ids.push_back(snapshot->getId(row));
+        }
+        queryCache.store(key, snapshot->getGeneration(), ids);
+    }
+
+    return std::make_shared<RecordStore::Selection>(std::move(snapshot), std::move(rows));
+}
+
+QueryCacheStats Core::getQueryCacheStats() const {
+    return queryCache.getStats();
+}
+
+ArenaStats Core::getArenaStats() const {
+    lock_guard<mutex> lock{ writerMutex };
+    return records.getArenaStats();
+}
+
 ReturnCode Core::init() {
+    lock_guard<mutex> lock{ writerMutex };
+    // Loading appends to the records, the data file is read only once
+    if(initialized) return ReturnCode::OK;
+
     std::ifstream ifs(DATA_FILE);
 
-    if(!ifs.is_open()) return ReturnCode::EMPTY;
+    if(!ifs.is_open()) {
+        initialized = true;
+        return ReturnCode::EMPTY;
+    }
     
-    if(encryption) {
-        std::stringstream encrypted_data;
-        encrypted_data << ifs.rdbuf();
+    try {
+        if(encryption) {
+            std::stringstream encrypted_data;
+            encrypted_data << ifs.rdbuf();
 	
-        Crypto crt(password);
-        std::stringstream decrypted_data(crt.decryptString(encrypted_data.str()));
-        boost::archive::text_iarchive ia(decrypted_data);
-        ia >> records;
+            Crypto crt(password);
+            std::stringstream decrypted_data(crt.decryptString(encrypted_data.str()));
+            readData(decrypted_data);
+        } else {
+            readData(ifs);
+        }
+    } catch(...) {
+        // Drop records loaded before the failure, so init may be retried
+        records.discard();
+        throw;
+    }
+
+    for(size_t row = 0; row < records.size(); ++row) {
+        records.setId(row, NEXT_RECORD_ID++);
+    }
+    records.publish();
+    initialized = true;
+
+    return ReturnCode::OK;
+}
+
+ReturnCode Core::save() {
+    std::stringstream textStream;
+    {
+        LatencyTimer timer{ "Core::sync", LatencyMetric::SERIALIZE };
+        TRACE_SPAN("Core::sync serialize");
+        writeData(textStream);
+    }
+
+    if(encryption) {
+        string encryptedData;
+        {
+            LatencyTimer timer{ "Core::sync", LatencyMetric::ENCRYPT };
+            TRACE_SPAN("Core::sync encrypt");
+            Crypto crt(password);
+            encryptedData = crt.encryptString(textStream.str());
+        }
+        writeFile(encryptedData);
     } else {
-        boost::archive::text_iarchive ia(ifs);
+        writeFile(textStream.str());
+    }
+
+    return ReturnCode::OK;
+}
+
+void Core::writeFile(const string &data) {
+    // Write size of a single io_uring operation
+    constexpr size_t MAX_WRITE_SIZE{ 1 << 30 };
+    constexpr uint64_t WRITE_TAG{ 1 };
+    constexpr uint64_t FSYNC_TAG{ 2 };
+
+    int fd = open(DATA_FILE.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0) throw string{ "I/O ERROR" };
+
+    try {
+        if(!ring && IoUring::isEnabled()) {
+            ring.reset(new IoUring{ 2 });
+        }
+
+        size_t written{ 0 };
+        bool synced{ false };
+        while(ring && !synced) {
+            // Fsync is linked to the write: it starts only once the write completed in full,
+            // otherwise it is canceled and the rest is written by the next iteration
+            auto size = std::min(data.size() - written, MAX_WRITE_SIZE);
+            ring->prepareWrite(fd, data.data() + written, size, written, WRITE_TAG, true);
+            ring->prepareFsync(fd, FSYNC_TAG);
+
+            int writeResult{ 0 }, fsyncResult{ 0 };
+            bool writeDone{ false }, fsyncDone{ false };
+            auto handler = [&](const io_uring_cqe &cqe) {
+                if(cqe.user_data == WRITE_TAG) {
+                    writeResult = cqe.res;
+                    writeDone = true;
+                } else {
+                    fsyncResult = cqe.res;
+                    fsyncDone = true;
+                }
+            };
+            {
+                LatencyTimer timer{ "Core::sync", LatencyMetric::WRITE };
+                TRACE_SPAN("Core::sync write");
+                ring->submit(1);
+                while(ring->complete(handler), !writeDone) {
+                    ring->submit(1);
+                }
+            }
+            {
+                LatencyTimer timer{ "Core::sync", LatencyMetric::FSYNC };
+                TRACE_SPAN("Core::sync fsync");
+                while(ring->complete(handler), !fsyncDone) {
+                    ring->submit(1);
+                }
+            }
+
+            if(writeResult < 0) throw string{ "I/O ERROR" };
+            if(fsyncResult < 0 && fsyncResult != -ECANCELED) throw string{ "I/O ERROR" };
+            written += writeResult;
+            synced = written == data.size() && fsyncResult == 0;
+        }
+
+        if(!ring) {
+            {
+                LatencyTimer timer{ "Core::sync", LatencyMetric::WRITE };
+                TRACE_SPAN("Core::sync write");
+                size_t written{ 0 };
+                while(written < data.size()) {
+                    auto count = write(fd, data.data() + written, data.size() - written);
+                    if(count < 0 && errno == EINTR) continue;
+                    if(count < 0) throw string{ "I/O ERROR" };
+                    written += count;
+                }
+            }
+            LatencyTimer timer{ "Core::sync", LatencyMetric::FSYNC };
+            TRACE_SPAN("Core::sync fsync");
+            if(fsync(fd) < 0) throw string{ "I/O ERROR" };
+        }
+    } catch(...) {
+        close(fd);
+        throw;
+    }
+
+    if(close(fd) < 0) throw string{ "I/O ERROR" };
+}
+
+void Core::writeData(std::ostream &os) {
+    os << DATA_FORMAT_HEADER << '\n';
+    boost::archive::text_oarchive oa(os);
+    const auto tagNames = TagDictionary::instance().names();
+    oa << tagNames;
+    oa << records;
+}
+
+void Core::readData(std::istream &is) {
+    string header;
+    std::getline(is, header);
+
+    if(header != DATA_FORMAT_HEADER) {
+        // Data saved before tags were stored in a dictionary
+        is.clear();
+        is.seekg(0);
+        boost::archive::text_iarchive ia(is);
         ia >> records;
+        return;
     }
 
-    for(auto &record : records) {
-        record.setId(NEXT_RECORD_ID++);
+    boost::archive::text_iarchive ia(is);
+    vector<string> tagNames;
+    ia >> tagNames;
+    auto firstRow = records.size();
+    ia >> records;
+
+    // Saved tag Ids refer to the saved dictionary, translate them into actual Ids
+    vector<TagId> mapping;
+    mapping.reserve(tagNames.size());
+    for(const auto &tag : tagNames) {
+        mapping.push_back(TagDictionary::instance().intern(tag));
     }
 
-    return ReturnCode::OK;
+    records.remapTags(mapping, firstRow);
 }
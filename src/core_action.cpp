@@ -1,6 +1,69 @@
 #include "core_action.hpp"
 #include "return_code.hpp"
 
+constexpr size_t SearchRecordsAction::MIN_PINNED_TEXT;
+
+void CoreAction::exec() {
+    respond(run());
+}
+
+Response CoreAction::apply(Core::Batch &) {
+    throw string{ "Action can't be batched" };
+}
+
+void CoreAction::respond(Response &&response) {
+    if(responseHandler) {
+        responseHandler(std::move(response));
+    } else {
+        responsePromise.set_value(std::move(response));
+    }
+}
+
+void CoreAction::setResponseHandler(function<void(Response&&)> &&handler) {
+    responseHandler = std::move(handler);
+}
+
+void CoreAction::encode(WireWriter &) const {
+    throw string{ "Action can't be sent over network" };
+}
+
+void CoreAction::encodeHeader(WireWriter &writer, MessageType type) const {
+    writer.putHeader(type);
+    writer.putByte(static_cast<uint8_t>(priority));
+}
+
+bool CoreAction::isReadOnly() const {
+    return false;
+}
+
+bool CoreAction::isBatchable() const {
+    return false;
+}
+
+const char* CoreAction::getName() const {
+    return "CoreAction";
+}
+
+ActionTimestamps& CoreAction::getTimestamps() {
+    return timestamps;
+}
+
+ActionPriority CoreAction::getPriority() const {
+    return priority;
+}
+
+void CoreAction::setPriority(ActionPriority priority) {
+    this->priority = priority;
+}
+
+std::chrono::steady_clock::time_point CoreAction::getDeadline() const {
+    return deadline;
+}
+
+void CoreAction::setDeadline(std::chrono::steady_clock::time_point deadline) {
+    this->deadline = deadline;
+}
+
 void CoreAction::setCore(const shared_ptr<Core> &core) {
     this->core = core;
 }
@@ -9,52 +72,356 @@ future<Response> CoreAction::getFuture() {
     return responsePromise.get_future();
 }
 
-void AddRecordAction::exec() {
-    auto code = core->addRecord({ std::move(text), std::move(tags) });
-    responsePromise.set_value({ code });
+const char* AddRecordAction::getName() const {
+    return "AddRecord";
+}
+
+void AddRecordAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::ADD_RECORD);
+    writer.putString(text);
+    writer.putStrings(tags);
+}
+
+Response AddRecordAction::run() {
+    return { core->addRecord({ std::move(text), std::move(tags) }) };
+}
+
+Response AddRecordAction::apply(Core::Batch &batch) {
+    return { batch.addRecord({ std::move(text), std::move(tags) }) };
+}
+
+bool AddRecordAction::isBatchable() const {
+    return true;
 }
 
 void AddRecordAction::undo() {
     throw string{ "Undo not implemented for AddRecord" };
 }
 
-void UpdateRecordAction::exec() {
-    auto code = core->updateRecord(std::move(record));
-    responsePromise.set_value({ code });
+const char* UpdateRecordAction::getName() const {
+    return "UpdateRecord";
+}
+
+void UpdateRecordAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::UPDATE_RECORD);
+    writer.putRecord(record);
+}
+
+Response UpdateRecordAction::run() {
+    return { core->updateRecord(std::move(record)) };
+}
+
+Response UpdateRecordAction::apply(Core::Batch &batch) {
+    return { batch.updateRecord(std::move(record)) };
+}
+
+bool UpdateRecordAction::isBatchable() const {
+    return true;
 }
 
 void UpdateRecordAction::undo() {
     throw string{ "Undo not implemented for Update Record" };
 }
 
-void SearchRecordsAction::exec() {
-    auto records = core->search(pred);
+Response PatchRecordAction::run() {
+    Core::Batch batch{ *core };
+    auto response = apply(batch);
+    batch.commit();
+    return response;
+}
 
-    if(!records.empty()) {
-        responsePromise.set_value({ ReturnCode::OK, std::move(records) });
-    } else {
-        responsePromise.set_value({ ReturnCode::NOT_FOUND });
+bool PatchRecordAction::isBatchable() const {
+    return true;
+}
+
+void PatchRecordAction::undo() {
+    throw string{ "Undo not implemented for record patch" };
+}
+
+const char* AddTagAction::getName() const {
+    return "AddTag";
+}
+
+void AddTagAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::ADD_TAG);
+    writer.putSignedVarint(recordId);
+    writer.putString(tag);
+}
+
+Response AddTagAction::apply(Core::Batch &batch) {
+    return { batch.addTag(recordId, tag) };
+}
+
+const char* RemoveTagAction::getName() const {
+    return "RemoveTag";
+}
+
+void RemoveTagAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::REMOVE_TAG);
+    writer.putSignedVarint(recordId);
+    writer.putString(tag);
+}
+
+Response RemoveTagAction::apply(Core::Batch &batch) {
+    return { batch.removeTag(recordId, tag) };
+}
+
+const char* SetDeletedAction::getName() const {
+    return "SetDeleted";
+}
+
+void SetDeletedAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::SET_DELETED);
+    writer.putSignedVarint(recordId);
+    writer.putByte(state);
+}
+
+Response SetDeletedAction::apply(Core::Batch &batch) {
+    return { batch.setDeleted(recordId, state) };
+}
+
+const char* SetTextAction::getName() const {
+    return "SetText";
+}
+
+void SetTextAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::SET_TEXT);
+    writer.putSignedVarint(recordId);
+    writer.putString(text);
+}
+
+Response SetTextAction::apply(Core::Batch &batch) {
+    return { batch.setText(recordId, text) };
+}
+
+const char* EditTextAction::getName() const {
+    return "EditText";
+}
+
+void EditTextAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::EDIT_TEXT);
+    writer.putSignedVarint(recordId);
+    writer.putDelta(delta);
+}
+
+Response EditTextAction::apply(Core::Batch &batch) {
+    return { batch.editText(recordId, delta) };
+}
+
+const char* BulkUpdateAction::getName() const {
+    return "BulkUpdate";
+}
+
+void BulkUpdateAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::BULK_UPDATE);
+    writer.putQuery(query);
+    writer.putByte(static_cast<uint8_t>(operation));
+    writer.putString(tag);
+}
+
+Response BulkUpdateAction::run() {
+    Core::Batch batch{ *core };
+    auto response = apply(batch);
+    batch.commit();
+    return response;
+}
+
+Response BulkUpdateAction::apply(Core::Batch &batch) {
+    size_t matched{ 0 }, changed{ 0 };
+    ReturnCode code;
+    switch(operation) {
+    case BulkOperation::ADD_TAG:
+        code = batch.addTag(query, tag, matched, changed);
+        break;
+    case BulkOperation::REMOVE_TAG:
+        code = batch.removeTag(query, tag, matched, changed);
+        break;
+    default:
+        code = batch.setDeleted(query, operation == BulkOperation::DELETE, matched, changed);
+        break;
+    }
+    return { code, vector<uint64_t>{ matched, changed } };
+}
+
+bool BulkUpdateAction::isBatchable() const {
+    return true;
+}
+
+void BulkUpdateAction::undo() {
+    throw string{ "Undo not implemented for Bulk Update action" };
+}
+
+const char* ReplaceTextAction::getName() const {
+    return "ReplaceText";
+}
+
+void ReplaceTextAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::REPLACE_TEXT);
+    writer.putQuery(query);
+    writer.putString(pattern);
+    writer.putString(replacement);
+    writer.putByte(regex);
+    writer.putByte(dryRun);
+}
+
+Response ReplaceTextAction::run() {
+    Core::Batch batch{ *core };
+    auto response = apply(batch);
+    batch.commit();
+    return response;
+}
+
+Response ReplaceTextAction::apply(Core::Batch &batch) {
+    // Invalid patterns and patterns failing on the matched texts are reported to the client,
+    // matching fails before any text is changed
+    size_t matched{ 0 }, changed{ 0 }, replaced{ 0 };
+    try {
+        TextPattern textPattern{ pattern, replacement, regex };
+        auto code = batch.replaceText(query, textPattern, dryRun, matched, changed, replaced);
+        return { code, vector<uint64_t>{ matched, changed, replaced } };
+    } catch(const string &ex) {
+        return { ReturnCode::GENERIC_ERROR, {}, string{ ex } };
     }
 }
 
+bool ReplaceTextAction::isBatchable() const {
+    return true;
+}
+
+void ReplaceTextAction::undo() {
+    throw string{ "Undo not implemented for Replace Text action" };
+}
+
+const char* SearchRecordsAction::getName() const {
+    return "SearchRecords";
+}
+
+void SearchRecordsAction::encode(WireWriter &writer) const {
+    if(pred) throw string{ "Predicate search can't be sent over network" };
+
+    encodeHeader(writer, MessageType::SEARCH_RECORDS);
+    writer.putQuery(query);
+}
+
+Response SearchRecordsAction::run() {
+    if(pred) {
+        auto records = core->search(pred);
+        if(records.empty()) return { ReturnCode::NOT_FOUND };
+        return { ReturnCode::OK, std::move(records) };
+    }
+
+    auto selection = core->select(query);
+    if(selection->getRows().empty()) {
+        return { ReturnCode::NOT_FOUND };
+    }
+    // Large results are handed over in place, so they are sent without copying
+    if(selection->getTextSize() >= MIN_PINNED_TEXT) {
+        return { ReturnCode::OK, std::move(selection) };
+    }
+    return { ReturnCode::OK, selection->getRecords() };
+}
+
 void SearchRecordsAction::undo() {
     // Does nothing
 }
 
-void SetPasswordAction::exec() {
-    auto code = core->setPassword(std::move(password));
-    responsePromise.set_value({ code });
+bool SearchRecordsAction::isReadOnly() const {
+    return true;
+}
+
+const char* SetPasswordAction::getName() const {
+    return "SetPassword";
+}
+
+void SetPasswordAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::SET_PASSWORD);
+    writer.putString(password);
+}
+
+Response SetPasswordAction::run() {
+    return { core->setPassword(std::move(password)) };
 }
 
 void SetPasswordAction::undo() {
     throw string{ "Undo not implemented for Set Password action" };
 }
 
-void StartAction::exec() {
-    auto code = core->start();
-    responsePromise.set_value({ code });
+const char* StartAction::getName() const {
+    return "Start";
+}
+
+void StartAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::START);
+}
+
+Response StartAction::run() {
+    return { core->start() };
 }
 
 void StartAction::undo() {
     throw string{ "Undo not implemented for Start action" };
 }
+
+Response StatsAction::run() {
+    return { ReturnCode::OK, {}, LatencyStats::instance().report() };
+}
+
+const char* StatsAction::getName() const {
+    return "Stats";
+}
+
+void StatsAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::STATS);
+}
+
+bool StatsAction::isReadOnly() const {
+    return true;
+}
+
+void StatsAction::undo() {
+    // Does nothing
+}
+
+const char* BatchAction::getName() const {
+    return "Batch";
+}
+
+void BatchAction::encode(WireWriter &writer) const {
+    encodeHeader(writer, MessageType::BATCH);
+    writer.putByte(atomic);
+    writer.putVarint(actions.size());
+    for(const auto &action : actions) {
+        writer.putString(WireProtocol::encodeAction(*action));
+    }
+}
+
+Response BatchAction::run() {
+    Core::Batch batch{ *core };
+    vector<ReturnCode> results;
+    results.reserve(actions.size());
+    for(auto &action : actions) {
+        ReturnCode code;
+        try {
+            code = action->isBatchable() ? action->apply(batch).getCode() : ReturnCode::GENERIC_ERROR;
+        } catch(...) {
+            // Otherwise the items applied so far would be published by the batch
+            if(atomic) batch.rollback();
+            throw;
+        }
+
+        results.push_back(code);
+        if(atomic && code != ReturnCode::OK) {
+            batch.rollback();
+            auto item = std::to_string(results.size() - 1);
+            results.resize(actions.size(), ReturnCode::GENERIC_ERROR);
+            return { code, "Batch is rolled back at item " + item, std::move(results) };
+        }
+    }
+
+    batch.commit();
+    return { ReturnCode::OK, {}, std::move(results) };
+}
+
+void BatchAction::undo() {
+    throw string{ "Undo not implemented for Batch action" };
+}
@@ -1,10 +1,18 @@
 #include "../include/core_service.hpp"
 
+#include <cerrno>
+#include <climits>
 #include <condition_variable>
+#include <cstring>
 #include <memory>
 #include <mutex>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
@@ -15,40 +23,237 @@ using std::thread;
 using std::unique_lock;
 using std::unique_ptr;
 
+constexpr size_t LocalCoreService::PRIORITY_CLASSES;
+constexpr size_t LocalCoreService::PRIORITY_WEIGHTS[];
+constexpr size_t LocalCoreService::DISPATCHER_SPINS;
+constexpr size_t LocalCoreService::DISPATCHER_YIELDS;
+constexpr size_t LocalCoreService::MAX_BATCH_SIZE;
 constexpr int NetworkCoreService::SOCKET_OPTION;
+constexpr int NetworkCoreService::DEFAULT_PORT;
+constexpr uint64_t RemoteCoreService::WAKE_ID;
+constexpr int RemoteCoreService::MAX_EVENTS;
+constexpr size_t RemoteCoreService::READ_BUFFER_SIZE;
 
 future<Response> LocalCoreService::execAction(unique_ptr<CoreAction> &&action) {
+    TRACE_SPAN("LocalCoreService::execAction");
     future<Response> fut = action->getFuture();
     action->setCore(core);
-    unique_lock<mutex> actionsLock(actionsMutex);
-    actions.push(std::move(action));
-    actionsLock.unlock();
-    actionsCv.notify_one();
+    if(timestampsEnabled()) {
+        action->getTimestamps().enqueued = LatencyStats::now();
+    }
+
+    // The push is counted, stop() drains the queues only after pushes passing the check end
+    pushingActions.fetch_add(1);
+    if(stopService.load()) {
+        pushingActions.fetch_sub(1);
+        action->respond({ ReturnCode::GENERIC_ERROR });
+        return fut;
+    }
+    auto pushed = queueOf(action->getPriority()).tryPush(action);
+    pushingActions.fetch_sub(1);
+    if(!pushed) {
+        reject(*action);
+        return fut;
+    }
+    wakeDispatcher();
     return fut;
 }
 
+ServiceStats LocalCoreService::getStats() const {
+    ServiceStats stats{};
+    for(const auto &queue : actions) {
+        stats.queueDepths.push_back(queue->size());
+    }
+    stats.readActions = activeReadActions.load();
+    stats.rejectedActions = rejectedActions.load();
+    return stats;
+}
+
+void LocalCoreService::reject(CoreAction &action) {
+    rejectedActions.fetch_add(1);
+    action.respond({ ReturnCode::OVERLOADED, limits.retryAfter });
+}
+
 void LocalCoreService::execActionLoop() {
+    unique_ptr<CoreAction> action;
+    while(action || nextAction(action)) {
+        if(action->isReadOnly()) {
+            if(activeReadActions.load() >= limits.maxReadActions) {
+                reject(*action);
+                action.reset();
+                continue;
+            }
+
+            activeReadActions.fetch_add(1);
+            shared_ptr<CoreAction> readAction{ std::move(action) };
+            auto taskPriority = readAction->getPriority() == ActionPriority::INTERACTIVE ? TaskPriority::HIGH :
+                readAction->getPriority() == ActionPriority::BULK ? TaskPriority::LOW : TaskPriority::NORMAL;
+            readActions.run([this, readAction]{
+                runAction(*readAction);
+                activeReadActions.fetch_sub(1);
+            }, taskPriority);
+        } else if(action->isBatchable()) {
+            runBatch(action);
+        } else {
+            runAction(*action);
+            action.reset();
+        }
+    }
+}
+
+void LocalCoreService::runBatch(unique_ptr<CoreAction> &action) {
+    // Batchable Actions of the class dispatched next join the batch. They are taken
+    // by the weighted round robin, so a batch doesn't use dispatches of other classes
+    auto priority = action->getPriority();
+    vector<unique_ptr<CoreAction>> batch;
+    batch.push_back(std::move(action));
+    while(batch.size() < MAX_BATCH_SIZE && takeAction(action)) {
+        if(!action->isBatchable() || action->getPriority() != priority) break;
+        batch.push_back(std::move(action));
+    }
+
+    auto started = timestampsEnabled() ? LatencyStats::now() : 0;
+    vector<Response> responses;
+    responses.reserve(batch.size());
+    try {
+        TRACE_SPAN("Core::Batch");
+        Core::Batch coreBatch{ *core };
+        for(auto &batchAction : batch) {
+            responses.push_back(batchAction->apply(coreBatch));
+        }
+        coreBatch.commit();
+    } catch(const string& ex) {
+        std::cerr << ex << std::endl;
+        responses.assign(batch.size(), { ReturnCode::GENERIC_ERROR });
+    } catch(...) {
+        std::cerr << "Unexpected exception in Exec Action Loop" << std::endl;
+        responses.assign(batch.size(), { ReturnCode::GENERIC_ERROR });
+    }
+
+    for(size_t idx = 0; idx < batch.size(); ++idx) {
+        batch[idx]->respond(std::move(responses[idx]));
+    }
+
+    if(started) {
+        auto finished = LatencyStats::now();
+        for(auto &batchAction : batch) {
+            batchAction->getTimestamps().started = started;
+            batchAction->getTimestamps().finished = finished;
+            recordLatency(*batchAction);
+        }
+    }
+}
+
+bool LocalCoreService::nextAction(unique_ptr<CoreAction> &action) {
     while(!stopService.load()) {
-        unique_lock<mutex> actionsLock(actionsMutex);
-        if(actions.empty()) {
-            actionsCv.wait(actionsLock);
+        for(size_t spin = 0; spin < DISPATCHER_SPINS; ++spin) {
+            if(takeAction(action)) return true;
         }
 
-        if(!actions.empty()) {
-            auto action{ std::move(actions.front()) };
-            actions.pop();
-            actionsLock.unlock();
-            try {
-                action->exec();
-            } catch(const string& ex) {
-                std::cerr << ex << std::endl;
-            } catch(...) {
-                std::cerr << "Unexpected exception in Exec Action Loop" << std::endl;
+        for(size_t yield = 0; yield < DISPATCHER_YIELDS; ++yield) {
+            std::this_thread::yield();
+            if(takeAction(action)) return true;
+        }
+
+        // Producers check the flag after pushing: either they see the dispatcher
+        // parked, or the dispatcher sees their Core Action
+        unique_lock<mutex> parkLock(parkMutex);
+        dispatcherParked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(takeAction(action)) {
+            dispatcherParked.store(false);
+            return true;
+        }
+
+        parkCv.wait(parkLock, [this]{ return !dispatcherParked.load() || stopService.load(); });
+        dispatcherParked.store(false);
+    }
+
+    return false;
+}
+
+bool LocalCoreService::takeAction(unique_ptr<CoreAction> &action) {
+    for(size_t round = 0; round < 2; ++round) {
+        for(size_t priority = 0; priority < PRIORITY_CLASSES; ++priority) {
+            if(credits[priority] && actions[priority]->tryPop(action)) {
+                markDequeued(*action);
+                --credits[priority];
+                return true;
             }
-        } else {
-            actionsLock.unlock();
         }
+
+        std::copy(PRIORITY_WEIGHTS, PRIORITY_WEIGHTS + PRIORITY_CLASSES, credits);
+    }
+
+    return false;
+}
+
+void LocalCoreService::markDequeued(CoreAction &action) {
+    if(timestampsEnabled()) {
+        auto &timestamps = action.getTimestamps();
+        timestamps.dequeued = LatencyStats::now();
+        if(timestamps.enqueued) {
+            TRACE_INTERVAL("queue wait", timestamps.enqueued);
+        }
+    }
+}
+
+MpscQueue<unique_ptr<CoreAction>>& LocalCoreService::queueOf(ActionPriority priority) {
+    return *actions[static_cast<size_t>(priority)];
+}
+
+size_t LocalCoreService::queueCapacity(size_t limit) {
+    size_t capacity{ 1 };
+    while(capacity < limit) {
+        capacity <<= 1;
     }
+    return capacity;
+}
+
+void LocalCoreService::wakeDispatcher() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(dispatcherParked.load(std::memory_order_relaxed)) {
+        unique_lock<mutex> parkLock(parkMutex);
+        dispatcherParked.store(false);
+        parkLock.unlock();
+        parkCv.notify_one();
+    }
+}
+
+void LocalCoreService::runAction(CoreAction &action) {
+    auto &timestamps = action.getTimestamps();
+    timestamps.started = timestampsEnabled() ? LatencyStats::now() : 0;
+    try {
+        TRACE_SPAN(action.getName());
+        action.exec();
+    } catch(const string& ex) {
+        std::cerr << ex << std::endl;
+        action.respond({ ReturnCode::GENERIC_ERROR });
+    } catch(...) {
+        std::cerr << "Unexpected exception in Exec Action Loop" << std::endl;
+        action.respond({ ReturnCode::GENERIC_ERROR });
+    }
+
+    if(timestamps.started) {
+        timestamps.finished = LatencyStats::now();
+        recordLatency(action);
+    }
+}
+
+bool LocalCoreService::timestampsEnabled() {
+    return LatencyStats::instance().isEnabled() || TRACE_ENABLED();
+}
+
+void LocalCoreService::recordLatency(CoreAction &action) {
+    auto &stats = LatencyStats::instance();
+    const auto &timestamps = action.getTimestamps();
+    if(timestamps.enqueued && timestamps.dequeued) {
+        stats.record(action.getName(), LatencyMetric::QUEUE_WAIT, timestamps.dequeued - timestamps.enqueued);
+    }
+    if(timestamps.dequeued) {
+        stats.record(action.getName(), LatencyMetric::SCHEDULE_WAIT, timestamps.started - timestamps.dequeued);
+    }
+    stats.record(action.getName(), LatencyMetric::EXECUTION, timestamps.finished - timestamps.started);
 }
 
 void LocalCoreService::start()  {
@@ -57,129 +262,556 @@ void LocalCoreService::start()  {
 
 void LocalCoreService::stop() {
     stopService.store(true);
-    actionsCv.notify_one();
+    unique_lock<mutex> parkLock(parkMutex);
+    parkLock.unlock();
+    parkCv.notify_one();
     execActionThread.join();
+    while(pushingActions.load()) {
+        std::this_thread::yield();
+    }
+
+    // Core Actions left in the queues are not executed, their clients are answered
+    unique_ptr<CoreAction> action;
+    for(auto &queue : actions) {
+        while(queue->tryPop(action)) {
+            action->respond({ ReturnCode::GENERIC_ERROR });
+            action.reset();
+        }
+    }
+
+    // Read-only Actions already dispatched are completed
+    readActions.wait();
+}
+
+NetworkCoreService::NetworkCoreService(shared_ptr<Core> &core, ThreadPool &pool,
+                                       const ServiceLimits &limits, size_t reactorsCount):
+    LocalCoreService{ core, pool, limits },
+    port{ DEFAULT_PORT },
+    connectionQueueSize{ SOMAXCONN }
+{
+    if(!reactorsCount) {
+        reactorsCount = std::max(1u, thread::hardware_concurrency() / 4);
+    }
+
+    // Connection limit is shared evenly, every reactor accepts its part
+    auto reactorConnections = (limits.maxConnections + reactorsCount - 1) / reactorsCount;
+    for(size_t idx = 0; idx < reactorsCount; ++idx) {
+        reactors.emplace_back(new Reactor{ [this](string_ref request, Reactor::Responder &&respond) {
+                                               processRequest(request, std::move(respond));
+                                           }, reactorConnections });
+    }
 }
 
 void NetworkCoreService::start() {
     LocalCoreService::start();
-    socketProcessingThread = thread{ &NetworkCoreService::processNextRequest, this };
-    createServerSocket();
-    acceptRequests();
+    for(auto &reactor : reactors) {
+        reactor->addListener(createServerSocket());
+    }
+
+    for(size_t idx = 1; idx < reactors.size(); ++idx) {
+        auto &reactor = *reactors[idx];
+        reactorThreads.emplace_back([&reactor]() {
+            try {
+                reactor.run();
+            } catch(const string& ex) {
+                std::cerr << ex << std::endl;
+            }
+        });
+    }
+
+    auto joinReactors = [this]() {
+        for(auto &reactor : reactors) {
+            reactor->stop();
+        }
+        for(auto &reactorThread : reactorThreads) {
+            reactorThread.join();
+        }
+        reactorThreads.clear();
+    };
+
+    try {
+        reactors.front()->run();
+    } catch(...) {
+        joinReactors();
+        throw;
+    }
+    joinReactors();
 }
 
 void NetworkCoreService::stop() {
+    for(auto &reactor : reactors) {
+        reactor->stop();
+    }
     LocalCoreService::stop();
-    stopService.store(true);
-    socketCv.notify_one();
-    socketProcessingThread.join();
 }
 
-void NetworkCoreService::createServerSocket() {
-    if((serverFd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+ServiceStats NetworkCoreService::getStats() const {
+    auto stats = LocalCoreService::getStats();
+    for(const auto &reactor : reactors) {
+        stats.connections += reactor->getConnections();
+        stats.rejectedConnections += reactor->getRejectedConnections();
+    }
+    return stats;
+}
+
+int NetworkCoreService::createServerSocket() {
+    int serverFd;
+    if((serverFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
         throw string{ "Socket creation failed" };
     }
 
-    if(setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT,
-                  &SOCKET_OPTION, sizeof(SOCKET_OPTION))) {
+    // Every reactor binds a socket of its own to the port
+    if(setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR, &SOCKET_OPTION, sizeof(SOCKET_OPTION)) ||
+       setsockopt(serverFd, SOL_SOCKET, SO_REUSEPORT, &SOCKET_OPTION, sizeof(SOCKET_OPTION))) {
+        close(serverFd);
         throw string{ "Setting socket options failed" };
     }
 
+    struct sockaddr_in socketAddr{};
     socketAddr.sin_family = AF_INET;
     socketAddr.sin_addr.s_addr = INADDR_ANY;
     socketAddr.sin_port = htons(port);
 
-    int socketAddrLen = sizeof(socketAddr);
-
-    if(bind(serverFd, reinterpret_cast<struct sockaddr*>(&socketAddr), socketAddrLen) < 0) {
+    if(bind(serverFd, reinterpret_cast<struct sockaddr*>(&socketAddr), sizeof(socketAddr)) < 0) {
+        close(serverFd);
         throw string{ "Socket bind failed" };
     }
 
     if (listen(serverFd, connectionQueueSize) < 0) {
+        close(serverFd);
         throw string{ "Listen failed" };
     }
+
+    return serverFd;
+}
+
+void NetworkCoreService::processRequest(string_ref request, Reactor::Responder &&respond) {
+    unique_ptr<CoreAction> action;
+    try {
+        action = WireProtocol::decodeAction(request);
+    } catch(const string& ex) {
+        respond(WireProtocol::encodeResponse({ ReturnCode::GENERIC_ERROR, {}, string{ ex } }));
+        return;
+    }
+
+    action->setResponseHandler([respond](Response &&response) {
+        OutputBuffer message;
+        WireProtocol::encodeResponse(response, message);
+        respond(std::move(message));
+    });
+    execAction(std::move(action));
 }
 
-void NetworkCoreService::acceptRequests() {
-    while(!stopService.load()) {
-        int newSocket;
-        int sockAddrLen = sizeof(struct sockaddr_in);
-        if ((newSocket = accept(serverFd, reinterpret_cast<struct sockaddr *>(&socketAddr),
-                     reinterpret_cast<socklen_t*>(&sockAddrLen))) < 0) {
-            throw string{ "Accept failed" };
+RemoteCoreService::RemoteCoreService(const string &host, int port, const RemoteServiceOptions &options):
+    CoreService{ nullptr },
+    options{ options },
+    address{},
+    addressLength{ 0 },
+    stopped{ true },
+    stopping{ false }
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) {
+        throw string{ "Server address resolution failed" };
+    }
+    std::memcpy(&address, found->ai_addr, found->ai_addrlen);
+    addressLength = found->ai_addrlen;
+    freeaddrinfo(found);
+
+    if((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        throw string{ "Epoll creation failed" };
+    }
+
+    if((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        close(epollFd);
+        throw string{ "Event descriptor creation failed" };
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_ID;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0) {
+        close(wakeFd);
+        close(epollFd);
+        throw string{ "Epoll registration failed" };
+    }
+
+    for(size_t idx = 0; idx < std::max<size_t>(options.connections, 1); ++idx) {
+        unique_ptr<Connection> connection{ new Connection{} };
+        connection->fd = -1;
+        connection->input.resize(READ_BUFFER_SIZE);
+        connections.push_back(std::move(connection));
+    }
+}
+
+RemoteCoreService::~RemoteCoreService() {
+    stop();
+    close(wakeFd);
+    close(epollFd);
+}
+
+future<Response> RemoteCoreService::execAction(unique_ptr<CoreAction> &&action) {
+    TRACE_SPAN("RemoteCoreService::execAction");
+    future<Response> fut = action->getFuture();
+    Submission submission{ 0, {}, Request{ nullptr, action->getDeadline() } };
+    try {
+        submission.message = WireProtocol::encodeAction(*action);
+    } catch(const string& ex) {
+        action->respond({ ReturnCode::GENERIC_ERROR, {}, string{ ex } });
+        return fut;
+    }
+    if(submission.request.deadline == std::chrono::steady_clock::time_point{}) {
+        submission.request.deadline = std::chrono::steady_clock::now() + options.timeout;
+    }
+
+    // Connection with the fewest Actions in flight, so a slow response holds up few others
+    for(size_t idx = 1; idx < connections.size(); ++idx) {
+        if(connections[idx]->load.load() < connections[submission.connection]->load.load()) {
+            submission.connection = idx;
         }
+    }
+    auto &connection = *connections[submission.connection];
+    if(connection.load.fetch_add(1) >= options.maxInFlight) {
+        connection.load.fetch_sub(1);
+        action->respond({ ReturnCode::OVERLOADED, options.retryAfter });
+        return fut;
+    }
+    submission.request.action = std::move(action);
+
+    unique_lock<mutex> submissionsLock{ submissionsMutex };
+    if(stopped) {
+        submissionsLock.unlock();
+        finish(connection, submission.request, { ReturnCode::GENERIC_ERROR, {}, string{ "Service is stopped" } });
+        return fut;
+    }
+    // The I/O thread takes all submissions at once, it's woken up only by the first one
+    auto first = submissions.empty();
+    submissions.push_back(std::move(submission));
+    submissionsLock.unlock();
 
-        unique_lock<mutex> socketLock{ socketMutex };
-        sockets.push(newSocket);
-        socketLock.unlock();
-        socketCv.notify_one();
+    if(first) {
+        wake();
     }
+    return fut;
 }
 
-void NetworkCoreService::processNextRequest() {
-    while (!stopService.load()) {
-            unique_lock<mutex> socketLock{ socketMutex };
-            if(sockets.empty()) {
-            socketCv.wait(socketLock);
+void RemoteCoreService::start() {
+    // Server should be reachable at start: connections are established before the
+    // service is used
+    for(size_t idx = 0; idx < connections.size(); ++idx) {
+        if(!openConnection(idx)) {
+            throw string{ "Connection to the server failed" };
         }
 
-        // Queue still may be empty even after wait() returned
-        if(!sockets.empty()) {
-            auto socket{ sockets.front() };
-            sockets.pop();
-            socketLock.unlock();
-            try {
-                processRequest(socket);
-            } catch(const string& ex) {
-                std::cerr << ex << std::endl;
-            } catch(...) {
-                std::cerr << "Unexpected exception in Process Next Request" << std::endl;
+        pollfd writable{ connections[idx]->fd, POLLOUT, 0 };
+        int error{ 0 };
+        socklen_t errorLength{ sizeof(error) };
+        if(poll(&writable, 1, static_cast<int>(options.timeout.count())) <= 0 ||
+           getsockopt(writable.fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) < 0 || error) {
+            for(size_t opened = 0; opened <= idx; ++opened) {
+                closeConnection(opened, "Connection to the server failed");
             }
-        } else {
-            socketLock.unlock();
+            throw string{ "Connection to the server failed" };
         }
     }
+
+    unique_lock<mutex> submissionsLock{ submissionsMutex };
+    stopped = false;
+    stopping.store(false);
+    submissionsLock.unlock();
+    ioThread = thread{ &RemoteCoreService::ioLoop, this };
 }
 
-void NetworkCoreService::processRequest(int socket) {
-    auto data = readSocket(socket);
-    close(socket);
-    //std::cout << "processed: " << data.first << std::endl;
-    //std::cout << data.second.get() << std::endl;
-    for (size_t i = 0; i < data.first; ++i) {
-        std::cout << *(data.second.get() + i);
+void RemoteCoreService::stop() {
+    unique_lock<mutex> submissionsLock{ submissionsMutex };
+    stopped = true;
+    vector<Submission> left;
+    left.swap(submissions);
+    submissionsLock.unlock();
+
+    stopping.store(true);
+    wake();
+    if(ioThread.joinable()) {
+        ioThread.join();
+    }
+
+    for(auto &submission : left) {
+        finish(*connections[submission.connection], submission.request,
+            { ReturnCode::GENERIC_ERROR, {}, string{ "Service is stopped" } });
+    }
+    for(size_t idx = 0; idx < connections.size(); ++idx) {
+        closeConnection(idx, "Service is stopped");
     }
-    std::cout << std::endl;
-    // parse XML
-    // init action
-    // exec action
 }
 
-pair<size_t, unique_ptr<char>> NetworkCoreService::readSocket(int socket) {
-    constexpr ssize_t dataLenBuffSize{ 9 };
-    char dataLenBuff[dataLenBuffSize];
+void RemoteCoreService::ioLoop() {
+    epoll_event events[MAX_EVENTS];
+    while(!stopping.load()) {
+        auto count = epoll_wait(epollFd, events, MAX_EVENTS, expireRequests());
+        if(count < 0) {
+            if(errno == EINTR) continue;
+            std::cerr << "Epoll wait failed" << std::endl;
+            return;
+        }
 
-    auto readCount = read(socket, dataLenBuff, dataLenBuffSize);
-    if(readCount != dataLenBuffSize) {
-        throw string{ "Cannot read data length" };
+        // Submissions are sent after the events of the round: a connection reopened
+        // for them doesn't get events of the closed one
+        auto woken = false;
+        for(int idx = 0; idx < count; ++idx) {
+            if(events[idx].data.u64 == WAKE_ID) {
+                uint64_t value;
+                while(read(wakeFd, &value, sizeof(value)) > 0) {}
+                woken = true;
+                continue;
+            }
+
+            auto connectionIdx = events[idx].data.u64 - 1;
+            if(connections[connectionIdx]->fd < 0) {
+                continue;
+            }
+
+            auto ready = events[idx].events;
+            if(ready & (EPOLLERR | EPOLLHUP) && !(ready & EPOLLIN)) {
+                closeConnection(connectionIdx, "Connection to the server failed");
+                continue;
+            }
+            if(ready & EPOLLOUT && !writeConnection(connectionIdx)) {
+                continue;
+            }
+            if(ready & (EPOLLIN | EPOLLRDHUP)) {
+                readConnection(connectionIdx);
+            }
+        }
+
+        if(woken) {
+            processSubmissions();
+        }
+    }
+}
+
+void RemoteCoreService::processSubmissions() {
+    vector<Submission> ready;
+    unique_lock<mutex> submissionsLock{ submissionsMutex };
+    ready.swap(submissions);
+    submissionsLock.unlock();
+
+    // Requests of a connection are written together once all are queued
+    vector<bool> written(connections.size(), false);
+    for(auto &submission : ready) {
+        auto &connection = *connections[submission.connection];
+        if(connection.fd < 0 && !openConnection(submission.connection)) {
+            finish(connection, submission.request,
+                { ReturnCode::GENERIC_ERROR, {}, string{ "Connection to the server failed" } });
+            continue;
+        }
+
+        char header[WireProtocol::FRAME_HEADER_SIZE];
+        WireProtocol::encodeFrameLength(header, static_cast<uint32_t>(submission.message.size()));
+        connection.output.append(header, WireProtocol::FRAME_HEADER_SIZE);
+        connection.output.append(submission.message);
+        deadlines.push(Deadline{ submission.request.deadline, submission.connection,
+                                 connection.firstSequence + connection.requests.size() });
+        connection.requests.push_back(std::move(submission.request));
+        written[submission.connection] = true;
     }
 
-    auto dataLen = atoi(dataLenBuff);
-    if(dataLen <= 0) {
-        throw string{ "Data length should be positive" };
+    for(size_t idx = 0; idx < connections.size(); ++idx) {
+        if(written[idx]) {
+            writeConnection(idx);
+        }
     }
+}
 
-    unique_ptr<char> dataBuff{ new char[dataLen] };
-    char *dataBuffWrPos = dataBuff.get();
-    char *dataBuffEndPos = dataBuffWrPos + dataLen;
-    readCount = 0;
-    while(dataBuffWrPos < dataBuffEndPos) {
-        auto readCount = read(socket, dataBuffWrPos, dataBuffEndPos - dataBuffWrPos);
+int RemoteCoreService::expireRequests() {
+    // Deadlines of answered requests are dropped as they come up, unless too many pile up
+    if(deadlines.size() > 2 * connections.size() * options.maxInFlight) {
+        vector<Deadline> pending;
+        for(; !deadlines.empty(); deadlines.pop()) {
+            const auto &deadline = deadlines.top();
+            const auto &connection = *connections[deadline.connection];
+            if(deadline.sequence >= connection.firstSequence &&
+               connection.requests[deadline.sequence - connection.firstSequence].action) {
+                pending.push_back(deadline);
+            }
+        }
+        for(const auto &deadline : pending) {
+            deadlines.push(deadline);
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for(; !deadlines.empty(); deadlines.pop()) {
+        const auto &deadline = deadlines.top();
+        if(deadline.time > now) {
+            // Rounded up, so the wait doesn't end just before the deadline
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline.time - now).count() + 1;
+            return static_cast<int>(std::min<decltype(wait)>(wait, INT_MAX));
+        }
+
+        auto &connection = *connections[deadline.connection];
+        if(deadline.sequence >= connection.firstSequence) {
+            // The request keeps its place: its late response is discarded
+            auto &request = connection.requests[deadline.sequence - connection.firstSequence];
+            if(request.action) {
+                finish(connection, request, { ReturnCode::TIMEOUT });
+            }
+        }
+    }
+    return -1;
+}
+
+bool RemoteCoreService::openConnection(size_t idx) {
+    auto &connection = *connections[idx];
+    int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return false;
+    }
+
+    // Requests are small and pipelined, they are sent at once
+    int noDelay{ 1 };
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    if(connect(fd, reinterpret_cast<const sockaddr*>(&address), addressLength) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return false;
+    }
+
+    // Writing starts once the connection is established: the socket isn't writable before
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u64 = idx + 1;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        return false;
+    }
+
+    connection.fd = fd;
+    connection.events = event.events;
+    return true;
+}
+
+bool RemoteCoreService::readConnection(size_t idx) {
+    auto &connection = *connections[idx];
+    while(true) {
+        auto readCount = read(connection.fd, &connection.input[connection.inputSize],
+            connection.input.size() - connection.inputSize);
         if(readCount < 0) {
-            throw string{ "Cannot read data" };
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            closeConnection(idx, "Connection to the server failed");
+            return false;
         }
-        dataBuffWrPos += readCount;
+        if(readCount == 0) {
+            closeConnection(idx, "Connection closed by the server");
+            return false;
+        }
+        connection.inputSize += readCount;
+
+        size_t pos{ 0 };
+        while(connection.inputSize - pos >= WireProtocol::FRAME_HEADER_SIZE) {
+            size_t length = WireProtocol::decodeFrameLength(&connection.input[pos]);
+            if(connection.inputSize - pos - WireProtocol::FRAME_HEADER_SIZE < length) {
+                break;
+            }
+            if(connection.requests.empty()) {
+                closeConnection(idx, "Unexpected response from the server");
+                return false;
+            }
+
+            auto request = std::move(connection.requests.front());
+            connection.requests.pop_front();
+            ++connection.firstSequence;
+            if(request.action) {
+                string_ref message{ &connection.input[pos + WireProtocol::FRAME_HEADER_SIZE], length };
+                try {
+                    finish(connection, request, WireProtocol::decodeResponse(message));
+                } catch(const string& ex) {
+                    finish(connection, request, { ReturnCode::GENERIC_ERROR, {}, string{ ex } });
+                }
+            }
+            pos += WireProtocol::FRAME_HEADER_SIZE + length;
+        }
+
+        if(pos) {
+            std::memmove(&connection.input[0], &connection.input[pos], connection.inputSize - pos);
+            connection.inputSize -= pos;
+        }
+
+        if(connection.inputSize >= WireProtocol::FRAME_HEADER_SIZE) {
+            // Response larger than the buffer: the buffer grows to fit it
+            size_t length = WireProtocol::decodeFrameLength(&connection.input[0]);
+            if(WireProtocol::FRAME_HEADER_SIZE + length > connection.input.size()) {
+                connection.input.resize(WireProtocol::FRAME_HEADER_SIZE + length);
+            }
+        } else if(connection.input.size() > READ_BUFFER_SIZE) {
+            string{ connection.input, 0, READ_BUFFER_SIZE }.swap(connection.input);
+        }
+    }
+}
+
+bool RemoteCoreService::writeConnection(size_t idx) {
+    auto &connection = *connections[idx];
+    while(connection.writeCount < connection.output.size()) {
+        auto writeCount = send(connection.fd, connection.output.data() + connection.writeCount,
+            connection.output.size() - connection.writeCount, MSG_NOSIGNAL);
+        if(writeCount < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            closeConnection(idx, "Connection to the server failed");
+            return false;
+        }
+        connection.writeCount += writeCount;
+    }
+
+    auto blocked = connection.writeCount < connection.output.size();
+    if(!blocked) {
+        connection.output.clear();
+        connection.writeCount = 0;
     }
 
-    return { static_cast<size_t>(dataLen), std::move(dataBuff) };
+    uint32_t events = EPOLLIN | EPOLLRDHUP | (blocked ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if(events != connection.events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = idx + 1;
+        if(epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event) < 0) {
+            closeConnection(idx, "Connection to the server failed");
+            return false;
+        }
+        connection.events = events;
+    }
+    return true;
+}
+
+void RemoteCoreService::closeConnection(size_t idx, const string &summary) {
+    auto &connection = *connections[idx];
+    if(connection.fd >= 0) {
+        // Closing the descriptor removes it from the epoll set
+        close(connection.fd);
+        connection.fd = -1;
+    }
+
+    for(auto &request : connection.requests) {
+        if(request.action) {
+            finish(connection, request, { ReturnCode::GENERIC_ERROR, {}, string{ summary } });
+        }
+    }
+    connection.firstSequence += connection.requests.size();
+    connection.requests.clear();
+    connection.output.clear();
+    connection.writeCount = 0;
+    connection.inputSize = 0;
+}
+
+void RemoteCoreService::finish(Connection &connection, Request &request, Response &&response) {
+    request.action->respond(std::move(response));
+    request.action.reset();
+    connection.load.fetch_sub(1);
+}
+
+void RemoteCoreService::wake() {
+    uint64_t value{ 1 };
+    while(write(wakeFd, &value, sizeof(value)) < 0 && errno == EINTR) {}
 }
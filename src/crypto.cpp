@@ -3,6 +3,7 @@
  */
 
 #include "crypto.hpp"
+#include "tracing.hpp"
 
 Crypto::Crypto(const string &passwdStr) {
     memset(password, 0x00, CRT_KEY_LEN);
@@ -16,6 +17,7 @@ Crypto::Crypto(const string &passwdStr) {
 }
 
 string Crypto::encryptString(const string &str) {
+    TRACE_SPAN("Crypto::encryptString");
 	string ciphertext;
 
 	CryptoPP::AES::Encryption aesEncryption(password, CRT_KEY_LEN);
@@ -29,6 +31,7 @@ string Crypto::encryptString(const string &str) {
 }
 
 string Crypto::decryptString(const string &str) {
+    TRACE_SPAN("Crypto::decryptString");
 	string decryptedtext;
 
 	CryptoPP::AES::Decryption aesDecryption(password, CRT_KEY_LEN);
@@ -0,0 +1,78 @@
+/**
+ * EpochManager implementation
+ */
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include "epoch_manager.hpp"
+
+constexpr size_t EpochManager::READER_SLOTS;
+constexpr uint64_t EpochManager::IDLE;
+constexpr size_t EpochManager::CACHE_LINE;
+
+EpochManager::Guard& EpochManager::Guard::operator=(Guard &&other) {
+    if(this != &other) {
+        if(slot) slot->store(IDLE);
+        slot = other.slot;
+        other.slot = nullptr;
+    }
+    return *this;
+}
+
+EpochManager::Guard::~Guard() {
+    if(slot) {
+        slot->store(IDLE);
+    }
+}
+
+EpochManager::EpochManager(): globalEpoch{ IDLE + 1 } {
+    for(auto &slot : slots) {
+        slot.epoch.store(IDLE);
+    }
+}
+
+EpochManager::~EpochManager() {
+    for(auto &item : retired) {
+        item.second();
+    }
+}
+
+EpochManager::Guard EpochManager::pin() {
+    // Threads start probing from different slots, so they rarely compete for one
+    auto slotIdx = std::hash<std::thread::id>{}(std::this_thread::get_id()) % READER_SLOTS;
+
+    while(true) {
+        for(size_t probe = 0; probe < READER_SLOTS; ++probe) {
+            auto &slot = slots[(slotIdx + probe) % READER_SLOTS].epoch;
+            auto idle = IDLE;
+            if(slot.load(std::memory_order_relaxed) == IDLE &&
+               slot.compare_exchange_strong(idle, globalEpoch.load())) {
+                return Guard{ &slot };
+            }
+        }
+
+        // All slots are pinned
+        std::this_thread::yield();
+    }
+}
+
+void EpochManager::retire(function<void()> &&deleter) {
+    // Readers which pin from now on can't see the retired data
+    retired.emplace_back(globalEpoch.fetch_add(1), std::move(deleter));
+}
+
+void EpochManager::collect() {
+    auto oldestPinned = globalEpoch.load();
+    for(auto &slot : slots) {
+        auto epoch = slot.epoch.load();
+        if(epoch != IDLE) {
+            oldestPinned = std::min(oldestPinned, epoch);
+        }
+    }
+
+    while(!retired.empty() && retired.front().first < oldestPinned) {
+        retired.front().second();
+        retired.pop_front();
+    }
+}
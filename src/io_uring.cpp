@@ -0,0 +1,236 @@
+/**
+ * IoUring implementation
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "io_uring.hpp"
+
+using std::string;
+
+namespace {
+    int ioUringSetup(unsigned entries, io_uring_params *params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    template<typename T>
+    T* ringField(void *ring, uint32_t offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+}
+
+bool IoUring::isEnabled() {
+    static const bool enabled = []() {
+        auto backend = std::getenv("NOTES_IO_BACKEND");
+        if(!backend || std::strcmp(backend, "io_uring") != 0) {
+            return false;
+        }
+
+        io_uring_params params{};
+        int fd = ioUringSetup(1, &params);
+        if(fd < 0) {
+            // Not supported by the kernel or disabled
+            return false;
+        }
+        close(fd);
+        return (params.features & IORING_FEAT_NODROP) != 0;
+    }();
+
+    return enabled;
+}
+
+IoUring::IoUring(unsigned entries): entries{ entries } {
+    io_uring_params params{};
+    if((ringFd = ioUringSetup(entries, &params)) < 0) {
+        throw string{ "io_uring setup failed" };
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if(sqRing == MAP_FAILED) {
+        close(ringFd);
+        throw string{ "io_uring mapping failed" };
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if(cqRing == MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+            close(ringFd);
+            throw string{ "io_uring mapping failed" };
+        }
+    }
+
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+    if(sqes == MAP_FAILED) {
+        if(cqRing != sqRing) munmap(cqRing, cqRingSize);
+        munmap(sqRing, sqRingSize);
+        close(ringFd);
+        throw string{ "io_uring mapping failed" };
+    }
+
+    this->entries = params.sq_entries;
+    sqHead = ringField<unsigned>(sqRing, params.sq_off.head);
+    sqTail = ringField<unsigned>(sqRing, params.sq_off.tail);
+    sqMask = ringField<unsigned>(sqRing, params.sq_off.ring_mask);
+    sqArray = ringField<unsigned>(sqRing, params.sq_off.array);
+    sqPendingTail = *sqTail;
+    cqHead = ringField<unsigned>(cqRing, params.cq_off.head);
+    cqTail = ringField<unsigned>(cqRing, params.cq_off.tail);
+    cqMask = ringField<unsigned>(cqRing, params.cq_off.ring_mask);
+    cqes = ringField<io_uring_cqe>(cqRing, params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    munmap(sqes, entries * sizeof(io_uring_sqe));
+    if(cqRing != sqRing) munmap(cqRing, cqRingSize);
+    munmap(sqRing, sqRingSize);
+    close(ringFd);
+}
+
+void IoUring::prepareAccept(int fd, uint64_t userData, bool multishot) {
+    auto &sqe = nextSqe(IORING_OP_ACCEPT, fd, userData);
+    sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if(multishot) {
+        sqe.ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+}
+
+void IoUring::prepareRead(int fd, void *buffer, size_t size, uint64_t offset, uint64_t userData) {
+    auto &sqe = nextSqe(IORING_OP_READ, fd, userData);
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(size);
+    sqe.off = offset;
+}
+
+void IoUring::prepareRecv(int fd, void *buffer, size_t size, uint64_t userData) {
+    auto &sqe = nextSqe(IORING_OP_RECV, fd, userData);
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(size);
+}
+
+void IoUring::prepareSend(int fd, const void *buffer, size_t size, uint64_t userData) {
+    auto &sqe = nextSqe(IORING_OP_SEND, fd, userData);
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(size);
+    sqe.msg_flags = MSG_NOSIGNAL;
+}
+
+void IoUring::prepareSendmsg(int fd, const msghdr *message, uint64_t userData) {
+    auto &sqe = nextSqe(IORING_OP_SENDMSG, fd, userData);
+    sqe.addr = reinterpret_cast<uint64_t>(message);
+    sqe.len = 1;
+    sqe.msg_flags = MSG_NOSIGNAL;
+}
+
+void IoUring::prepareWrite(int fd, const void *buffer, size_t size, uint64_t offset, uint64_t userData, bool link) {
+    auto &sqe = nextSqe(IORING_OP_WRITE, fd, userData);
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(size);
+    sqe.off = offset;
+    if(link) {
+        sqe.flags |= IOSQE_IO_LINK;
+    }
+}
+
+void IoUring::prepareFsync(int fd, uint64_t userData) {
+    nextSqe(IORING_OP_FSYNC, fd, userData);
+}
+
+void IoUring::prepareCancelAll(uint64_t userData) {
+    auto &sqe = nextSqe(IORING_OP_ASYNC_CANCEL, -1, userData);
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_ANY;
+}
+
+void IoUring::submit(unsigned waitFor) {
+    __atomic_store_n(sqTail, sqPendingTail, __ATOMIC_RELEASE);
+    if(!reaped.empty()) {
+        waitFor = 0;
+    }
+
+    while(true) {
+        // Entries not consumed by the kernel yet, including ones left by an earlier call
+        auto toSubmit = sqPendingTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if(ioUringEnter(ringFd, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0) >= 0) {
+            return;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno == EBUSY || errno == EAGAIN) {
+            // Completion ring is full: entries are submitted after completions are processed
+            return;
+        }
+        throw string{ "io_uring submission failed" };
+    }
+}
+
+io_uring_sqe& IoUring::nextSqe(uint8_t opcode, int fd, uint64_t userData) {
+    while(sqPendingTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries) {
+        submit();
+        if(sqPendingTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) < entries) {
+            break;
+        }
+
+        // Completion ring is full: the kernel takes entries once completions are taken off it
+        if(!reapCompletions()) {
+            submit(1);
+        }
+    }
+
+    auto idx = sqPendingTail & *sqMask;
+    auto &sqe = sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.user_data = userData;
+    sqArray[idx] = idx;
+    ++sqPendingTail;
+    return sqe;
+}
+
+bool IoUring::takeCompletion(io_uring_cqe &cqe) {
+    if(!reaped.empty()) {
+        cqe = reaped.front();
+        reaped.pop_front();
+        return true;
+    }
+
+    auto head = *cqHead;
+    if(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = cqes[head & *cqMask];
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+size_t IoUring::reapCompletions() {
+    auto head = *cqHead;
+    auto tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    size_t count{ 0 };
+    for(; head != tail; ++head, ++count) {
+        reaped.push_back(cqes[head & *cqMask]);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
@@ -0,0 +1,222 @@
+/**
+ * LatencyStats implementation
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include "latency_stats.hpp"
+
+using std::lock_guard;
+
+constexpr size_t LatencyHistogram::SUB_BUCKET_BITS;
+constexpr size_t LatencyHistogram::SUB_BUCKETS;
+constexpr size_t LatencyHistogram::BUCKETS;
+constexpr size_t LatencyStats::MAX_NAMES;
+constexpr size_t LatencyStats::METRICS;
+
+namespace {
+    // Histograms of the current thread
+    thread_local void *currentThreadHistograms{ nullptr };
+
+    const char* metricName(LatencyMetric metric) {
+        switch(metric) {
+        case LatencyMetric::QUEUE_WAIT: return "queue";
+        case LatencyMetric::SCHEDULE_WAIT: return "schedule";
+        case LatencyMetric::EXECUTION: return "exec";
+        case LatencyMetric::SERIALIZE: return "serialize";
+        case LatencyMetric::ENCRYPT: return "encrypt";
+        case LatencyMetric::WRITE: return "write";
+        case LatencyMetric::FSYNC: return "fsync";
+        }
+        return "";
+    }
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for(auto &count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+    // Single writer: no read-modify-write needed
+    auto &count = counts[bucketOf(nanos)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::addTo(vector<uint64_t> &totals) const {
+    for(size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        totals[bucket] += counts[bucket].load(std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t nanos) {
+    if(nanos < SUB_BUCKETS) {
+        return nanos;
+    }
+
+    // Position of the highest bit selects the range, the following bits the bucket
+    size_t magnitude = 63 - __builtin_clzll(nanos);
+    size_t subBucket = (nanos >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketValue(size_t bucket) {
+    if(bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+
+    size_t shift = bucket / SUB_BUCKETS - 1;
+    uint64_t subBucket = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + subBucket + 1) << shift) - 1;
+}
+
+LatencyStats::ThreadHistograms::ThreadHistograms() {
+    for(auto &nameHistograms : histograms) {
+        for(auto &histogram : nameHistograms) {
+            histogram.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+}
+
+LatencyStats::ThreadHistograms::~ThreadHistograms() {
+    for(auto &nameHistograms : histograms) {
+        for(auto &histogram : nameHistograms) {
+            delete histogram.load();
+        }
+    }
+}
+
+LatencyStats& LatencyStats::instance() {
+    static LatencyStats stats;
+    return stats;
+}
+
+LatencyStats::LatencyStats(): enabled{ std::getenv("NOTES_LATENCY_STATS") != nullptr } {
+    for(auto &name : names) {
+        name.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyStats::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyStats::setEnabled(bool state) {
+    enabled.store(state);
+}
+
+void LatencyStats::record(const char *name, LatencyMetric metric, uint64_t nanos) {
+    if(!isEnabled()) {
+        return;
+    }
+
+    auto index = nameIndex(name);
+    if(index == MAX_NAMES) {
+        return;
+    }
+
+    auto &slot = threadHistograms().histograms[index][static_cast<size_t>(metric)];
+    auto histogram = slot.load(std::memory_order_relaxed);
+    if(!histogram) {
+        histogram = new LatencyHistogram;
+        slot.store(histogram, std::memory_order_release);
+    }
+    histogram->record(nanos);
+}
+
+vector<LatencySummary> LatencyStats::getSummary() const {
+    vector<LatencySummary> summary;
+    lock_guard<mutex> threadsLock{ threadsMutex };
+
+    for(size_t index = 0; index < MAX_NAMES; ++index) {
+        auto name = names[index].load(std::memory_order_acquire);
+        if(!name) {
+            break;
+        }
+
+        for(size_t metric = 0; metric < METRICS; ++metric) {
+            vector<uint64_t> counts(LatencyHistogram::BUCKETS, 0);
+            for(const auto &thread : threads) {
+                auto histogram = thread->histograms[index][metric].load(std::memory_order_acquire);
+                if(histogram) {
+                    histogram->addTo(counts);
+                }
+            }
+
+            uint64_t total{ 0 };
+            for(auto count : counts) {
+                total += count;
+            }
+            if(!total) {
+                continue;
+            }
+
+            LatencySummary item{ name, static_cast<LatencyMetric>(metric), total, 0, 0, 0, 0 };
+            uint64_t seen{ 0 };
+            for(size_t bucket = 0; bucket < counts.size(); ++bucket) {
+                if(!counts[bucket]) {
+                    continue;
+                }
+
+                seen += counts[bucket];
+                auto value = LatencyHistogram::bucketValue(bucket);
+                if(!item.p50 && seen * 100 >= total * 50) item.p50 = value;
+                if(!item.p90 && seen * 100 >= total * 90) item.p90 = value;
+                if(!item.p99 && seen * 100 >= total * 99) item.p99 = value;
+                item.max = value;
+            }
+            summary.push_back(std::move(item));
+        }
+    }
+
+    return summary;
+}
+
+string LatencyStats::report() const {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1);
+    for(const auto &item : getSummary()) {
+        os << item.name << ' ' << metricName(item.metric)
+           << " count=" << item.count
+           << " p50=" << item.p50 / 1000.0 << "us"
+           << " p90=" << item.p90 / 1000.0 << "us"
+           << " p99=" << item.p99 / 1000.0 << "us"
+           << " max=" << item.max / 1000.0 << "us\n";
+    }
+    return os.str();
+}
+
+size_t LatencyStats::nameIndex(const char *name) {
+    for(size_t index = 0; index < MAX_NAMES; ++index) {
+        auto registered = names[index].load(std::memory_order_acquire);
+        if(!registered) {
+            if(names[index].compare_exchange_strong(registered, name)) {
+                return index;
+            }
+        }
+
+        // Either the slot was taken or another thread registered a name concurrently
+        if(registered == name || std::strcmp(registered, name) == 0) {
+            return index;
+        }
+    }
+
+    return MAX_NAMES;
+}
+
+LatencyStats::ThreadHistograms& LatencyStats::threadHistograms() {
+    if(!currentThreadHistograms) {
+        unique_ptr<ThreadHistograms> histograms{ new ThreadHistograms };
+        currentThreadHistograms = histograms.get();
+        lock_guard<mutex> threadsLock{ threadsMutex };
+        threads.push_back(std::move(histograms));
+    }
+
+    return *static_cast<ThreadHistograms*>(currentThreadHistograms);
+}
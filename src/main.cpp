@@ -11,13 +11,30 @@ using std::shared_ptr;
 
 int main(int argc, char *argv[])
 {
-    bool encryption;
-    if(argc > 1 && strcmp(argv[1], Cli::NO_ENCRYPTION) == 0) 
-        encryption = false;
-    else 
-        encryption = true;
+    bool encryption{ true };
+    string server;
+    for(int idx = 1; idx < argc; ++idx) {
+        if(strcmp(argv[idx], Cli::NO_ENCRYPTION) == 0)
+            encryption = false;
+        else if(strcmp(argv[idx], Cli::REMOTE_SERVICE) == 0 && idx + 1 < argc)
+            server = argv[++idx];
+    }
 
     try { 
+        if(!server.empty()) {
+            // CLI of a remote notes server
+            auto colon = server.rfind(':');
+            auto port = colon == string::npos ? NetworkCoreService::DEFAULT_PORT : std::stoi(server.substr(colon + 1));
+            shared_ptr<CoreService> coreService{ new RemoteCoreService{ server.substr(0, colon), port } };
+            coreService->start();
+
+            Cli cli{ coreService, encryption };
+            cli.start();
+
+            coreService->stop();
+            return 0;
+        }
+
         shared_ptr<Core> core{ new Core }; 
         shared_ptr<CoreService> coreService{ new NetworkCoreService { core } };
         coreService->start();
@@ -0,0 +1,147 @@
+/**
+ * OutputBuffer implementation
+ */
+
+#include <algorithm>
+#include "output_buffer.hpp"
+
+constexpr size_t OutputBuffer::MIN_CHUNK_CAPACITY;
+constexpr size_t OutputBuffer::MAX_COPIED_CHUNK;
+
+OutputBuffer::OutputBuffer(string &&bytes): offset{ 0 }, total{ bytes.size() } {
+    if(!bytes.empty()) {
+        chunks.push_back(Chunk{ std::move(bytes), nullptr, 0, {}, false, 0 });
+    }
+}
+
+OutputBuffer::OutputBuffer(OutputBuffer &&other):
+    chunks{ std::move(other.chunks) },
+    offset{ other.offset },
+    total{ other.total },
+    retained{ std::move(other.retained) }
+{
+    other.chunks.clear();
+    other.retained.clear();
+    other.offset = other.total = 0;
+}
+
+OutputBuffer& OutputBuffer::operator=(OutputBuffer &&other) {
+    if(this != &other) {
+        chunks = std::move(other.chunks);
+        offset = other.offset;
+        total = other.total;
+        retained = std::move(other.retained);
+        other.chunks.clear();
+        other.retained.clear();
+        other.offset = other.total = 0;
+    }
+    return *this;
+}
+
+void OutputBuffer::append(const char *data, size_t size) {
+    if(!size) {
+        return;
+    }
+
+    // Chunks being read by the kernel stay unchanged: their memory might be reallocated
+    if(chunks.empty() || chunks.back().data || chunks.back().zerocopy) {
+        chunks.push_back(Chunk{ {}, nullptr, 0, {}, false, 0 });
+        chunks.back().bytes.reserve(std::max(size, MIN_CHUNK_CAPACITY));
+    }
+    chunks.back().bytes.append(data, size);
+    total += size;
+}
+
+void OutputBuffer::appendRef(string_ref data, const shared_ptr<const void> &owner) {
+    if(data.empty()) {
+        return;
+    }
+
+    chunks.push_back(Chunk{ {}, data.data(), data.size(), owner, false, 0 });
+    total += data.size();
+}
+
+void OutputBuffer::append(OutputBuffer &&other) {
+    for(size_t idx = 0; idx < other.chunks.size(); ++idx) {
+        auto &chunk = other.chunks[idx];
+        auto skip = idx ? 0 : other.offset;
+        if(!chunk.data && chunk.bytes.size() - skip <= MAX_COPIED_CHUNK) {
+            append(chunk.bytes.data() + skip, chunk.bytes.size() - skip);
+            continue;
+        }
+
+        // Large chunks are moved: owned bytes are far beyond the small string buffer,
+        // so their memory moves along with them
+        if(skip) {
+            if(chunk.data) {
+                chunk.data += skip;
+                chunk.size -= skip;
+            } else {
+                chunk.bytes.erase(0, skip);
+            }
+        }
+        total += chunk.length();
+        chunks.push_back(std::move(chunk));
+    }
+
+    other.chunks.clear();
+    other.offset = other.total = 0;
+}
+
+size_t OutputBuffer::size() const {
+    return total;
+}
+
+bool OutputBuffer::empty() const {
+    return total == 0;
+}
+
+size_t OutputBuffer::prepare(iovec *vectors, size_t maxVectors) const {
+    size_t count{ 0 };
+    for(size_t idx = 0; idx < chunks.size() && count < maxVectors; ++idx) {
+        auto skip = idx ? 0 : offset;
+        vectors[count].iov_base = const_cast<char*>(chunks[idx].begin() + skip);
+        vectors[count].iov_len = chunks[idx].length() - skip;
+        ++count;
+    }
+    return count;
+}
+
+void OutputBuffer::consume(size_t count) {
+    consume(count, false, 0);
+}
+
+void OutputBuffer::consumeZerocopy(size_t count, uint32_t sendId) {
+    consume(count, true, sendId);
+}
+
+void OutputBuffer::release(uint32_t lastSendId) {
+    // Send numbers wrap around
+    while(!retained.empty() && static_cast<int32_t>(retained.front().sendId - lastSendId) <= 0) {
+        retained.pop_front();
+    }
+}
+
+void OutputBuffer::consume(size_t count, bool zerocopy, uint32_t sendId) {
+    total -= count;
+    while(count) {
+        auto &chunk = chunks.front();
+        if(zerocopy) {
+            chunk.zerocopy = true;
+            chunk.sendId = sendId;
+        }
+
+        auto left = chunk.length() - offset;
+        if(count < left) {
+            offset += count;
+            return;
+        }
+
+        count -= left;
+        offset = 0;
+        if(chunk.zerocopy) {
+            retained.push_back(std::move(chunk));
+        }
+        chunks.pop_front();
+    }
+}
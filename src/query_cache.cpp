@@ -0,0 +1,107 @@
+/**
+ * QueryCache implementation
+ */
+
+#include <functional>
+#include "query_cache.hpp"
+
+using std::lock_guard;
+
+constexpr size_t QueryCache::SHARDS;
+
+double QueryCacheStats::hitRate() const {
+    auto lookups = hits + misses;
+    return lookups ? static_cast<double>(hits) / lookups : 0.0;
+}
+
+QueryCache::QueryCache(size_t maxEntries, size_t maxBytes):
+    maxEntries{ (maxEntries + SHARDS - 1) / SHARDS },
+    maxBytes{ (maxBytes + SHARDS - 1) / SHARDS }
+    {}
+
+bool QueryCache::lookup(const string &key, uint64_t generation, vector<int> &ids) {
+    auto &shard = shardOf(key);
+    lock_guard<mutex> lock{ shard.shardMutex };
+
+    auto indexIter = shard.index.find(key);
+    if(indexIter == shard.index.end()) {
+        ++shard.misses;
+        return false;
+    }
+
+    auto entry = indexIter->second;
+    if(entry->generation != generation) {
+        // Data has changed since the result was calculated. A result calculated for
+        // a newer generation is kept for the readers which see that generation
+        if(entry->generation < generation) {
+            erase(shard, entry);
+        }
+        ++shard.misses;
+        return false;
+    }
+
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    ids = entry->ids;
+    ++shard.hits;
+    return true;
+}
+
+void QueryCache::store(const string &key, uint64_t generation, const vector<int> &ids) {
+    auto &shard = shardOf(key);
+    lock_guard<mutex> lock{ shard.shardMutex };
+
+    auto indexIter = shard.index.find(key);
+    if(indexIter != shard.index.end()) {
+        if(indexIter->second->generation > generation) {
+            // Slow reader of an older snapshot
+            return;
+        }
+        erase(shard, indexIter->second);
+    }
+
+    shard.entries.push_front({ key, generation, ids });
+    shard.index.emplace(key, shard.entries.begin());
+    shard.memoryBytes += entrySize(shard.entries.front());
+
+    // Evict least recently used entries, but always keep the latest one
+    while(shard.entries.size() > 1 &&
+          (shard.entries.size() > maxEntries || shard.memoryBytes > maxBytes)) {
+        erase(shard, std::prev(shard.entries.end()));
+    }
+}
+
+void QueryCache::clear() {
+    for(auto &shard : shards) {
+        lock_guard<mutex> lock{ shard.shardMutex };
+        shard.entries.clear();
+        shard.index.clear();
+        shard.memoryBytes = 0;
+    }
+}
+
+QueryCacheStats QueryCache::getStats() const {
+    QueryCacheStats stats{ 0, 0, 0, 0 };
+    for(auto &shard : shards) {
+        lock_guard<mutex> lock{ shard.shardMutex };
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.entries += shard.entries.size();
+        stats.memoryBytes += shard.memoryBytes;
+    }
+    return stats;
+}
+
+QueryCache::Shard& QueryCache::shardOf(const string &key) {
+    return shards[std::hash<string>{}(key) % SHARDS];
+}
+
+size_t QueryCache::entrySize(const Entry &entry) {
+    // Key is stored twice: in the entry and in the index
+    return sizeof(Entry) + 2 * entry.key.capacity() + entry.ids.capacity() * sizeof(int);
+}
+
+void QueryCache::erase(Shard &shard, EntryIter entry) {
+    shard.memoryBytes -= entrySize(*entry);
+    shard.index.erase(entry->key);
+    shard.entries.erase(entry);
+}
@@ -0,0 +1,636 @@
+/**
+ * Reactor implementation
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "reactor.hpp"
+
+using std::unique_lock;
+
+constexpr size_t Reactor::HEADER_SIZE;
+constexpr size_t Reactor::MAX_REQUEST_SIZE;
+constexpr size_t Reactor::MAX_RESPONSE_SIZE;
+constexpr size_t Reactor::READ_BUFFER_SIZE;
+constexpr uint64_t Reactor::MAX_PIPELINED_REQUESTS;
+constexpr size_t Reactor::MAX_PENDING_OUTPUT;
+constexpr size_t Reactor::MAX_SEND_VECTORS;
+constexpr size_t Reactor::MIN_ZEROCOPY_SIZE;
+constexpr int Reactor::MAX_EVENTS;
+constexpr uint64_t Reactor::WAKE_ID;
+constexpr uint64_t Reactor::LISTENER_ID;
+constexpr uint64_t Reactor::FIRST_CONNECTION_ID;
+constexpr unsigned Reactor::URING_ENTRIES;
+constexpr unsigned Reactor::OPERATION_BITS;
+
+Reactor::Reactor(RequestHandler &&handler, size_t maxConnections):
+    handler{ std::move(handler) },
+    maxConnections{ maxConnections },
+    stopping{ false },
+    nextConnectionId{ FIRST_CONNECTION_ID },
+    connectionsCount{ 0 },
+    rejectedCount{ 0 },
+    ring{ nullptr },
+    ringOperations{ 0 },
+    multishotAccept{ true },
+    wakeValue{ 0 }
+{
+    if((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        throw string{ "Epoll creation failed" };
+    }
+
+    if((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        close(epollFd);
+        throw string{ "Event descriptor creation failed" };
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_ID;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0) {
+        close(wakeFd);
+        close(epollFd);
+        throw string{ "Epoll registration failed" };
+    }
+}
+
+Reactor::~Reactor() {
+    for(auto &connection : connections) {
+        close(connection.second->fd);
+    }
+    for(auto listenFd : listeners) {
+        close(listenFd);
+    }
+    close(wakeFd);
+    close(epollFd);
+}
+
+void Reactor::addListener(int listenFd) {
+    if(fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK) < 0) {
+        throw string{ "Setting non-blocking mode failed" };
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTENER_ID + listeners.size();
+    listeners.push_back(listenFd);
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) < 0) {
+        throw string{ "Epoll registration failed" };
+    }
+}
+
+void Reactor::run() {
+    if(IoUring::isEnabled()) {
+        runUring();
+    } else {
+        runEpoll();
+    }
+}
+
+void Reactor::runEpoll() {
+    epoll_event events[MAX_EVENTS];
+    while(!stopping.load()) {
+        auto count = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if(count < 0) {
+            if(errno == EINTR) continue;
+            throw string{ "Epoll wait failed" };
+        }
+
+        for(int idx = 0; idx < count; ++idx) {
+            auto id = events[idx].data.u64;
+            if(id == WAKE_ID) {
+                uint64_t value;
+                while(read(wakeFd, &value, sizeof(value)) > 0) {}
+                processCompletions();
+                continue;
+            }
+
+            if(id < LISTENER_ID + listeners.size()) {
+                acceptConnections(listeners[id - LISTENER_ID]);
+                continue;
+            }
+
+            // Connection may be closed by an earlier event of this round
+            auto found = connections.find(id);
+            if(found == connections.end()) {
+                continue;
+            }
+
+            auto &connection = *found->second;
+            auto ready = events[idx].events;
+            // Zero-copy send completions are queued as socket errors
+            if(ready & EPOLLERR && connection.zerocopySends && readErrorQueue(connection)) {
+                ready &= ~EPOLLERR;
+            }
+            if(ready & (EPOLLERR | EPOLLHUP) && !(ready & EPOLLIN)) {
+                closeConnection(id);
+                continue;
+            }
+            if(ready & EPOLLOUT && !writeConnection(id, connection)) {
+                continue;
+            }
+            if(ready & (EPOLLIN | EPOLLRDHUP) && !readConnection(id, connection)) {
+                continue;
+            }
+            resume(id, connection);
+        }
+    }
+}
+
+void Reactor::runUring() {
+    IoUring uring{ URING_ENTRIES };
+    ring = &uring;
+
+    for(size_t idx = 0; idx < listeners.size(); ++idx) {
+        submitOperation(LISTENER_ID + idx, Operation::ACCEPT);
+    }
+    submitOperation(WAKE_ID, Operation::WAKE);
+
+    while(!stopping.load()) {
+        // Operations queued while handling completions are submitted together
+        uring.submit(1);
+        uring.complete([this](const io_uring_cqe &cqe) { handleCompletion(cqe); });
+    }
+
+    // Buffers of pending operations are released only after the operations complete
+    submitOperation(WAKE_ID, Operation::CANCEL);
+    while(ringOperations) {
+        uring.submit(1);
+        uring.complete([this](const io_uring_cqe &cqe) { handleCompletion(cqe); });
+    }
+    ring = nullptr;
+}
+
+void Reactor::handleCompletion(const io_uring_cqe &cqe) {
+    if(!(cqe.flags & IORING_CQE_F_MORE)) {
+        --ringOperations;
+    }
+
+    auto id = cqe.user_data >> OPERATION_BITS;
+    auto operation = static_cast<Operation>(cqe.user_data & ((1u << OPERATION_BITS) - 1));
+    if(stopping.load()) {
+        // Connections are closed by the destructor
+        if(operation == Operation::ACCEPT && cqe.res >= 0) {
+            close(cqe.res);
+        }
+        return;
+    }
+
+    if(operation == Operation::WAKE) {
+        processCompletions();
+        submitOperation(WAKE_ID, Operation::WAKE);
+        return;
+    }
+
+    if(operation == Operation::ACCEPT) {
+        if(cqe.res >= 0) {
+            addConnection(cqe.res);
+        } else if(cqe.res == -EINVAL && multishotAccept) {
+            // Kernel doesn't support multishot accept
+            multishotAccept = false;
+        }
+        if(!(cqe.flags & IORING_CQE_F_MORE)) {
+            submitOperation(id, Operation::ACCEPT);
+        }
+        return;
+    }
+
+    // A connection has at most one receive and one send in flight and is released
+    // only once both completed, so the kernel never accesses a released buffer
+    auto found = connections.find(id);
+    if(found == connections.end() || operation == Operation::CANCEL) {
+        return;
+    }
+
+    auto &connection = *found->second;
+    if(operation == Operation::RECV) {
+        connection.recvPending = false;
+    } else {
+        connection.sendPending = false;
+    }
+    if(connection.closing) {
+        closeConnection(id);
+        return;
+    }
+
+    if(cqe.res == -EINTR || cqe.res == -EAGAIN) {
+        submitOperation(id, operation);
+        return;
+    }
+    if(cqe.res < 0) {
+        closeConnection(id);
+        return;
+    }
+
+    if(operation == Operation::RECV) {
+        if(cqe.res == 0) {
+            // Client shut its side down, responses to its requests are still sent
+            connection.readClosed = true;
+        }
+        connection.inputSize += cqe.res;
+    } else {
+        connection.output.consume(cqe.res);
+    }
+    resume(id, connection);
+}
+
+void Reactor::submitOperation(uint64_t id, Operation operation) {
+    auto tag = id << OPERATION_BITS | static_cast<uint64_t>(operation);
+    switch(operation) {
+    case Operation::WAKE:
+        ring->prepareRead(wakeFd, &wakeValue, sizeof(wakeValue), static_cast<uint64_t>(-1), tag);
+        break;
+    case Operation::ACCEPT:
+        ring->prepareAccept(listeners[id - LISTENER_ID], tag, multishotAccept);
+        break;
+    case Operation::RECV: {
+        auto &connection = *connections[id];
+        connection.recvPending = true;
+        ring->prepareRecv(connection.fd, &connection.input[connection.inputSize],
+            connection.input.size() - connection.inputSize, tag);
+        break;
+    }
+    case Operation::SEND: {
+        auto &connection = *connections[id];
+        connection.output.append(std::move(connection.pendingOutput));
+        connection.sendPending = true;
+        connection.sendMessage = msghdr{};
+        connection.sendMessage.msg_iov = connection.sendVectors;
+        connection.sendMessage.msg_iovlen = connection.output.prepare(connection.sendVectors, MAX_SEND_VECTORS);
+        ring->prepareSendmsg(connection.fd, &connection.sendMessage, tag);
+        break;
+    }
+    case Operation::CANCEL:
+        ring->prepareCancelAll(tag);
+        break;
+    }
+    ++ringOperations;
+}
+
+void Reactor::stop() {
+    stopping.store(true);
+    wake();
+}
+
+size_t Reactor::getConnections() const {
+    return connectionsCount.load();
+}
+
+size_t Reactor::getRejectedConnections() const {
+    return rejectedCount.load();
+}
+
+void Reactor::acceptConnections(int listenFd) {
+    while(true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            // EAGAIN: no more pending connections. Other errors (e.g. out of
+            // descriptors) are retried on the next readiness notification
+            return;
+        }
+
+        addConnection(fd);
+    }
+}
+
+void Reactor::addConnection(int fd) {
+    // Connections beyond the limit are closed at once, the client may retry
+    if(connections.size() >= maxConnections) {
+        rejectedCount.fetch_add(1);
+        close(fd);
+        return;
+    }
+
+    auto id = nextConnectionId++;
+    unique_ptr<Connection> connection{ new Connection{} };
+    connection->fd = fd;
+    connection->input.resize(READ_BUFFER_SIZE);
+
+    // Responses are written as soon as they are ready, pipelined ones must not wait
+    // for the acknowledgement of the previous (the client delays it)
+    int enable{ 1 };
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    if(!ring) {
+        connection->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+
+        connection->events = EPOLLIN | EPOLLRDHUP;
+        epoll_event event{};
+        event.events = connection->events;
+        event.data.u64 = id;
+        if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            return;
+        }
+    }
+
+    connections.emplace(id, std::move(connection));
+    connectionsCount.store(connections.size());
+    if(ring) {
+        submitOperation(id, Operation::RECV);
+    }
+}
+
+bool Reactor::canDispatch(const Connection &connection) {
+    return connection.nextSequence - connection.sendSequence < MAX_PIPELINED_REQUESTS &&
+           connection.output.size() + connection.pendingOutput.size() < MAX_PENDING_OUTPUT;
+}
+
+bool Reactor::canRead(const Connection &connection) {
+    return !connection.readClosed && !connection.closing && canDispatch(connection);
+}
+
+bool Reactor::hasOutput(const Connection &connection) {
+    return !connection.output.empty() || !connection.pendingOutput.empty();
+}
+
+size_t Reactor::parseLength(const char *header) {
+    size_t length = WireProtocol::decodeFrameLength(header);
+    return length <= MAX_REQUEST_SIZE ? length : 0;
+}
+
+bool Reactor::parseInput(uint64_t id, Connection &connection) {
+    size_t pos{ 0 };
+    while(canDispatch(connection) && connection.inputSize - pos >= HEADER_SIZE) {
+        auto length = parseLength(&connection.input[pos]);
+        if(!length) {
+            closeConnection(id);
+            return false;
+        }
+        if(connection.inputSize - pos - HEADER_SIZE < length) {
+            break;
+        }
+
+        dispatchRequest(id, connection, string_ref{ &connection.input[pos + HEADER_SIZE], length });
+        pos += HEADER_SIZE + length;
+    }
+
+    if(pos) {
+        std::memmove(&connection.input[0], &connection.input[pos], connection.inputSize - pos);
+        connection.inputSize -= pos;
+    }
+
+    if(connection.inputSize >= HEADER_SIZE) {
+        // Request larger than the buffer: the buffer grows to fit it
+        auto length = parseLength(&connection.input[0]);
+        if(!length) {
+            closeConnection(id);
+            return false;
+        }
+        if(HEADER_SIZE + length > connection.input.size()) {
+            connection.input.resize(HEADER_SIZE + length);
+        }
+    } else if(connection.input.size() > READ_BUFFER_SIZE) {
+        string{ connection.input, 0, READ_BUFFER_SIZE }.swap(connection.input);
+    }
+    return true;
+}
+
+void Reactor::flushReady(Connection &connection) {
+    auto next = connection.ready.begin();
+    while(next != connection.ready.end() && next->first == connection.sendSequence) {
+        char header[HEADER_SIZE];
+        WireProtocol::encodeFrameLength(header, static_cast<uint32_t>(next->second.size()));
+        connection.pendingOutput.append(header, HEADER_SIZE);
+        connection.pendingOutput.append(std::move(next->second));
+        ++connection.sendSequence;
+        next = connection.ready.erase(next);
+    }
+}
+
+void Reactor::resume(uint64_t id, Connection &connection) {
+    if(connection.closing) {
+        return;
+    }
+
+    // Requests left in the buffer while dispatching was paused. The buffer is not
+    // touched while the kernel receives into it
+    if(!connection.recvPending && !parseInput(id, connection)) {
+        return;
+    }
+
+    if(ring) {
+        if(!connection.sendPending && hasOutput(connection)) {
+            submitOperation(id, Operation::SEND);
+        }
+        if(!connection.recvPending && canRead(connection)) {
+            submitOperation(id, Operation::RECV);
+        }
+    } else {
+        if(!connection.writeBlocked && hasOutput(connection) && !writeConnection(id, connection)) {
+            return;
+        }
+        if(!watch(id, connection, (canRead(connection) ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u) |
+                                  (connection.writeBlocked ? static_cast<uint32_t>(EPOLLOUT) : 0u))) {
+            return;
+        }
+    }
+
+    if(connection.readClosed && connection.nextSequence == connection.sendSequence &&
+       !hasOutput(connection) && !connection.sendPending) {
+        closeConnection(id);
+    }
+}
+
+bool Reactor::readConnection(uint64_t id, Connection &connection) {
+    while(canRead(connection)) {
+        auto readCount = read(connection.fd, &connection.input[connection.inputSize],
+            connection.input.size() - connection.inputSize);
+        if(readCount < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            closeConnection(id);
+            return false;
+        }
+        if(readCount == 0) {
+            // Client shut its side down, responses to its requests are still sent
+            connection.readClosed = true;
+            return true;
+        }
+
+        connection.inputSize += readCount;
+        if(!parseInput(id, connection)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Reactor::writeConnection(uint64_t id, Connection &connection) {
+    connection.writeBlocked = false;
+    connection.output.append(std::move(connection.pendingOutput));
+
+    auto zerocopy = connection.zerocopy;
+    while(!connection.output.empty()) {
+        iovec vectors[MAX_SEND_VECTORS];
+        msghdr message{};
+        message.msg_iov = vectors;
+        message.msg_iovlen = connection.output.prepare(vectors, MAX_SEND_VECTORS);
+
+        auto zerocopySend = zerocopy && connection.output.size() >= MIN_ZEROCOPY_SIZE;
+        auto writeCount = sendmsg(connection.fd, &message, MSG_NOSIGNAL | (zerocopySend ? MSG_ZEROCOPY : 0));
+        if(writeCount < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                connection.writeBlocked = true;
+                return true;
+            }
+            if(errno == ENOBUFS && zerocopySend) {
+                // Too many zero-copy sends in flight, the data is copied instead
+                zerocopy = false;
+                continue;
+            }
+            closeConnection(id);
+            return false;
+        }
+
+        if(zerocopySend) {
+            connection.output.consumeZerocopy(writeCount, connection.zerocopySends++);
+        } else {
+            connection.output.consume(writeCount);
+        }
+    }
+    return true;
+}
+
+bool Reactor::readErrorQueue(Connection &connection) {
+    auto notified = false;
+    while(true) {
+        char control[CMSG_SPACE(sizeof(sock_extended_err)) * 4];
+        msghdr message{};
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if(recvmsg(connection.fd, &message, MSG_ERRQUEUE) < 0) {
+            if(errno == EINTR) continue;
+            // EAGAIN: the queue is drained
+            return notified;
+        }
+
+        for(auto header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if(!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) &&
+               !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            sock_extended_err error;
+            std::memcpy(&error, CMSG_DATA(header), sizeof(error));
+            if(error.ee_errno == 0 && error.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                // Sends [ee_info, ee_data] completed
+                connection.output.release(error.ee_data);
+                notified = true;
+                if(error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    // Kernel had to copy the data anyway (e.g. loopback), plain sends are cheaper
+                    connection.zerocopy = false;
+                }
+            }
+        }
+    }
+}
+
+void Reactor::dispatchRequest(uint64_t id, Connection &connection, string_ref request) {
+    auto sequence = connection.nextSequence++;
+    try {
+        handler(request, [this, id, sequence](OutputBuffer &&response) {
+            if(response.size() > MAX_RESPONSE_SIZE) {
+                std::cerr << "Response is too large" << std::endl;
+                response = OutputBuffer{};
+            }
+            complete(id, sequence, std::move(response));
+        });
+    } catch(const string& ex) {
+        std::cerr << ex << std::endl;
+        complete(id, sequence, {});
+    } catch(...) {
+        std::cerr << "Unexpected exception in Process Request" << std::endl;
+        complete(id, sequence, {});
+    }
+}
+
+void Reactor::complete(uint64_t id, uint64_t sequence, OutputBuffer &&response) {
+    unique_lock<mutex> completionsLock{ completionsMutex };
+    completions.push_back(Completion{ id, sequence, std::move(response) });
+    completionsLock.unlock();
+    wake();
+}
+
+void Reactor::processCompletions() {
+    vector<Completion> ready;
+    unique_lock<mutex> completionsLock{ completionsMutex };
+    ready.swap(completions);
+    completionsLock.unlock();
+
+    for(auto &completion : ready) {
+        auto found = connections.find(completion.id);
+        if(found != connections.end()) {
+            found->second->ready.emplace(completion.sequence, std::move(completion.response));
+        }
+    }
+
+    // Every connection is resumed once all its responses of the batch are queued
+    for(const auto &completion : ready) {
+        auto found = connections.find(completion.id);
+        if(found == connections.end()) {
+            continue;
+        }
+
+        auto &connection = *found->second;
+        if(!connection.ready.empty() && connection.ready.begin()->first == connection.sendSequence) {
+            flushReady(connection);
+            resume(completion.id, connection);
+        }
+    }
+}
+
+bool Reactor::watch(uint64_t id, Connection &connection, uint32_t events) {
+    if(events == connection.events) {
+        return true;
+    }
+
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    if(epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event) < 0) {
+        // The connection can't be served any more, other connections of the reactor are kept
+        closeConnection(id);
+        return false;
+    }
+    connection.events = events;
+    return true;
+}
+
+void Reactor::closeConnection(uint64_t id) {
+    auto found = connections.find(id);
+    if(found == connections.end()) {
+        return;
+    }
+
+    auto &connection = *found->second;
+    if(connection.recvPending || connection.sendPending) {
+        // Pending operations complete at once on a shut down socket
+        if(!connection.closing) {
+            connection.closing = true;
+            shutdown(connection.fd, SHUT_RDWR);
+        }
+        return;
+    }
+
+    // Closing the descriptor removes it from the epoll set
+    close(connection.fd);
+    connections.erase(found);
+    connectionsCount.store(connections.size());
+}
+
+void Reactor::wake() {
+    uint64_t value{ 1 };
+    while(write(wakeFd, &value, sizeof(value)) < 0 && errno == EINTR) {}
+}
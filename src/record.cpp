@@ -5,8 +5,7 @@
 #include "record.hpp"
 
 void Record::addTag(string &&tag) {
-    if(!tagged(tag)) {
-        tags.push_back(std::move(tag));
+    if(tags.insert(TagDictionary::instance().intern(tag))) {
         mdate = boost::gregorian::day_clock::local_day();
     }
 }
@@ -25,7 +24,10 @@ bool Record::containsText(const string &text) const {
 }
 
 void Record::deleteTag(const string &tag) {
-    tags.erase(std::remove(tags.begin(), tags.end(), tag), tags.end());
+    TagId id;
+    if(TagDictionary::instance().find(tag, id)) {
+        tags.erase(id);
+    }
     mdate = boost::gregorian::day_clock::local_day();
 }
 
@@ -45,7 +47,18 @@ string Record::getModificationDateStr() const {
     return boost::gregorian::to_simple_string(mdate);
 }
 
-const vector<string>& Record::getTags() const {
+vector<string> Record::getTags() const {
+    auto &dictionary = TagDictionary::instance();
+    vector<string> tagNames;
+    tagNames.reserve(tags.size());
+    for(auto id : tags) {
+        tagNames.push_back(dictionary.name(id));
+    }
+
+    return tagNames;
+}
+
+const TagSet& Record::getTagIds() const {
     return tags;
 }
 
@@ -71,8 +84,6 @@ void Record::setText(string &&newText) {
 }
 
 bool Record::tagged(const vector<string> &tags) const {
-    if(this->tags.size() < tags.size()) return false;
-
     for(const auto &tag : tags) {
         if(!tagged(tag)) return false;
     }
@@ -81,7 +92,22 @@ bool Record::tagged(const vector<string> &tags) const {
 }
 
 bool Record::tagged(const string &tag) const {
-    return std::find(tags.begin(), tags.end(), tag) != tags.end();
+    TagId id;
+    return TagDictionary::instance().find(tag, id) && tags.contains(id);
+}
+
+bool Record::tagged(TagId tag) const {
+    return tags.contains(tag);
+}
+
+TagSet Record::internTags(const vector<string> &tags) {
+    auto &dictionary = TagDictionary::instance();
+    TagSet ids;
+    for(const auto &tag : tags) {
+        ids.insert(dictionary.intern(tag));
+    }
+
+    return ids;
 }
 
 int Record::getId() const {
@@ -0,0 +1,112 @@
+/**
+ * RecordQuery implementation
+ */
+
+#include <sstream>
+#include "record_query.hpp"
+
+using boost::gregorian::date;
+
+namespace {
+    /**
+     * Append sorted list of unique tags to the key stream
+     */
+    void appendTags(std::ostringstream &key, vector<string> tags) {
+        std::sort(tags.begin(), tags.end());
+        tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+        for(const auto &tag : tags) {
+            key << tag.size() << ':' << tag;
+        }
+        key << '|';
+    }
+
+    /**
+     * Append date bound to the key stream
+     */
+    void appendDate(std::ostringstream &key, const date &bound) {
+        if(!bound.is_not_a_date()) {
+            key << boost::gregorian::to_iso_string(bound);
+        }
+        key << '|';
+    }
+}
+
+bool RecordQuery::matches(const Record &record) const {
+    return QueryMatcher{ *this }.matches(record);
+}
+
+string RecordQuery::key() const {
+    std::ostringstream key;
+    key << (deleted ? 'D' : 'L') << '|';
+    appendTags(key, allTags);
+    appendTags(key, anyTags);
+    appendDate(key, cdateAfter);
+    appendDate(key, cdateBefore);
+    appendDate(key, mdateAfter);
+    appendDate(key, mdateBefore);
+    key << boost::algorithm::to_lower_copy(fragment);
+    return key.str();
+}
+
+QueryMatcher::QueryMatcher(const RecordQuery &query): query{ query }, unsatisfiable{ false } {
+    auto &dictionary = TagDictionary::instance();
+    TagId id;
+
+    for(const auto &tag : query.allTags) {
+        if(dictionary.find(tag, id)) {
+            allTags.insert(id);
+        } else {
+            unsatisfiable = true;
+        }
+    }
+
+    for(const auto &tag : query.anyTags) {
+        if(dictionary.find(tag, id)) {
+            anyTags.push_back(id);
+        }
+    }
+
+    if(!query.anyTags.empty() && anyTags.empty()) {
+        unsatisfiable = true;
+    }
+}
+
+bool QueryMatcher::matches(const Record &record) const {
+    if(unsatisfiable || record.isDeleted() != query.deleted) return false;
+
+    const auto &tags = record.getTagIds();
+    if(!tags.containsAll(allTags)) return false;
+
+    if(!anyTags.empty()) {
+        auto tagged = std::any_of(anyTags.begin(), anyTags.end(),
+            [&tags](TagId tag){return tags.contains(tag);});
+        if(!tagged) return false;
+    }
+
+    const auto &cdate = record.getCreationDate();
+    const auto &mdate = record.getModificationDate();
+    if(!query.cdateBefore.is_not_a_date() && !(cdate < query.cdateBefore)) return false;
+    if(!query.cdateAfter.is_not_a_date() && cdate < query.cdateAfter) return false;
+    if(!query.mdateBefore.is_not_a_date() && !(mdate < query.mdateBefore)) return false;
+    if(!query.mdateAfter.is_not_a_date() && mdate < query.mdateAfter) return false;
+
+    if(!query.fragment.empty() && !record.containsText(query.fragment)) return false;
+
+    return true;
+}
+
+const RecordQuery& QueryMatcher::getQuery() const {
+    return query;
+}
+
+bool QueryMatcher::isUnsatisfiable() const {
+    return unsatisfiable;
+}
+
+const TagSet& QueryMatcher::getAllTags() const {
+    return allTags;
+}
+
+const vector<TagId>& QueryMatcher::getAnyTags() const {
+    return anyTags;
+}
@@ -0,0 +1,783 @@
+/**
+ * RecordStore implementation
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include "record_store.hpp"
+#include "thread_pool.hpp"
+
+using boost::gregorian::date;
+using boost::gregorian::gregorian_calendar;
+
+constexpr size_t RecordStore::WORD_BITS;
+constexpr size_t RecordStore::SEGMENT_SIZE;
+constexpr size_t RecordStore::SEGMENT_WORDS;
+constexpr size_t RecordStore::SCAN_GRAIN;
+constexpr size_t RecordStore::CHANGE_GRAIN;
+
+using std::lock_guard;
+
+namespace {
+    /**
+     * Convert day number into date
+     */
+    date toDate(uint32_t day) {
+        auto ymd = gregorian_calendar::from_day_number(day);
+        return { ymd.year, ymd.month, ymd.day };
+    }
+
+    /**
+     * Convert optional date bound into day number
+     */
+    uint32_t toDay(const date &bound, uint32_t unlimited) {
+        return bound.is_not_a_date() ? unlimited : bound.day_number();
+    }
+}
+
+size_t RecordStore::Snapshot::size() const {
+    return count;
+}
+
+uint64_t RecordStore::Snapshot::getGeneration() const {
+    return generation;
+}
+
+bool RecordStore::Snapshot::find(int id, size_t &row) const {
+    // Ids are ascending across segments: pick the last segment starting not after the Id
+    auto segmentIter = std::upper_bound(segments.begin(), segments.end(), id,
+        [](int id, const shared_ptr<Segment> &segment){return id < segment->ids[0];});
+    if(count == 0 || segmentIter == segments.begin()) {
+        return false;
+    }
+
+    auto segment = segmentIter - segments.begin() - 1;
+    const auto &ids = segments[segment]->ids;
+    auto rows = segmentRows(segment);
+    auto idIter = std::lower_bound(ids, ids + rows, id);
+    if(idIter == ids + rows || *idIter != id) {
+        return false;
+    }
+
+    row = segment * SEGMENT_SIZE + (idIter - ids);
+    return true;
+}
+
+Record RecordStore::Snapshot::get(size_t row, bool withText) const {
+    const auto &segment = *segments[row / SEGMENT_SIZE];
+    auto i = row % SEGMENT_SIZE;
+
+    TagSet tags;
+    std::for_each(segment.tagIds[i], segment.tagIds[i] + segment.tagCounts[i],
+        [&tags](TagId id){tags.insert(id);});
+
+    auto deleted = segment.deletedBits[i / WORD_BITS].load(std::memory_order_relaxed) >> (i % WORD_BITS) & 1;
+    return {
+        segment.ids[i],
+        withText ? string{ segment.texts[i], segment.textLengths[i] } : string{},
+        std::move(tags),
+        toDate(segment.cdays[i]),
+        toDate(segment.mdays[i]),
+        deleted != 0
+    };
+}
+
+int RecordStore::Snapshot::getId(size_t row) const {
+    return segments[row / SEGMENT_SIZE]->ids[row % SEGMENT_SIZE];
+}
+
+string_ref RecordStore::Snapshot::getText(size_t row) const {
+    const auto &segment = *segments[row / SEGMENT_SIZE];
+    auto i = row % SEGMENT_SIZE;
+    return { segment.texts[i], segment.textLengths[i] };
+}
+
+vector<size_t> RecordStore::Snapshot::select(const QueryMatcher &matcher) const {
+    vector<size_t> rowsFound;
+    if(matcher.isUnsatisfiable()) {
+        return rowsFound;
+    }
+
+    auto fragment = boost::algorithm::to_lower_copy(matcher.getQuery().fragment);
+    if(segments.size() <= SCAN_GRAIN) {
+        for(size_t segment = 0; segment < segments.size(); ++segment) {
+            selectSegment(segment, matcher, fragment, rowsFound);
+        }
+        return rowsFound;
+    }
+
+    // Large snapshots are scanned by several workers, results are merged in order
+    vector<vector<size_t>> segmentRowsFound(segments.size());
+    ThreadPool::instance().parallelFor(0, segments.size(), SCAN_GRAIN, [&](size_t begin, size_t end) {
+        for(auto segment = begin; segment < end; ++segment) {
+            selectSegment(segment, matcher, fragment, segmentRowsFound[segment]);
+        }
+    });
+
+    for(const auto &found : segmentRowsFound) {
+        rowsFound.insert(rowsFound.end(), found.begin(), found.end());
+    }
+    return rowsFound;
+}
+
+void RecordStore::Snapshot::selectSegment(size_t segmentIdx, const QueryMatcher &matcher,
+    const string &fragment, vector<size_t> &rowsFound) const {
+    const auto &query = matcher.getQuery();
+    constexpr auto unlimited = std::numeric_limits<uint32_t>::max();
+    const auto &segment = *segments[segmentIdx];
+    const auto rows = segmentRows(segmentIdx);
+    const auto words = (rows + WORD_BITS - 1) / WORD_BITS;
+
+    // Start with all records in required deleted state
+    uint64_t selected[SEGMENT_WORDS];
+    for(size_t word = 0; word < words; ++word) {
+        selected[word] = segment.deletedBits[word].load(std::memory_order_relaxed);
+        if(!query.deleted) selected[word] = ~selected[word];
+    }
+    if(rows % WORD_BITS) {
+        selected[words - 1] &= (uint64_t{ 1 } << (rows % WORD_BITS)) - 1;
+    }
+
+    if(!query.cdateAfter.is_not_a_date() || !query.cdateBefore.is_not_a_date()) {
+        filterDays(segment.cdays, rows, toDay(query.cdateAfter, 0), toDay(query.cdateBefore, unlimited),
+            selected);
+    }
+
+    if(!query.mdateAfter.is_not_a_date() || !query.mdateBefore.is_not_a_date()) {
+        filterDays(segment.mdays, rows, toDay(query.mdateAfter, 0), toDay(query.mdateBefore, unlimited),
+            selected);
+    }
+
+    // Remaining conditions are checked for the candidates only
+    for(size_t word = 0; word < words; ++word) {
+        for(auto bits = selected[word]; bits; bits &= bits - 1) {
+            auto row = word * WORD_BITS + __builtin_ctzll(bits);
+            if(tagsMatch(segment, row, matcher) && (fragment.empty() || textMatches(segment, row, fragment))) {
+                rowsFound.push_back(segmentIdx * SEGMENT_SIZE + row);
+            }
+        }
+    }
+}
+
+size_t RecordStore::Snapshot::segmentRows(size_t segment) const {
+    return std::min(SEGMENT_SIZE, count - segment * SEGMENT_SIZE);
+}
+
+void RecordStore::Snapshot::filterDays(const uint32_t *days, size_t rows, uint32_t from, uint32_t to,
+    uint64_t *selected) {
+    // from <= day < to is checked as a single unsigned comparison
+    const uint32_t range = to - from;
+    const auto fullWords = rows / WORD_BITS;
+
+    for(size_t word = 0; word < fullWords; ++word) {
+        const auto *wordDays = days + word * WORD_BITS;
+        uint64_t inRange = 0;
+        for(size_t bit = 0; bit < WORD_BITS; ++bit) {
+            inRange |= uint64_t{ wordDays[bit] - from < range } << bit;
+        }
+        selected[word] &= inRange;
+    }
+
+    if(rows % WORD_BITS) {
+        uint64_t inRange = 0;
+        for(auto row = fullWords * WORD_BITS; row < rows; ++row) {
+            inRange |= uint64_t{ days[row] - from < range } << (row % WORD_BITS);
+        }
+        selected[fullWords] &= inRange;
+    }
+}
+
+bool RecordStore::Snapshot::tagsMatch(const Segment &segment, size_t row, const QueryMatcher &matcher) {
+    auto first = segment.tagIds[row];
+    auto last = first + segment.tagCounts[row];
+
+    const auto &allTags = matcher.getAllTags();
+    if(!std::includes(first, last, allTags.begin(), allTags.end())) {
+        return false;
+    }
+
+    const auto &anyTags = matcher.getAnyTags();
+    return anyTags.empty() || std::any_of(anyTags.begin(), anyTags.end(),
+        [first, last](TagId id){return std::binary_search(first, last, id);});
+}
+
+bool RecordStore::Snapshot::textMatches(const Segment &segment, size_t row, const string &fragment) {
+    auto first = segment.texts[row];
+    auto last = first + segment.textLengths[row];
+
+    return std::search(first, last, fragment.begin(), fragment.end(), [](char textChar, char fragmentChar) {
+        return std::tolower(static_cast<unsigned char>(textChar)) == fragmentChar;
+    }) != last;
+}
+
+size_t RecordStore::Selection::getTextSize() const {
+    size_t size{ 0 };
+    for(auto row : rows) {
+        size += view->getText(row).size();
+    }
+    return size;
+}
+
+vector<Record> RecordStore::Selection::getRecords() const {
+    vector<Record> records;
+    records.reserve(rows.size());
+    for(auto row : rows) {
+        records.push_back(view->get(row));
+    }
+    return records;
+}
+
+shared_ptr<const RecordStore::TextLease> RecordStore::Selection::leaseText(size_t minSize) const {
+    vector<const char*> texts;
+    for(auto row : rows) {
+        auto text = view->getText(row);
+        if(!text.empty() && text.size() >= minSize) {
+            texts.push_back(text.data());
+        }
+    }
+    // Snapshot is pinned, so the texts are registered before they could be freed
+    return std::make_shared<TextLease>(view.getStore(), std::move(texts));
+}
+
+RecordStore::TextLease::TextLease(const RecordStore &store, vector<const char*> &&texts):
+    store{ store },
+    texts{ std::move(texts) }
+{
+    auto &leases = store.leases;
+    lock_guard<mutex> leasesLock{ leases.leasesMutex };
+    for(auto text : this->texts) {
+        ++leases.leased[text];
+    }
+    leases.count.fetch_add(this->texts.size());
+}
+
+RecordStore::TextLease::~TextLease() {
+    auto &leases = store.leases;
+    lock_guard<mutex> leasesLock{ leases.leasesMutex };
+    for(auto text : texts) {
+        auto found = leases.leased.find(text);
+        if(--found->second) {
+            continue;
+        }
+        leases.leased.erase(found);
+
+        // Text replaced while it was leased is handed over to the writer
+        auto retired = leases.retired.find(text);
+        if(retired != leases.retired.end()) {
+            leases.released.emplace_back(const_cast<char*>(text), retired->second);
+            leases.retired.erase(retired);
+        }
+    }
+    leases.count.fetch_sub(texts.size());
+}
+
+RecordStore::RecordStore(): published{ new Snapshot{ 0 } } {}
+
+RecordStore::~RecordStore() {
+    delete published.load();
+}
+
+RecordStore::View RecordStore::read() const {
+    // Epoch is pinned before the snapshot is loaded, so the snapshot can't be reclaimed
+    auto guard = epochs.pin();
+    return { std::move(guard), published.load(), this };
+}
+
+void RecordStore::publish() {
+    if(draft) {
+        auto *previous = published.exchange(draft.release());
+        auto blocks = std::make_shared<vector<pair<char*, size_t>>>(std::move(retiredBlocks));
+        retiredBlocks.clear();
+        draftBlocks.clear();
+
+        epochs.retire([this, previous, blocks]() {
+            // Segments no longer used by any version are released with the snapshot
+            delete previous;
+            freeBlocks(*blocks);
+        });
+    }
+
+    epochs.collect();
+
+    // Replaced text whose leases were released since the last publish
+    vector<pair<char*, size_t>> released;
+    {
+        lock_guard<mutex> leasesLock{ leases.leasesMutex };
+        released.swap(leases.released);
+    }
+    for(const auto &block : released) {
+        arena.deallocate(block.first, block.second);
+    }
+}
+
+void RecordStore::discard() {
+    draft.reset();
+    // Blocks stored and replaced within the draft are listed in both lists
+    for(const auto &block : draftBlocks) {
+        arena.deallocate(block.first, block.second);
+    }
+    draftBlocks.clear();
+    retiredBlocks.clear();
+}
+
+size_t RecordStore::size() const {
+    return latest().size();
+}
+
+void RecordStore::append(const Record &record) {
+    const auto &tags = record.getTagIds();
+    const auto &text = record.getText();
+
+    appendRow({
+        record.getId(),
+        record.getCreationDate().day_number(),
+        record.getModificationDate().day_number(),
+        record.isDeleted(),
+        storeTags(tags),
+        static_cast<uint32_t>(tags.size()),
+        storeText(text),
+        static_cast<uint32_t>(text.size())
+    });
+}
+
+void RecordStore::reserve(size_t size) {
+    edit().segments.reserve((size + SEGMENT_SIZE - 1) / SEGMENT_SIZE);
+}
+
+bool RecordStore::find(int id, size_t &row) const {
+    return latest().find(id, row);
+}
+
+Record RecordStore::get(size_t row) const {
+    return latest().get(row);
+}
+
+int RecordStore::getId(size_t row) const {
+    return latest().getId(row);
+}
+
+vector<size_t> RecordStore::select(const QueryMatcher &matcher) const {
+    return latest().select(matcher);
+}
+
+string_ref RecordStore::getText(size_t row) const {
+    auto current = readRow(row);
+    return { current.text, current.textLength };
+}
+
+void RecordStore::setId(size_t row, int id) {
+    editSegment(row / SEGMENT_SIZE).ids[row % SEGMENT_SIZE] = id;
+}
+
+void RecordStore::update(size_t row, const Record &record) {
+    auto &segment = editSegment(row / SEGMENT_SIZE);
+    auto i = row % SEGMENT_SIZE;
+
+    segment.cdays[i] = record.getCreationDate().day_number();
+    segment.mdays[i] = record.getModificationDate().day_number();
+    setDeleted(segment, i, record.isDeleted());
+
+    // Most updates change a single field: keep unchanged tags and text blocks
+    const auto &tags = record.getTagIds();
+    if(tags.size() != segment.tagCounts[i] || !std::equal(tags.begin(), tags.end(), segment.tagIds[i])) {
+        retire(reinterpret_cast<char*>(segment.tagIds[i]), segment.tagCounts[i] * sizeof(TagId));
+        segment.tagIds[i] = storeTags(tags);
+        segment.tagCounts[i] = tags.size();
+    }
+
+    const auto &text = record.getText();
+    if(text.size() != segment.textLengths[i] || !std::equal(text.begin(), text.end(), segment.texts[i])) {
+        retire(segment.texts[i], segment.textLengths[i]);
+        segment.texts[i] = storeText(text);
+        segment.textLengths[i] = text.size();
+    }
+}
+
+bool RecordStore::addTag(size_t row, TagId tag) {
+    auto current = readRow(row);
+    auto last = current.tagIds + current.tagCount;
+    auto position = std::lower_bound(current.tagIds, last, tag);
+    if(position != last && *position == tag) {
+        return false;
+    }
+
+    auto size = (current.tagCount + 1) * sizeof(TagId);
+    auto block = reinterpret_cast<TagId*>(arena.allocate(size));
+    draftBlocks.emplace_back(reinterpret_cast<char*>(block), size);
+    *std::copy(current.tagIds, position, block) = tag;
+    std::copy(position, last, block + (position - current.tagIds) + 1);
+
+    auto &segment = editSegment(row / SEGMENT_SIZE);
+    auto i = row % SEGMENT_SIZE;
+    retire(reinterpret_cast<char*>(segment.tagIds[i]), segment.tagCounts[i] * sizeof(TagId));
+    segment.tagIds[i] = block;
+    ++segment.tagCounts[i];
+    return true;
+}
+
+bool RecordStore::removeTag(size_t row, TagId tag) {
+    auto current = readRow(row);
+    auto last = current.tagIds + current.tagCount;
+    auto position = std::lower_bound(current.tagIds, last, tag);
+    if(position == last || *position != tag) {
+        return false;
+    }
+
+    auto size = (current.tagCount - 1) * sizeof(TagId);
+    auto block = reinterpret_cast<TagId*>(arena.allocate(size));
+    if(block) {
+        draftBlocks.emplace_back(reinterpret_cast<char*>(block), size);
+        std::copy(position + 1, last, std::copy(current.tagIds, position, block));
+    }
+
+    auto &segment = editSegment(row / SEGMENT_SIZE);
+    auto i = row % SEGMENT_SIZE;
+    retire(reinterpret_cast<char*>(segment.tagIds[i]), segment.tagCounts[i] * sizeof(TagId));
+    segment.tagIds[i] = block;
+    --segment.tagCounts[i];
+    return true;
+}
+
+bool RecordStore::setDeleted(size_t row, bool state) {
+    if(readRow(row).deleted == state) {
+        return false;
+    }
+
+    setDeleted(editSegment(row / SEGMENT_SIZE), row % SEGMENT_SIZE, state);
+    return true;
+}
+
+bool RecordStore::setText(size_t row, const string &text) {
+    auto current = readRow(row);
+    if(text.size() == current.textLength && std::equal(text.begin(), text.end(), current.text)) {
+        return false;
+    }
+
+    auto &segment = editSegment(row / SEGMENT_SIZE);
+    auto i = row % SEGMENT_SIZE;
+    retire(segment.texts[i], segment.textLengths[i]);
+    segment.texts[i] = storeText(text);
+    segment.textLengths[i] = text.size();
+    return true;
+}
+
+void RecordStore::editText(size_t row, const TextDelta &delta) {
+    auto current = readRow(row);
+    auto size = delta.resultSize(current.textLength);
+    auto block = arena.allocate(size);
+    if(block) {
+        draftBlocks.emplace_back(block, size);
+        delta.apply({ current.text, current.textLength }, block);
+    }
+
+    auto &segment = editSegment(row / SEGMENT_SIZE);
+    auto i = row % SEGMENT_SIZE;
+    retire(segment.texts[i], segment.textLengths[i]);
+    segment.texts[i] = block;
+    segment.textLengths[i] = size;
+}
+
+size_t RecordStore::addTag(const vector<size_t> &rows, TagId tag, const boost::gregorian::date &mdate) {
+    auto changed = filterRows(rows, [tag](const Row &row) {
+        return !std::binary_search(row.tagIds, row.tagIds + row.tagCount, tag);
+    });
+
+    // The arena isn't thread safe: blocks are allocated up front
+    vector<TagId*> blocks;
+    blocks.reserve(changed.size());
+    for(auto row : changed) {
+        auto current = readRow(row);
+        auto size = (current.tagCount + 1) * sizeof(TagId);
+        blocks.push_back(reinterpret_cast<TagId*>(arena.allocate(size)));
+        draftBlocks.emplace_back(reinterpret_cast<char*>(blocks.back()), size);
+        retire(reinterpret_cast<char*>(current.tagIds), current.tagCount * sizeof(TagId));
+    }
+
+    auto mday = mdate.day_number();
+    changeRows(changed, [&](size_t idx, Segment &segment, size_t i) {
+        auto first = segment.tagIds[i];
+        auto last = first + segment.tagCounts[i];
+        auto position = std::lower_bound(first, last, tag);
+        *std::copy(first, position, blocks[idx]) = tag;
+        std::copy(position, last, blocks[idx] + (position - first) + 1);
+        segment.tagIds[i] = blocks[idx];
+        ++segment.tagCounts[i];
+        segment.mdays[i] = mday;
+    });
+    return changed.size();
+}
+
+size_t RecordStore::removeTag(const vector<size_t> &rows, TagId tag, const boost::gregorian::date &mdate) {
+    auto changed = filterRows(rows, [tag](const Row &row) {
+        return std::binary_search(row.tagIds, row.tagIds + row.tagCount, tag);
+    });
+
+    vector<TagId*> blocks;
+    blocks.reserve(changed.size());
+    for(auto row : changed) {
+        auto current = readRow(row);
+        auto size = (current.tagCount - 1) * sizeof(TagId);
+        blocks.push_back(reinterpret_cast<TagId*>(arena.allocate(size)));
+        if(blocks.back()) {
+            draftBlocks.emplace_back(reinterpret_cast<char*>(blocks.back()), size);
+        }
+        retire(reinterpret_cast<char*>(current.tagIds), current.tagCount * sizeof(TagId));
+    }
+
+    auto mday = mdate.day_number();
+    changeRows(changed, [&](size_t idx, Segment &segment, size_t i) {
+        auto first = segment.tagIds[i];
+        auto last = first + segment.tagCounts[i];
+        auto position = std::lower_bound(first, last, tag);
+        std::copy(position + 1, last, std::copy(first, position, blocks[idx]));
+        segment.tagIds[i] = blocks[idx];
+        --segment.tagCounts[i];
+        segment.mdays[i] = mday;
+    });
+    return changed.size();
+}
+
+size_t RecordStore::setDeleted(const vector<size_t> &rows, bool state) {
+    auto changed = filterRows(rows, [state](const Row &row) {
+        return row.deleted != state;
+    });
+
+    // Deleted bits are atomic, records sharing a word may be changed concurrently
+    changeRows(changed, [state](size_t, Segment &segment, size_t i) {
+        setDeleted(segment, i, state);
+    });
+    return changed.size();
+}
+
+void RecordStore::setText(const vector<size_t> &rows, const vector<string> &texts,
+    const boost::gregorian::date &mdate) {
+    vector<char*> blocks;
+    blocks.reserve(rows.size());
+    for(size_t idx = 0; idx < rows.size(); ++idx) {
+        auto current = readRow(rows[idx]);
+        blocks.push_back(arena.allocate(texts[idx].size()));
+        if(blocks.back()) {
+            draftBlocks.emplace_back(blocks.back(), texts[idx].size());
+        }
+        retire(current.text, current.textLength);
+    }
+
+    auto mday = mdate.day_number();
+    changeRows(rows, [&](size_t idx, Segment &segment, size_t i) {
+        std::copy(texts[idx].begin(), texts[idx].end(), blocks[idx]);
+        segment.texts[i] = blocks[idx];
+        segment.textLengths[i] = texts[idx].size();
+        segment.mdays[i] = mday;
+    });
+}
+
+void RecordStore::setModificationDate(size_t row, const boost::gregorian::date &mdate) {
+    editSegment(row / SEGMENT_SIZE).mdays[row % SEGMENT_SIZE] = mdate.day_number();
+}
+
+void RecordStore::erase(size_t row) {
+    auto removed = readRow(row);
+    retire(reinterpret_cast<char*>(removed.tagIds), removed.tagCount * sizeof(TagId));
+    retire(removed.text, removed.textLength);
+
+    // Following records are moved by value, their text and tags stay in place
+    vector<Row> following;
+    following.reserve(size() - row - 1);
+    for(auto next = row + 1; next < size(); ++next) {
+        following.push_back(readRow(next));
+    }
+
+    editSegment(row / SEGMENT_SIZE);
+    auto &snapshot = edit();
+    snapshot.segments.resize(row / SEGMENT_SIZE + 1);
+    snapshot.count = row;
+
+    for(const auto &next : following) {
+        appendRow(next);
+    }
+    if(snapshot.segments.size() * SEGMENT_SIZE >= snapshot.count + SEGMENT_SIZE) {
+        snapshot.segments.pop_back();
+    }
+}
+
+void RecordStore::remapTags(const vector<TagId> &mapping, size_t firstRow) {
+    const auto &snapshot = latest();
+    for(auto row = firstRow; row < snapshot.count; ++row) {
+        const auto &segment = *snapshot.segments[row / SEGMENT_SIZE];
+        auto first = segment.tagIds[row % SEGMENT_SIZE];
+        auto last = first + segment.tagCounts[row % SEGMENT_SIZE];
+        std::transform(first, last, first, [&mapping](TagId id) {
+            if(id >= mapping.size()) throw string{ "Unknown tag Id in saved data" };
+            return mapping[id];
+        });
+        std::sort(first, last);
+    }
+}
+
+ArenaStats RecordStore::getArenaStats() const {
+    return arena.getStats();
+}
+
+const RecordStore::Snapshot& RecordStore::latest() const {
+    return draft ? *draft : *published.load();
+}
+
+RecordStore::Snapshot& RecordStore::edit() {
+    if(!draft) {
+        const auto &current = *published.load();
+        draft.reset(new Snapshot{ current.generation + 1 });
+        draft->segments = current.segments;
+        draft->count = current.count;
+    }
+
+    return *draft;
+}
+
+RecordStore::Segment& RecordStore::editSegment(size_t segmentIdx) {
+    auto &snapshot = edit();
+    const auto &current = *published.load();
+    auto &segment = snapshot.segments[segmentIdx];
+
+    if(segmentIdx < current.segments.size() && segment == current.segments[segmentIdx]) {
+        // Readers may scan the segment: copy it
+        shared_ptr<Segment> copy{ new Segment() };
+        auto rows = snapshot.segmentRows(segmentIdx);
+        std::copy(segment->ids, segment->ids + rows, copy->ids);
+        std::copy(segment->cdays, segment->cdays + rows, copy->cdays);
+        std::copy(segment->mdays, segment->mdays + rows, copy->mdays);
+        for(size_t word = 0; word < (rows + WORD_BITS - 1) / WORD_BITS; ++word) {
+            copy->deletedBits[word].store(segment->deletedBits[word].load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+        }
+        if(rows % WORD_BITS) {
+            copy->deletedBits[rows / WORD_BITS].fetch_and((uint64_t{ 1 } << (rows % WORD_BITS)) - 1,
+                std::memory_order_relaxed);
+        }
+        std::copy(segment->tagIds, segment->tagIds + rows, copy->tagIds);
+        std::copy(segment->tagCounts, segment->tagCounts + rows, copy->tagCounts);
+        std::copy(segment->texts, segment->texts + rows, copy->texts);
+        std::copy(segment->textLengths, segment->textLengths + rows, copy->textLengths);
+        segment = std::move(copy);
+    }
+
+    return *segment;
+}
+
+void RecordStore::appendRow(const Row &row) {
+    auto &snapshot = edit();
+    auto position = snapshot.count % SEGMENT_SIZE;
+    if(snapshot.count == snapshot.segments.size() * SEGMENT_SIZE) {
+        snapshot.segments.emplace_back(new Segment());
+    }
+
+    auto &segment = *snapshot.segments.back();
+    segment.ids[position] = row.id;
+    segment.cdays[position] = row.cday;
+    segment.mdays[position] = row.mday;
+    setDeleted(segment, position, row.deleted);
+    segment.tagIds[position] = row.tagIds;
+    segment.tagCounts[position] = row.tagCount;
+    segment.texts[position] = row.text;
+    segment.textLengths[position] = row.textLength;
+    ++snapshot.count;
+}
+
+vector<size_t> RecordStore::filterRows(const vector<size_t> &rows, const function<bool(const Row&)> &pred) const {
+    vector<char> passed(rows.size());
+    ThreadPool::instance().parallelFor(0, rows.size(), CHANGE_GRAIN, [&](size_t begin, size_t end) {
+        for(auto idx = begin; idx < end; ++idx) {
+            passed[idx] = pred(readRow(rows[idx]));
+        }
+    });
+
+    vector<size_t> found;
+    for(size_t idx = 0; idx < rows.size(); ++idx) {
+        if(passed[idx]) found.push_back(rows[idx]);
+    }
+    return found;
+}
+
+void RecordStore::changeRows(const vector<size_t> &rows, const function<void(size_t, Segment&, size_t)> &change) {
+    // Draft segments are replaced by copies only here, by the calling thread
+    for(size_t idx = 0; idx < rows.size(); ++idx) {
+        if(!idx || rows[idx] / SEGMENT_SIZE != rows[idx - 1] / SEGMENT_SIZE) {
+            editSegment(rows[idx] / SEGMENT_SIZE);
+        }
+    }
+
+    ThreadPool::instance().parallelFor(0, rows.size(), CHANGE_GRAIN, [&](size_t begin, size_t end) {
+        for(auto idx = begin; idx < end; ++idx) {
+            change(idx, *draft->segments[rows[idx] / SEGMENT_SIZE], rows[idx] % SEGMENT_SIZE);
+        }
+    });
+}
+
+RecordStore::Row RecordStore::readRow(size_t row) const {
+    const auto &segment = *latest().segments[row / SEGMENT_SIZE];
+    auto i = row % SEGMENT_SIZE;
+    auto deleted = segment.deletedBits[i / WORD_BITS].load(std::memory_order_relaxed) >> (i % WORD_BITS) & 1;
+
+    return {
+        segment.ids[i],
+        segment.cdays[i],
+        segment.mdays[i],
+        deleted != 0,
+        segment.tagIds[i],
+        segment.tagCounts[i],
+        segment.texts[i],
+        segment.textLengths[i]
+    };
+}
+
+void RecordStore::setDeleted(Segment &segment, size_t row, bool state) {
+    auto bit = uint64_t{ 1 } << (row % WORD_BITS);
+    if(state) {
+        segment.deletedBits[row / WORD_BITS].fetch_or(bit, std::memory_order_relaxed);
+    } else {
+        segment.deletedBits[row / WORD_BITS].fetch_and(~bit, std::memory_order_relaxed);
+    }
+}
+
+TagId* RecordStore::storeTags(const TagSet &tags) {
+    auto size = tags.size() * sizeof(TagId);
+    auto block = reinterpret_cast<TagId*>(arena.allocate(size));
+    if(block) {
+        draftBlocks.emplace_back(reinterpret_cast<char*>(block), size);
+    }
+    std::copy(tags.begin(), tags.end(), block);
+    return block;
+}
+
+char* RecordStore::storeText(const string &text) {
+    auto block = arena.allocate(text.size());
+    if(block) {
+        draftBlocks.emplace_back(block, text.size());
+    }
+    std::copy(text.begin(), text.end(), block);
+    return block;
+}
+
+void RecordStore::retire(char *block, size_t size) {
+    if(block) {
+        retiredBlocks.emplace_back(block, size);
+    }
+}
+
+void RecordStore::freeBlocks(const vector<pair<char*, size_t>> &blocks) {
+    if(!leases.count.load()) {
+        for(const auto &block : blocks) {
+            arena.deallocate(block.first, block.second);
+        }
+        return;
+    }
+
+    lock_guard<mutex> leasesLock{ leases.leasesMutex };
+    for(const auto &block : blocks) {
+        if(leases.leased.count(block.first)) {
+            leases.retired.emplace(block.first, block.second);
+        } else {
+            arena.deallocate(block.first, block.second);
+        }
+    }
+}
@@ -2,13 +2,37 @@
 #include "response.hpp"
 
 vector<Record>& Response::getRecords() {
+    static_cast<const Response*>(this)->getRecords();
     return records;
 }
 
+const vector<Record>& Response::getRecords() const {
+    if(selection) {
+        records = selection->getRecords();
+        selection.reset();
+    }
+    return records;
+}
+
+const shared_ptr<const RecordStore::Selection>& Response::getSelection() const {
+    return selection;
+}
+
 ReturnCode Response::getCode() const {
     return code;
 }
 
 const string& Response::getSummary() const {
     return summary;
-}
\ No newline at end of file
+}
+
+std::chrono::milliseconds Response::getRetryAfter() const {
+    return retryAfter;
+}
+const vector<ReturnCode>& Response::getResults() const {
+    return results;
+}
+
+const vector<uint64_t>& Response::getCounts() const {
+    return counts;
+}
@@ -0,0 +1,46 @@
+/**
+ * TagDictionary implementation
+ */
+
+#include "tag_dictionary.hpp"
+
+using std::lock_guard;
+
+TagDictionary& TagDictionary::instance() {
+    static TagDictionary dictionary;
+    return dictionary;
+}
+
+TagId TagDictionary::intern(const string &tag) {
+    lock_guard<mutex> lock{ dictionaryMutex };
+    auto idIter = ids.find(tag);
+    if(idIter != ids.end()) {
+        return idIter->second;
+    }
+
+    TagId id = tagNames.size();
+    tagNames.push_back(tag);
+    ids.emplace(tag, id);
+    return id;
+}
+
+bool TagDictionary::find(const string &tag, TagId &id) const {
+    lock_guard<mutex> lock{ dictionaryMutex };
+    auto idIter = ids.find(tag);
+    if(idIter == ids.end()) {
+        return false;
+    }
+
+    id = idIter->second;
+    return true;
+}
+
+const string& TagDictionary::name(TagId id) const {
+    lock_guard<mutex> lock{ dictionaryMutex };
+    return tagNames.at(id);
+}
+
+vector<string> TagDictionary::names() const {
+    lock_guard<mutex> lock{ dictionaryMutex };
+    return { tagNames.begin(), tagNames.end() };
+}
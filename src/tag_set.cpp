@@ -0,0 +1,119 @@
+/**
+ * TagSet implementation
+ */
+
+#include <algorithm>
+#include "tag_set.hpp"
+
+constexpr uint32_t TagSet::INLINE_CAPACITY;
+
+TagSet::TagSet(const TagSet &other): count{ 0 }, capacity{ INLINE_CAPACITY } {
+    reserve(other.count);
+    std::copy(other.begin(), other.end(), data());
+    count = other.count;
+}
+
+TagSet::TagSet(TagSet &&other): count{ 0 }, capacity{ INLINE_CAPACITY } {
+    moveFrom(other);
+}
+
+TagSet& TagSet::operator=(TagSet other) {
+    if(capacity != INLINE_CAPACITY) {
+        delete[] heapIds;
+        capacity = INLINE_CAPACITY;
+    }
+
+    moveFrom(other);
+    return *this;
+}
+
+TagSet::~TagSet() {
+    if(capacity != INLINE_CAPACITY) {
+        delete[] heapIds;
+    }
+}
+
+bool TagSet::contains(TagId id) const {
+    // Linear scan over a few integers is cheaper than binary search
+    if(count <= 2 * INLINE_CAPACITY) {
+        return std::find(begin(), end(), id) != end();
+    }
+
+    return std::binary_search(begin(), end(), id);
+}
+
+bool TagSet::containsAll(const TagSet &other) const {
+    return std::includes(begin(), end(), other.begin(), other.end());
+}
+
+bool TagSet::insert(TagId id) {
+    auto pos = std::lower_bound(begin(), end(), id);
+    if(pos != end() && *pos == id) {
+        return false;
+    }
+
+    auto idx = pos - begin();
+    reserve(count + 1);
+    auto ids = data();
+    std::copy_backward(ids + idx, ids + count, ids + count + 1);
+    ids[idx] = id;
+    ++count;
+    return true;
+}
+
+bool TagSet::erase(TagId id) {
+    auto pos = std::lower_bound(begin(), end(), id);
+    if(pos == end() || *pos != id) {
+        return false;
+    }
+
+    auto ids = data();
+    auto idx = pos - begin();
+    std::copy(ids + idx + 1, ids + count, ids + idx);
+    --count;
+    return true;
+}
+
+size_t TagSet::size() const {
+    return count;
+}
+
+const TagId* TagSet::begin() const {
+    return capacity == INLINE_CAPACITY ? inlineIds : heapIds;
+}
+
+const TagId* TagSet::end() const {
+    return begin() + count;
+}
+
+TagId* TagSet::data() {
+    return capacity == INLINE_CAPACITY ? inlineIds : heapIds;
+}
+
+void TagSet::moveFrom(TagSet &other) {
+    if(other.capacity == INLINE_CAPACITY) {
+        std::copy(other.begin(), other.end(), inlineIds);
+    } else {
+        heapIds = other.heapIds;
+        capacity = other.capacity;
+        other.capacity = INLINE_CAPACITY;
+    }
+
+    count = other.count;
+    other.count = 0;
+}
+
+void TagSet::reserve(uint32_t size) {
+    if(size <= capacity) return;
+
+    auto newCapacity = std::max(size, 2 * capacity);
+    auto newIds = new TagId[newCapacity];
+    std::copy(begin(), end(), newIds);
+
+    if(capacity != INLINE_CAPACITY) {
+        delete[] heapIds;
+    }
+
+    heapIds = newIds;
+    capacity = newCapacity;
+}
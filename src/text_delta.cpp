@@ -0,0 +1,196 @@
+/**
+ * TextDelta implementation
+ */
+
+#include <algorithm>
+#include "text_delta.hpp"
+
+constexpr size_t TextDelta::MAX_LINE_EDITS;
+
+namespace {
+    /**
+     * Line of a text, compared by hash first
+     */
+    struct Line {
+        string_ref text;
+        uint64_t hash;
+
+        bool operator==(const Line &other) const {
+            return hash == other.hash && text == other.text;
+        }
+    };
+
+    /**
+     * Split text into lines, every line but the last one ends with a newline
+     *
+     * @param text Text
+     * @return Lines
+     */
+    vector<Line> splitLines(string_ref text) {
+        vector<Line> lines;
+        auto start = text.begin();
+        while(start != text.end()) {
+            auto end = std::find(start, text.end(), '\n');
+            end = end == text.end() ? end : end + 1;
+            string_ref line{ start, static_cast<size_t>(end - start) };
+            lines.push_back(Line{ line, TextDelta::hash(line) });
+            start = end;
+        }
+        return lines;
+    }
+
+    /**
+     * Find the shortest sequence of line deletions and insertions turning one list
+     * of lines into another (Myers' algorithm)
+     *
+     * @param a Base lines
+     * @param b Changed lines
+     * @param maxEdits Maximum number of deleted and inserted lines
+     * @param ops Output: (base line, changed line) per deletion (-1 changed line) or
+     *            insertion (base line it precedes), in ascending order
+     * @return False if more edits are needed
+     */
+    bool diffLines(const vector<Line> &a, const vector<Line> &b, size_t maxEdits,
+                   vector<std::pair<long, long>> &ops) {
+        const long n = a.size(), m = b.size();
+        const long max = std::min<long>(n + m, maxEdits);
+        // Furthest base position reached on every diagonal k = x - y, shifted by max
+        vector<long> v(2 * max + 2, 0);
+        vector<vector<long>> trace;
+
+        for(long d = 0; d <= max; ++d) {
+            trace.push_back(v);
+            for(long k = -d; k <= d; k += 2) {
+                long x = k == -d || (k != d && v[max + k - 1] < v[max + k + 1]) ?
+                    v[max + k + 1] : v[max + k - 1] + 1;
+                long y = x - k;
+                while(x < n && y < m && a[x] == b[y]) {
+                    ++x;
+                    ++y;
+                }
+                v[max + k] = x;
+                if(x < n || y < m) {
+                    continue;
+                }
+
+                // Walk back through the steps taken
+                for(long step = d; step > 0; --step) {
+                    const auto &prev = trace[step];
+                    k = x - y;
+                    auto prevK = k == -step || (k != step && prev[max + k - 1] < prev[max + k + 1]) ?
+                        k + 1 : k - 1;
+                    auto prevX = prev[max + prevK];
+                    auto prevY = prevX - prevK;
+                    if(prevK == k + 1) {
+                        ops.emplace_back(prevX, prevY);
+                    } else {
+                        ops.emplace_back(prevX, -1);
+                    }
+                    x = prevX;
+                    y = prevY;
+                }
+                std::reverse(ops.begin(), ops.end());
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+TextDelta TextDelta::diff(const string &base, const string &text) {
+    TextDelta delta;
+    delta.baseHash = hash(base);
+
+    // Lines around the changes usually are the same: only lines between the common
+    // prefix and suffix are compared
+    auto limit = std::min(base.size(), text.size());
+    size_t prefix = std::mismatch(base.begin(), base.begin() + limit, text.begin()).first - base.begin();
+    if(prefix == base.size() && prefix == text.size()) {
+        return delta;
+    }
+
+    // Common prefix and suffix consist of whole lines
+    auto newline = prefix ? base.rfind('\n', prefix - 1) : string::npos;
+    prefix = newline == string::npos ? 0 : newline + 1;
+    size_t suffix{ 0 };
+    while(suffix < limit - prefix && base[base.size() - suffix - 1] == text[text.size() - suffix - 1]) {
+        ++suffix;
+    }
+    while(suffix && suffix < base.size() - prefix && base[base.size() - suffix - 1] != '\n') {
+        --suffix;
+    }
+
+    string_ref baseMiddle{ base.data() + prefix, base.size() - prefix - suffix };
+    string_ref textMiddle{ text.data() + prefix, text.size() - prefix - suffix };
+    auto a = splitLines(baseMiddle);
+    auto b = splitLines(textMiddle);
+    vector<std::pair<long, long>> ops;
+    if(!diffLines(a, b, MAX_LINE_EDITS, ops)) {
+        delta.edits.push_back({ prefix, baseMiddle.size(), textMiddle.to_string() });
+        return delta;
+    }
+
+    // Consecutive deletions and insertions at the same position form a single edit
+    vector<size_t> offsets{ prefix };
+    for(const auto &line : a) {
+        offsets.push_back(offsets.back() + line.text.size());
+    }
+    long end{ -1 };
+    for(const auto &op : ops) {
+        if(op.first != end) {
+            delta.edits.push_back({ offsets[op.first], 0, {} });
+            end = op.first;
+        }
+        auto &edit = delta.edits.back();
+        if(op.second < 0) {
+            edit.removed += a[op.first].text.size();
+            ++end;
+        } else {
+            auto line = b[op.second].text;
+            edit.inserted.append(line.data(), line.size());
+        }
+    }
+    return delta;
+}
+
+uint64_t TextDelta::hash(string_ref text) {
+    uint64_t value{ 14695981039346656037ULL };
+    for(auto c : text) {
+        value ^= static_cast<uint8_t>(c);
+        value *= 1099511628211ULL;
+    }
+    return value;
+}
+
+bool TextDelta::isValid(size_t baseSize) const {
+    size_t position{ 0 };
+    for(const auto &edit : edits) {
+        if(edit.offset < position || edit.offset > baseSize || edit.removed > baseSize - edit.offset) {
+            return false;
+        }
+        position = edit.offset + edit.removed;
+    }
+    return true;
+}
+
+bool TextDelta::empty() const {
+    return edits.empty();
+}
+
+size_t TextDelta::resultSize(size_t baseSize) const {
+    auto size = baseSize;
+    for(const auto &edit : edits) {
+        size = size - edit.removed + edit.inserted.size();
+    }
+    return size;
+}
+
+void TextDelta::apply(string_ref base, char *out) const {
+    size_t position{ 0 };
+    for(const auto &edit : edits) {
+        out = std::copy(base.begin() + position, base.begin() + edit.offset, out);
+        out = std::copy(edit.inserted.begin(), edit.inserted.end(), out);
+        position = edit.offset + edit.removed;
+    }
+    std::copy(base.begin() + position, base.end(), out);
+}
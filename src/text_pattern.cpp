@@ -0,0 +1,79 @@
+/**
+ * TextPattern implementation
+ */
+
+#include <algorithm>
+#include <iterator>
+#include "text_pattern.hpp"
+
+TextPattern::TextPattern(const string &pattern, const string &replacement, bool regex):
+    pattern{ pattern },
+    replacement{ replacement },
+    regex{ regex }
+{
+    if(!regex) {
+        if(pattern.empty()) throw string{ "Empty pattern" };
+        return;
+    }
+
+    try {
+        expression.assign(pattern, std::regex::ECMAScript);
+    } catch(const std::regex_error &ex) {
+        throw string{ "Invalid regular expression: " } + ex.what();
+    }
+}
+
+size_t TextPattern::count(string_ref text) const {
+    if(regex) {
+        try {
+            std::cregex_iterator first{ text.begin(), text.end(), expression }, last;
+            return std::distance(first, last);
+        } catch(const std::regex_error &ex) {
+            throw string{ "Regular expression failed: " } + ex.what();
+        }
+    }
+
+    size_t matches{ 0 };
+    auto position = text.begin();
+    while((position = std::search(position, text.end(), pattern.begin(), pattern.end())) != text.end()) {
+        ++matches;
+        position += pattern.size();
+    }
+    return matches;
+}
+
+size_t TextPattern::replace(string_ref text, string &out) const {
+    auto matches = count(text);
+    if(!matches) {
+        return 0;
+    }
+
+    out.clear();
+    if(regex) {
+        try {
+            std::regex_replace(std::back_inserter(out), text.begin(), text.end(), expression, replacement);
+        } catch(const std::regex_error &ex) {
+            throw string{ "Regular expression failed: " } + ex.what();
+        }
+        return matches;
+    }
+
+    out.reserve(text.size() + matches * replacement.size() - matches * pattern.size());
+    auto position = text.begin();
+    while(true) {
+        auto found = std::search(position, text.end(), pattern.begin(), pattern.end());
+        out.append(position, found);
+        if(found == text.end()) break;
+        out.append(replacement);
+        position = found + pattern.size();
+    }
+    return matches;
+}
+
+bool TextPattern::isRegex() const {
+    return regex;
+}
+
+const string& TextPattern::getPattern() const {
+    return pattern;
+}
@@ -0,0 +1,234 @@
+/**
+ * ThreadPool implementation
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include "thread_pool.hpp"
+
+using std::lock_guard;
+using std::string;
+using std::unique_lock;
+
+constexpr size_t ThreadPool::PRIORITIES;
+
+namespace {
+    // Pool and index of the worker running on the current thread
+    thread_local const ThreadPool *workerPool{ nullptr };
+    thread_local size_t workerIndex{ 0 };
+}
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t workersCount): pending{ 0 }, sleeping{ 0 }, stopping{ false } {
+    if(!workersCount) {
+        workersCount = std::max(1u, thread::hardware_concurrency());
+    }
+
+    for(size_t worker = 0; worker < workersCount; ++worker) {
+        workerQueues.emplace_back(new TaskQueues);
+    }
+    for(size_t worker = 0; worker < workersCount; ++worker) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, worker);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stopping.store(true);
+    unique_lock<mutex> sleepLock{ sleepMutex };
+    sleepLock.unlock();
+    sleepCv.notify_all();
+
+    for(auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task &&task, TaskPriority priority) {
+    auto worker = currentWorker();
+    auto &queues = worker < workers.size() ? *workerQueues[worker] : sharedQueues;
+
+    // Counted before it's queued, so a worker taking the task never sees the counter
+    // below the number of queued tasks
+    pending.fetch_add(1);
+    unique_lock<mutex> queuesLock{ queues.queuesMutex };
+    queues.tasks[static_cast<size_t>(priority)].push_back(std::move(task));
+    queuesLock.unlock();
+
+    // Sleeping workers check the counter after announcing themselves: either they see
+    // the task, or the task submitter sees them
+    if(sleeping.load()) {
+        unique_lock<mutex> sleepLock{ sleepMutex };
+        sleepLock.unlock();
+        sleepCv.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)> &body) {
+    if(end - begin <= std::max<size_t>(grain, 1)) {
+        body(begin, end);
+        return;
+    }
+
+    // Second half is offered to other workers, the first one is processed in place
+    auto middle = begin + (end - begin) / 2;
+    TaskGroup group{ *this };
+    group.run([this, middle, end, grain, &body]{ parallelFor(middle, end, grain, body); });
+    parallelFor(begin, middle, grain, body);
+    group.wait();
+}
+
+size_t ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+    workerPool = this;
+    workerIndex = worker;
+
+    Task task;
+    while(true) {
+        if(take(worker, task)) {
+            execute(task);
+            task = nullptr;
+            continue;
+        }
+
+        unique_lock<mutex> sleepLock{ sleepMutex };
+        sleeping.fetch_add(1);
+        sleepCv.wait(sleepLock, [this]{ return pending.load() || stopping.load(); });
+        sleeping.fetch_sub(1);
+
+        if(stopping.load() && !pending.load()) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::take(size_t worker, Task &task) {
+    if(!pending.load()) {
+        return false;
+    }
+
+    for(size_t priority = 0; priority < PRIORITIES; ++priority) {
+        // Own tasks: newest first, its data is likely in cache
+        if(worker < workers.size()) {
+            auto &queues = *workerQueues[worker];
+            lock_guard<mutex> queuesLock{ queues.queuesMutex };
+            auto &tasks = queues.tasks[priority];
+            if(!tasks.empty()) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+                pending.fetch_sub(1);
+                return true;
+            }
+        }
+
+        // Shared and stolen tasks: oldest first
+        for(size_t victim = 0; victim <= workers.size(); ++victim) {
+            auto &queues = victim < workers.size() ? *workerQueues[(worker + victim + 1) % workers.size()] :
+                sharedQueues;
+            lock_guard<mutex> queuesLock{ queues.queuesMutex };
+            auto &tasks = queues.tasks[priority];
+            if(!tasks.empty()) {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                pending.fetch_sub(1);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::execute(Task &task) {
+    try {
+        task();
+    } catch(const string& ex) {
+        std::cerr << ex << std::endl;
+    } catch(...) {
+        std::cerr << "Unexpected exception in Thread Pool task" << std::endl;
+    }
+}
+
+size_t ThreadPool::currentWorker() const {
+    return workerPool == this ? workerIndex : workers.size();
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch(...) {
+        // Errors are reported by explicit wait() only
+    }
+}
+
+void TaskGroup::run(Task &&task, TaskPriority priority) {
+    auto entry = std::make_shared<Entry>();
+    entry->task = std::move(task);
+    entry->taken = false;
+    {
+        lock_guard<mutex> stateLock{ state->stateMutex };
+        ++state->active;
+        entry->position = state->queued.insert(state->queued.end(), entry);
+    }
+
+    auto groupState = state;
+    pool.submit([groupState, entry]() {
+        {
+            lock_guard<mutex> stateLock{ groupState->stateMutex };
+            if(entry->taken) return;
+            entry->taken = true;
+            groupState->queued.erase(entry->position);
+        }
+        execute(*groupState, *entry);
+    }, priority);
+}
+
+void TaskGroup::wait() {
+    unique_lock<mutex> stateLock{ state->stateMutex };
+    while(state->active) {
+        // Tasks no worker has started are executed in place, newest first
+        if(!state->queued.empty()) {
+            auto entry = state->queued.back();
+            state->queued.pop_back();
+            entry->taken = true;
+            stateLock.unlock();
+            execute(*state, *entry);
+            stateLock.lock();
+            continue;
+        }
+
+        state->completed.wait(stateLock);
+    }
+
+    if(state->error) {
+        auto groupError = state->error;
+        state->error = nullptr;
+        std::rethrow_exception(groupError);
+    }
+}
+
+void TaskGroup::execute(State &state, Entry &entry) {
+    std::exception_ptr taskError;
+    try {
+        entry.task();
+    } catch(...) {
+        taskError = std::current_exception();
+    }
+    // Captured data is released before the waiter may return
+    entry.task = nullptr;
+
+    lock_guard<mutex> stateLock{ state.stateMutex };
+    if(taskError && !state.error) {
+        state.error = taskError;
+    }
+    if(!--state.active) {
+        state.completed.notify_all();
+    }
+}
@@ -0,0 +1,112 @@
+/**
+ * Tracer implementation
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "tracing.hpp"
+
+using std::lock_guard;
+
+constexpr size_t Tracer::RING_SIZE;
+
+namespace {
+    // Ring of the current thread
+    thread_local void *currentRing{ nullptr };
+}
+
+Tracer::Ring::Ring(size_t threadIdx): threadIdx{ threadIdx }, head{ 0 }, spans{ new Span[RING_SIZE] } {
+    for(size_t idx = 0; idx < RING_SIZE; ++idx) {
+        spans[idx].name.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer(): enabled{ false } {
+    auto path = std::getenv("NOTES_TRACE");
+    if(path && *path) {
+        exitPath = path;
+        enabled.store(true);
+    }
+}
+
+Tracer::~Tracer() {
+    if(exitPath.empty()) {
+        return;
+    }
+
+    try {
+        dump(exitPath);
+    } catch(const string& ex) {
+        std::cerr << ex << std::endl;
+    }
+}
+
+void Tracer::setEnabled(bool state) {
+    enabled.store(state);
+}
+
+void Tracer::record(const char *name, uint64_t start, uint64_t end) {
+    if(!isEnabled()) {
+        return;
+    }
+
+    // Single writer: the oldest span is overwritten once the ring is full
+    auto &ring = threadRing();
+    auto head = ring.head.load(std::memory_order_relaxed);
+    auto &span = ring.spans[head & (RING_SIZE - 1)];
+    span.name.store(name, std::memory_order_relaxed);
+    span.start.store(start, std::memory_order_relaxed);
+    span.duration.store(end > start ? end - start : 0, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::dump(std::ostream &os) const {
+    lock_guard<mutex> ringsLock{ ringsMutex };
+    os << "{\"traceEvents\":[";
+    os << std::fixed << std::setprecision(3);
+
+    bool first{ true };
+    for(const auto &ring : rings) {
+        auto head = ring->head.load(std::memory_order_acquire);
+        // Spans which may be overwritten while dumped are skipped
+        auto tail = head > RING_SIZE ? head - RING_SIZE + 1 : 0;
+        for(auto pos = tail; pos < head; ++pos) {
+            const auto &span = ring->spans[pos & (RING_SIZE - 1)];
+            auto name = span.name.load(std::memory_order_relaxed);
+            if(!name) {
+                continue;
+            }
+
+            os << (first ? "\n" : ",\n");
+            first = false;
+            os << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadIdx
+               << ",\"ts\":" << span.start.load(std::memory_order_relaxed) / 1000.0
+               << ",\"dur\":" << span.duration.load(std::memory_order_relaxed) / 1000.0 << '}';
+        }
+    }
+
+    os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void Tracer::dump(const string &path) const {
+    std::ofstream ofs(path);
+    if(!ofs.is_open()) throw string{ "Cannot open trace file " + path };
+    dump(ofs);
+}
+
+Tracer::Ring& Tracer::threadRing() {
+    if(!currentRing) {
+        lock_guard<mutex> ringsLock{ ringsMutex };
+        rings.emplace_back(new Ring{ rings.size() });
+        currentRing = rings.back().get();
+    }
+
+    return *static_cast<Ring*>(currentRing);
+}
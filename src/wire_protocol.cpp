@@ -0,0 +1,444 @@
+/**
+ * Wire protocol implementation
+ */
+
+#include "core_action.hpp"
+#include "tag_dictionary.hpp"
+#include "wire_protocol.hpp"
+
+using boost::gregorian::date;
+
+constexpr uint8_t WireProtocol::VERSION;
+constexpr size_t WireProtocol::FRAME_HEADER_SIZE;
+constexpr size_t WireProtocol::MIN_REFERENCED_TEXT;
+
+namespace {
+    // Encoded dates are shifted by the number of special values
+    constexpr uint64_t NOT_A_DATE{ 0 };
+    constexpr uint64_t NEG_INFINITY{ 1 };
+    constexpr uint64_t POS_INFINITY{ 2 };
+    constexpr uint64_t DATE_OFFSET{ 3 };
+}
+
+void WireWriter::putHeader(MessageType type) {
+    putByte(WireProtocol::VERSION);
+    putByte(static_cast<uint8_t>(type));
+}
+
+void WireWriter::putByte(uint8_t value) {
+    out.push_back(static_cast<char>(value));
+}
+
+void WireWriter::putVarint(uint64_t value) {
+    while(value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void WireWriter::putSignedVarint(int64_t value) {
+    putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void WireWriter::putString(string_ref value) {
+    putVarint(value.size());
+    out.append(value.data(), value.size());
+}
+
+void WireWriter::putStrings(const vector<string> &values) {
+    putVarint(values.size());
+    for(const auto &value : values) {
+        putString(value);
+    }
+}
+
+void WireWriter::putDate(const date &value) {
+    if(value.is_not_a_date()) {
+        putVarint(NOT_A_DATE);
+    } else if(value.is_neg_infinity()) {
+        putVarint(NEG_INFINITY);
+    } else if(value.is_pos_infinity()) {
+        putVarint(POS_INFINITY);
+    } else {
+        putVarint(value.day_number() + DATE_OFFSET);
+    }
+}
+
+void WireWriter::putRecord(const Record &record) {
+    putSignedVarint(record.getId());
+    putString(record.getText());
+    putRecordFields(record);
+}
+
+void WireWriter::putRecordFields(const Record &record) {
+    auto &dictionary = TagDictionary::instance();
+    putVarint(record.getTagIds().size());
+    for(auto tag : record.getTagIds()) {
+        putString(dictionary.name(tag));
+    }
+    putDate(record.getCreationDate());
+    putDate(record.getModificationDate());
+    putByte(record.isDeleted());
+}
+
+void WireWriter::putQuery(const RecordQuery &query) {
+    putByte(query.deleted);
+    putStrings(query.allTags);
+    putStrings(query.anyTags);
+    putDate(query.cdateAfter);
+    putDate(query.cdateBefore);
+    putDate(query.mdateAfter);
+    putDate(query.mdateBefore);
+    putString(query.fragment);
+}
+
+void WireWriter::putDelta(const TextDelta &delta) {
+    putVarint(delta.baseHash);
+    putVarint(delta.edits.size());
+    for(const auto &edit : delta.edits) {
+        putVarint(edit.offset);
+        putVarint(edit.removed);
+        putString(edit.inserted);
+    }
+}
+
+MessageType WireReader::getHeader() {
+    if(getByte() != WireProtocol::VERSION) {
+        throw string{ "Unsupported protocol version" };
+    }
+
+    auto type = getByte();
+    if(type < static_cast<uint8_t>(MessageType::ADD_RECORD) || type > static_cast<uint8_t>(MessageType::REPLACE_TEXT)) {
+        throw string{ "Unknown message type" };
+    }
+    return static_cast<MessageType>(type);
+}
+
+uint8_t WireReader::getByte() {
+    if(pos >= message.size()) throw string{ "Truncated message" };
+    return static_cast<uint8_t>(message[pos++]);
+}
+
+uint64_t WireReader::getVarint() {
+    uint64_t value{ 0 };
+    for(unsigned shift = 0; shift < 64; shift += 7) {
+        auto byte = getByte();
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw string{ "Malformed integer" };
+}
+
+int64_t WireReader::getSignedVarint() {
+    auto value = getVarint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+string_ref WireReader::getString() {
+    auto size = getVarint();
+    if(size > message.size() - pos) throw string{ "Truncated message" };
+
+    auto value = message.substr(pos, size);
+    pos += size;
+    return value;
+}
+
+vector<string> WireReader::getStrings() {
+    auto count = getCount();
+    vector<string> values;
+    values.reserve(count);
+    for(size_t idx = 0; idx < count; ++idx) {
+        values.push_back(getString().to_string());
+    }
+    return values;
+}
+
+date WireReader::getDate() {
+    static const auto MIN_DAY = date{ boost::gregorian::min_date_time }.day_number();
+    static const auto MAX_DAY = date{ boost::gregorian::max_date_time }.day_number();
+
+    auto value = getVarint();
+    switch(value) {
+    case NOT_A_DATE: return date{ boost::gregorian::not_a_date_time };
+    case NEG_INFINITY: return date{ boost::gregorian::neg_infin };
+    case POS_INFINITY: return date{ boost::gregorian::pos_infin };
+    }
+
+    value -= DATE_OFFSET;
+    if(value < MIN_DAY || value > MAX_DAY) throw string{ "Malformed date" };
+    return date{ static_cast<date::date_int_type>(value) };
+}
+
+Record WireReader::getRecord() {
+    auto &dictionary = TagDictionary::instance();
+    auto id = static_cast<int>(getSignedVarint());
+    auto text = getString();
+    auto count = getCount();
+    TagSet tags;
+    for(size_t idx = 0; idx < count; ++idx) {
+        tags.insert(dictionary.intern(getString().to_string()));
+    }
+    auto cdate = getDate();
+    auto mdate = getDate();
+    bool deleted = getByte() != 0;
+    return { id, text.to_string(), std::move(tags), cdate, mdate, deleted };
+}
+
+RecordQuery WireReader::getQuery() {
+    RecordQuery query;
+    query.deleted = getByte() != 0;
+    query.allTags = getStrings();
+    query.anyTags = getStrings();
+    query.cdateAfter = getDate();
+    query.cdateBefore = getDate();
+    query.mdateAfter = getDate();
+    query.mdateBefore = getDate();
+    query.fragment = getString().to_string();
+    return query;
+}
+
+TextDelta WireReader::getDelta() {
+    TextDelta delta;
+    delta.baseHash = getVarint();
+    auto count = getCount();
+    delta.edits.reserve(count);
+    for(size_t idx = 0; idx < count; ++idx) {
+        auto offset = getVarint();
+        auto removed = getVarint();
+        delta.edits.push_back({ offset, removed, getString().to_string() });
+    }
+    return delta;
+}
+
+bool WireReader::atEnd() const {
+    return pos == message.size();
+}
+
+size_t WireReader::getCount() {
+    auto count = getVarint();
+    if(count > message.size() - pos) throw string{ "Truncated message" };
+    return count;
+}
+
+void WireProtocol::encodeFrameLength(char *header, uint32_t length) {
+    for(size_t idx = 0; idx < FRAME_HEADER_SIZE; ++idx) {
+        header[idx] = static_cast<char>(length >> (8 * idx));
+    }
+}
+
+uint32_t WireProtocol::decodeFrameLength(const char *header) {
+    uint32_t length{ 0 };
+    for(size_t idx = 0; idx < FRAME_HEADER_SIZE; ++idx) {
+        length |= static_cast<uint32_t>(static_cast<uint8_t>(header[idx])) << (8 * idx);
+    }
+    return length;
+}
+
+string WireProtocol::encodeAction(const CoreAction &action) {
+    string message;
+    WireWriter writer{ message };
+    action.encode(writer);
+    return message;
+}
+
+unique_ptr<CoreAction> WireProtocol::decodeAction(string_ref message) {
+    WireReader reader{ message };
+    auto type = reader.getHeader();
+    auto priority = reader.getByte();
+    if(priority > static_cast<uint8_t>(ActionPriority::BULK)) throw string{ "Unknown Action priority" };
+
+    unique_ptr<CoreAction> action;
+    switch(type) {
+    case MessageType::ADD_RECORD: {
+        auto text = reader.getString();
+        auto tags = reader.getStrings();
+        action.reset(new AddRecordAction{ text.to_string(), std::move(tags) });
+        break;
+    }
+    case MessageType::UPDATE_RECORD:
+        action.reset(new UpdateRecordAction{ reader.getRecord() });
+        break;
+    case MessageType::SEARCH_RECORDS:
+        action.reset(new SearchRecordsAction{ reader.getQuery() });
+        break;
+    case MessageType::SET_PASSWORD:
+        action.reset(new SetPasswordAction{ reader.getString().to_string() });
+        break;
+    case MessageType::START:
+        action.reset(new StartAction);
+        break;
+    case MessageType::STATS:
+        action.reset(new StatsAction);
+        break;
+    case MessageType::BATCH: {
+        bool atomic = reader.getByte() != 0;
+        auto count = reader.getVarint();
+        vector<unique_ptr<CoreAction>> actions;
+        for(uint64_t idx = 0; idx < count; ++idx) {
+            auto item = reader.getString();
+            // Nesting is not supported, so decoding doesn't recurse deeper
+            if(WireReader{ item }.getHeader() == MessageType::BATCH) throw string{ "Nested batch" };
+            actions.push_back(decodeAction(item));
+        }
+        action.reset(new BatchAction{ std::move(actions), atomic });
+        break;
+    }
+    case MessageType::ADD_TAG: {
+        auto id = static_cast<int>(reader.getSignedVarint());
+        action.reset(new AddTagAction{ id, reader.getString().to_string() });
+        break;
+    }
+    case MessageType::REMOVE_TAG: {
+        auto id = static_cast<int>(reader.getSignedVarint());
+        action.reset(new RemoveTagAction{ id, reader.getString().to_string() });
+        break;
+    }
+    case MessageType::SET_DELETED: {
+        auto id = static_cast<int>(reader.getSignedVarint());
+        action.reset(new SetDeletedAction{ id, reader.getByte() != 0 });
+        break;
+    }
+    case MessageType::SET_TEXT: {
+        auto id = static_cast<int>(reader.getSignedVarint());
+        action.reset(new SetTextAction{ id, reader.getString().to_string() });
+        break;
+    }
+    case MessageType::EDIT_TEXT: {
+        auto id = static_cast<int>(reader.getSignedVarint());
+        action.reset(new EditTextAction{ id, reader.getDelta() });
+        break;
+    }
+    case MessageType::BULK_UPDATE: {
+        auto query = reader.getQuery();
+        auto operation = reader.getByte();
+        if(operation > static_cast<uint8_t>(BulkOperation::RESTORE)) throw string{ "Unknown bulk operation" };
+        auto tag = reader.getString();
+        action.reset(new BulkUpdateAction{ std::move(query), static_cast<BulkOperation>(operation), tag.to_string() });
+        break;
+    }
+    case MessageType::REPLACE_TEXT: {
+        auto query = reader.getQuery();
+        auto pattern = reader.getString();
+        auto replacement = reader.getString();
+        bool regex = reader.getByte() != 0;
+        bool dryRun = reader.getByte() != 0;
+        action.reset(new ReplaceTextAction{ std::move(query), pattern.to_string(), replacement.to_string(),
+            regex, dryRun });
+        break;
+    }
+    default:
+        throw string{ "Message is not an Action request" };
+    }
+
+    if(!reader.atEnd()) throw string{ "Malformed message" };
+    action->setPriority(static_cast<ActionPriority>(priority));
+    return action;
+}
+
+string WireProtocol::encodeResponse(const Response &response) {
+    const auto &records = response.getRecords();
+    // Records are the bulk of the message: text plus Id, dates and a few tags
+    size_t size{ 16 + response.getSummary().size() };
+    for(const auto &record : records) {
+        size += record.getText().size() + 16 + 8 * record.getTagIds().size();
+    }
+
+    string message;
+    message.reserve(size);
+    WireWriter writer{ message };
+    putResponseHeader(writer, response, records.size());
+    for(const auto &record : records) {
+        writer.putRecord(record);
+    }
+    return message;
+}
+
+void WireProtocol::encodeResponse(const Response &response, OutputBuffer &out) {
+    auto selection = response.getSelection();
+    if(!selection) {
+        out.append(encodeResponse(response));
+        return;
+    }
+
+    // Fields around the text are collected in a small message, flushed into the output
+    // before every referenced text. The output keeps only the referenced text alive,
+    // the snapshot is unpinned once the response is encoded
+    const auto &snapshot = selection->getSnapshot();
+    auto lease = selection->leaseText(MIN_REFERENCED_TEXT);
+    string message;
+    WireWriter writer{ message };
+    putResponseHeader(writer, response, selection->getRows().size());
+    for(auto row : selection->getRows()) {
+        auto record = snapshot.get(row, false);
+        auto text = snapshot.getText(row);
+        writer.putSignedVarint(record.getId());
+        if(text.size() < MIN_REFERENCED_TEXT) {
+            writer.putString(text);
+        } else {
+            writer.putVarint(text.size());
+            out.append(message.data(), message.size());
+            message.clear();
+            out.appendRef(text, lease);
+        }
+        writer.putRecordFields(record);
+    }
+    out.append(message.data(), message.size());
+}
+
+Response WireProtocol::decodeResponse(string_ref message) {
+    WireReader reader{ message };
+    if(reader.getHeader() != MessageType::RESPONSE) throw string{ "Message is not a response" };
+
+    auto code = reader.getByte();
+    if(code > static_cast<uint8_t>(ReturnCode::CONFLICT)) throw string{ "Unknown return code" };
+    std::chrono::milliseconds retryAfter{ reader.getVarint() };
+    auto summary = reader.getString();
+    auto resultsCount = reader.getVarint();
+    vector<ReturnCode> results;
+    for(uint64_t idx = 0; idx < resultsCount; ++idx) {
+        auto result = reader.getByte();
+        if(result > static_cast<uint8_t>(ReturnCode::CONFLICT)) throw string{ "Unknown return code" };
+        results.push_back(static_cast<ReturnCode>(result));
+    }
+    auto countsCount = reader.getVarint();
+    vector<uint64_t> counts;
+    for(uint64_t idx = 0; idx < countsCount; ++idx) {
+        counts.push_back(reader.getVarint());
+    }
+    auto count = reader.getVarint();
+    vector<Record> records;
+    for(uint64_t idx = 0; idx < count; ++idx) {
+        records.push_back(reader.getRecord());
+    }
+    if(!reader.atEnd()) throw string{ "Malformed message" };
+
+    if(retryAfter.count()) {
+        return { static_cast<ReturnCode>(code), retryAfter };
+    }
+    if(!counts.empty()) {
+        return { static_cast<ReturnCode>(code), std::move(counts) };
+    }
+    if(!results.empty()) {
+        return { static_cast<ReturnCode>(code), summary.to_string(), std::move(results) };
+    }
+    return { static_cast<ReturnCode>(code), std::move(records), summary.to_string() };
+}
+
+void WireProtocol::putResponseHeader(WireWriter &writer, const Response &response, size_t count) {
+    writer.putHeader(MessageType::RESPONSE);
+    writer.putByte(static_cast<uint8_t>(response.getCode()));
+    writer.putVarint(response.getRetryAfter().count());
+    writer.putString(response.getSummary());
+    writer.putVarint(response.getResults().size());
+    for(auto result : response.getResults()) {
+        writer.putByte(static_cast<uint8_t>(result));
+    }
+    writer.putVarint(response.getCounts().size());
+    for(auto count : response.getCounts()) {
+        writer.putVarint(count);
+    }
+    writer.putVarint(count);
+}